@@ -0,0 +1,70 @@
+/* Copyright (c) 2021 Connected Way, LLC. All rights reserved.
+ * Use of this source code is governed by a Creative Commons
+ * Attribution-NoDerivatives 4.0 International license that can be
+ * found in the LICENSE file.
+ */
+#if !defined(__OFC_BUFPOOL_WINDOWS_H__)
+#define __OFC_BUFPOOL_WINDOWS_H__
+
+#include "ofc/types.h"
+
+/**
+ * \defgroup bufpool_windows Windows Shared Receive Buffer Pool
+ *
+ * A process wide pool of fixed size receive buffers.  Sockets borrow a
+ * buffer only when data is ready and the caller returns it once the
+ * message has been consumed.  Each thread keeps a small cache of buffers
+ * so the common path does not touch the shared free list.
+ */
+
+/** \{ */
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif
+  /**
+   * Initialize the pool.  It is prefilled to the low watermark when
+   * the first buffer is borrowed.
+   */
+  OFC_VOID ofc_bufpool_init(OFC_VOID) ;
+  /**
+   * Borrow a buffer of ofc_bufpool_size bytes
+   *
+   * \returns
+   * Pointer to the buffer or OFC_NULL if memory is exhausted
+   */
+  OFC_VOID *ofc_bufpool_alloc(OFC_VOID) ;
+  /**
+   * Return a buffer obtained from ofc_bufpool_alloc
+   *
+   * \param buf
+   * The buffer to return
+   */
+  OFC_VOID ofc_bufpool_free(OFC_VOID *buf) ;
+  /**
+   * Size of each pooled buffer in bytes
+   */
+  OFC_SIZET ofc_bufpool_size(OFC_VOID) ;
+  /**
+   * Return the calling thread's cached buffers to the shared pool.
+   *
+   * Called when a thread exits so its cache is not stranded.
+   */
+  OFC_VOID ofc_bufpool_thread_flush(OFC_VOID) ;
+  /**
+   * Report pool usage
+   *
+   * \param outstanding
+   * Receives the number of buffers currently borrowed
+   *
+   * \param pooled
+   * Receives the number of buffers on the shared free list
+   */
+  OFC_VOID ofc_bufpool_stats(OFC_INT *outstanding, OFC_INT *pooled) ;
+#if defined(__cplusplus)
+}
+#endif
+
+/** \} */
+#endif
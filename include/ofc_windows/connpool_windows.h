@@ -0,0 +1,75 @@
+/* Copyright (c) 2021 Connected Way, LLC. All rights reserved.
+ * Use of this source code is governed by a Creative Commons
+ * Attribution-NoDerivatives 4.0 International license that can be
+ * found in the LICENSE file.
+ */
+#if !defined(__OFC_CONNPOOL_WINDOWS_H__)
+#define __OFC_CONNPOOL_WINDOWS_H__
+
+#include "ofc/types.h"
+#include "ofc/net.h"
+
+/**
+ * \defgroup connpool_windows Windows Outgoing Connection Pool
+ *
+ * A process wide pool of idle connected stream sockets keyed by remote
+ * address and port.  Checkout and checkin are constant time.  Sockets
+ * are health checked on checkout and evicted once idle for
+ * OFC_CONNPOOL_IDLE_TIMEOUT milliseconds.  Eviction runs from a timer,
+ * so idle sockets are closed even when the pool is not used.
+ */
+
+/** \{ */
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif
+  /**
+   * Initialize the pool
+   */
+  OFC_VOID ofc_connpool_init(OFC_VOID) ;
+  /**
+   * Close every idle socket in the pool
+   */
+  OFC_VOID ofc_connpool_flush(OFC_VOID) ;
+  /**
+   * Take an idle connected socket to ip and port out of the pool
+   *
+   * \param ip
+   * Remote address of the connection
+   *
+   * \param port
+   * Remote port of the connection
+   *
+   * \returns
+   * A socket implementation handle, or OFC_HANDLE_NULL if none is idle.
+   * The caller then creates and connects a socket as usual.
+   */
+  OFC_HANDLE ofc_connpool_checkout(const OFC_IPADDR *ip, OFC_UINT16 port) ;
+  /**
+   * Return a connected socket to the pool.  The pool takes ownership
+   * and closes the socket if it is no longer connected or the pool for
+   * its address is full.
+   *
+   * \param hSocket
+   * Socket implementation handle of the connection
+   *
+   * \param ip
+   * Remote address the socket is connected to
+   *
+   * \param port
+   * Remote port the socket is connected to
+   */
+  OFC_VOID ofc_connpool_checkin(OFC_HANDLE hSocket,
+                                const OFC_IPADDR *ip, OFC_UINT16 port) ;
+  /**
+   * Close sockets idle for longer than the idle timeout
+   */
+  OFC_VOID ofc_connpool_evict(OFC_VOID) ;
+#if defined(__cplusplus)
+}
+#endif
+
+/** \} */
+#endif
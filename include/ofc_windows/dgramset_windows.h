@@ -0,0 +1,77 @@
+/* Copyright (c) 2021 Connected Way, LLC. All rights reserved.
+ * Use of this source code is governed by a Creative Commons
+ * Attribution-NoDerivatives 4.0 International license that can be
+ * found in the LICENSE file.
+ */
+#if !defined(__OFC_DGRAMSET_WINDOWS_H__)
+#define __OFC_DGRAMSET_WINDOWS_H__
+
+#include "ofc/types.h"
+#include "ofc/net.h"
+
+/**
+ * \defgroup dgramset_windows Windows Per Interface Datagram Sockets
+ *
+ * A managed set of datagram sockets, one bound to each interface that
+ * is up.  A payload can be sent to the broadcast (IPv4) or all nodes
+ * multicast (IPv6) address of every interface in one call.
+ *
+ * The set is rebuilt only by ofc_dgram_set_refresh, never behind the
+ * caller's back, so handles from ofc_dgram_set_socket that were added
+ * to a waitset stay valid until a refresh reports a rebuild.  Call it
+ * when the interface addresses may have changed and fetch the handles
+ * again when it returns OFC_TRUE.
+ */
+
+/** \{ */
+
+typedef struct _OFC_DGRAM_SET OFC_DGRAM_SET ;
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif
+  /**
+   * Create a set with a socket bound to port on every interface
+   */
+  OFC_DGRAM_SET *ofc_dgram_set_create(OFC_UINT16 port) ;
+  OFC_VOID ofc_dgram_set_destroy(OFC_DGRAM_SET *set) ;
+  /**
+   * Rebuild the set if the interface addresses changed
+   *
+   * \returns
+   * OFC_TRUE if the set was rebuilt.  Socket handles obtained from the
+   * set before the rebuild are no longer valid.
+   */
+  OFC_BOOL ofc_dgram_set_refresh(OFC_DGRAM_SET *set) ;
+  /**
+   * Send a payload to the broadcast or multicast address of every
+   * interface in the set as last built
+   *
+   * \returns
+   * Number of interfaces the payload was sent on
+   */
+  OFC_INT ofc_dgram_set_broadcast(OFC_DGRAM_SET *set,
+                                  const OFC_VOID *buf, OFC_SIZET len,
+                                  OFC_UINT16 port) ;
+  OFC_INT ofc_dgram_set_count(OFC_DGRAM_SET *set) ;
+  /**
+   * Get the socket bound to an interface
+   *
+   * \param index
+   * Index of the interface within the set
+   *
+   * \param ip
+   * Receives the interface address.  May be OFC_NULL.
+   *
+   * \returns
+   * The socket implementation handle or OFC_HANDLE_NULL
+   */
+  OFC_HANDLE ofc_dgram_set_socket(OFC_DGRAM_SET *set, OFC_INT index,
+                                  OFC_IPADDR *ip) ;
+#if defined(__cplusplus)
+}
+#endif
+
+/** \} */
+#endif
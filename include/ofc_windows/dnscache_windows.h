@@ -0,0 +1,92 @@
+/* Copyright (c) 2021 Connected Way, LLC. All rights reserved.
+ * Use of this source code is governed by a Creative Commons
+ * Attribution-NoDerivatives 4.0 International license that can be
+ * found in the LICENSE file.
+ */
+#if !defined(__OFC_DNSCACHE_WINDOWS_H__)
+#define __OFC_DNSCACHE_WINDOWS_H__
+
+#include "ofc/types.h"
+#include "ofc/net.h"
+
+/**
+ * \defgroup dnscache_windows Windows Resolver Cache
+ *
+ * An in process cache of name to address lookups.  GetAddrInfo does not
+ * report a record TTL so entries live for a configured time.  Failed
+ * lookups are cached too, for a shorter time, so an unknown name does
+ * not hit the DNS server on every reconnect.  The cache is bounded and
+ * the least recently used entry is replaced when it is full.  Lookups
+ * share a reader lock and only inserts take it exclusively.
+ */
+
+/** \{ */
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif
+  /**
+   * Initialize the cache
+   */
+  OFC_VOID ofc_dnscache_init(OFC_VOID) ;
+  /**
+   * Look up a name
+   *
+   * \param name
+   * The name to look up.  Names are compared without regard to case.
+   *
+   * \param num_addrs
+   * On input the size of the ip array.  On a hit, receives the number of
+   * addresses returned, which is zero for a cached failure.
+   *
+   * \param ip
+   * Receives the cached addresses
+   *
+   * \returns
+   * OFC_TRUE on a hit, OFC_FALSE if the name must be resolved
+   */
+  OFC_BOOL ofc_dnscache_lookup(OFC_LPCSTR name, OFC_UINT16 *num_addrs,
+                               OFC_IPADDR *ip) ;
+  /**
+   * Record the result of a lookup
+   *
+   * \param name
+   * The name that was resolved
+   *
+   * \param num_addrs
+   * Number of addresses found.  Zero records a failed lookup, which
+   * expires after OFC_DNS_CACHE_NEGATIVE_TTL instead of OFC_DNS_CACHE_TTL.
+   *
+   * \param ip
+   * The addresses found
+   */
+  OFC_VOID ofc_dnscache_insert(OFC_LPCSTR name, OFC_UINT16 num_addrs,
+                               const OFC_IPADDR *ip) ;
+  /**
+   * Drop every entry
+   *
+   * Called when the interface addresses change since the answers may
+   * depend on which networks are attached.
+   */
+  OFC_VOID ofc_dnscache_flush(OFC_VOID) ;
+  /**
+   * Report cache usage
+   *
+   * \param hits
+   * Receives the number of lookups answered from the cache
+   *
+   * \param misses
+   * Receives the number of lookups that had to be resolved
+   *
+   * \param entries
+   * Receives the number of names currently cached
+   */
+  OFC_VOID ofc_dnscache_stats(OFC_UINT32 *hits, OFC_UINT32 *misses,
+                              OFC_INT *entries) ;
+#if defined(__cplusplus)
+}
+#endif
+
+/** \} */
+#endif
@@ -0,0 +1,117 @@
+/* Copyright (c) 2021 Connected Way, LLC. All rights reserved.
+ * Use of this source code is governed by a Creative Commons
+ * Attribution-NoDerivatives 4.0 International license that can be
+ * found in the LICENSE file.
+ */
+#if !defined(__OFC_EXECUTOR_WINDOWS_H__)
+#define __OFC_EXECUTOR_WINDOWS_H__
+
+#include "ofc/types.h"
+
+/**
+ * \defgroup executor_windows Windows Work Stealing Executor
+ *
+ * A fixed set of worker threads for short background tasks.  Each
+ * worker owns a deque.  Tasks submitted from a worker go on the bottom
+ * of its own deque and are run newest first.  Tasks submitted from
+ * other threads are spread across the workers.  An idle worker steals
+ * the oldest task from the top of another worker's deque.
+ *
+ * The module also keeps a cache of parked OS threads so that short
+ * lived ofc_thread_create threads can reuse an OS thread instead of
+ * creating a new one.  See OFC_THREAD_POOLED.
+ */
+
+/** \{ */
+
+typedef struct _OFC_EXECUTOR_TASK OFC_EXECUTOR_TASK ;
+
+typedef OFC_VOID (*OFC_EXECUTOR_FN)(OFC_VOID *context) ;
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif
+  /**
+   * Start the workers
+   *
+   * Called on first submit, so calling it is only needed to pay the
+   * cost up front.  Starts OFC_EXECUTOR_WORKERS workers, or one per
+   * processor if that is zero.
+   */
+  OFC_VOID ofc_executor_init(OFC_VOID) ;
+  /**
+   * Submit a task that will be waited for
+   *
+   * \param fn
+   * Function to run
+   *
+   * \param context
+   * Argument passed to fn
+   *
+   * \returns
+   * The task, which must be passed to ofc_executor_wait, or OFC_NULL if
+   * it could not be queued
+   */
+  OFC_EXECUTOR_TASK *ofc_executor_submit(OFC_EXECUTOR_FN fn,
+                                         OFC_VOID *context) ;
+  /**
+   * Submit a task that nobody waits for
+   *
+   * \param fn
+   * Function to run
+   *
+   * \param context
+   * Argument passed to fn
+   *
+   * \returns
+   * OFC_TRUE if the task was queued
+   */
+  OFC_BOOL ofc_executor_post(OFC_EXECUTOR_FN fn, OFC_VOID *context) ;
+  /**
+   * Wait for a task to finish and release it
+   *
+   * A worker that waits runs other queued tasks in the meantime, so
+   * tasks may wait on tasks they submit.
+   *
+   * \param task
+   * The task returned by ofc_executor_submit
+   */
+  OFC_VOID ofc_executor_wait(OFC_EXECUTOR_TASK *task) ;
+  /**
+   * Report executor usage
+   *
+   * \param workers
+   * Receives the number of workers
+   *
+   * \param queued
+   * Receives the number of tasks waiting for a worker
+   *
+   * \param stolen
+   * Receives the number of tasks run by a worker that did not own them
+   */
+  OFC_VOID ofc_executor_stats(OFC_INT *workers, OFC_INT *queued,
+                              OFC_UINT32 *stolen) ;
+  /**
+   * Run a function on a pooled OS thread
+   *
+   * A parked thread is reused if there is one, otherwise a new one is
+   * created.  Once the function returns the thread parks for up to
+   * OFC_THREAD_POOL_IDLE milliseconds before it exits.
+   *
+   * \param fn
+   * Function to run
+   *
+   * \param context
+   * Argument passed to fn
+   *
+   * \returns
+   * OFC_TRUE if the function was started
+   */
+  OFC_BOOL ofc_executor_spawn(OFC_EXECUTOR_FN fn, OFC_VOID *context) ;
+#if defined(__cplusplus)
+}
+#endif
+
+/** \} */
+#endif
@@ -0,0 +1,74 @@
+/* Copyright (c) 2021 Connected Way, LLC. All rights reserved.
+ * Use of this source code is governed by a Creative Commons
+ * Attribution-NoDerivatives 4.0 International license that can be
+ * found in the LICENSE file.
+ */
+#if !defined(__OFC_NET_WINDOWS_H__)
+#define __OFC_NET_WINDOWS_H__
+
+#include "ofc/types.h"
+
+/**
+ * \defgroup net_windows_ext Windows Network Extensions
+ *
+ * The interface table is enumerated once and cached.  It is rebuilt
+ * when the system reports an address change, at which point every
+ * event registered through ofc_net_register_config is set.
+ */
+
+/** \{ */
+
+/**
+ * Link details of an interface
+ */
+typedef struct
+{
+  /** Interface index, zero if no adapter carries the address */
+  OFC_UINT32 ifindex ;
+  /** Largest packet the link carries */
+  OFC_UINT32 mtu ;
+  /** Transmit speed in bits per second */
+  OFC_UINT64 speed ;
+  /** IANA ifType such as IF_TYPE_ETHERNET_CSMACD */
+  OFC_UINT32 type ;
+  /** Receive side scaling is enabled */
+  OFC_BOOL rss ;
+} OFC_NET_WIN32_INFO ;
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif
+  /**
+   * Generation of the cached interface table
+   *
+   * \returns
+   * A counter that changes every time the table is rebuilt.  Callers
+   * that keep per interface state can compare it against the value they
+   * saw last to tell whether they need to rebuild.
+   */
+  OFC_UINT32 ofc_net_win32_generation(OFC_VOID) ;
+  /**
+   * Get the link details of an interface
+   *
+   * Upper layers use these to size transfers and to pick and weight
+   * interfaces for multichannel.  Receive side scaling is a stack wide
+   * setting, so every interface reports the same value.
+   *
+   * \param index
+   * Index of the interface, as passed to ofc_net_interface_addr
+   *
+   * \param info
+   * Receives the link details
+   *
+   * \returns
+   * OFC_TRUE if the index names an interface
+   */
+  OFC_BOOL ofc_net_win32_interface_info(OFC_INT index,
+                                        OFC_NET_WIN32_INFO *info) ;
+#if defined(__cplusplus)
+}
+#endif
+
+/** \} */
+#endif
@@ -0,0 +1,144 @@
+/* Copyright (c) 2021 Connected Way, LLC. All rights reserved.
+ * Use of this source code is governed by a Creative Commons
+ * Attribution-NoDerivatives 4.0 International license that can be
+ * found in the LICENSE file.
+ */
+#if !defined(__OFC_RESOLVE_WINDOWS_H__)
+#define __OFC_RESOLVE_WINDOWS_H__
+
+#include "ofc/types.h"
+#include "ofc/handle.h"
+#include "ofc/net.h"
+
+/**
+ * \defgroup resolve_windows Windows Asynchronous Name Resolution
+ *
+ * Resolves a name without blocking the calling scheduler thread.  Each
+ * request owns a manual reset event that is set when the request
+ * finishes, so it can be added to a wait set like any other event.
+ * Requests finish when the lookup completes, when their timeout expires
+ * or when they are cancelled.
+ *
+ * Lookups are posted with GetAddrInfoExW and overlapped completion on
+ * Windows 8 and later.  Older targets run the blocking resolver on a
+ * thread pool worker instead.  Results go through the resolver cache in
+ * both cases.  Tests can replace the system resolver with a local stub.
+ */
+
+/** \{ */
+
+typedef struct _OFC_RESOLVE OFC_RESOLVE ;
+
+typedef enum
+  {
+    OFC_RESOLVE_PENDING = 0,
+    OFC_RESOLVE_DONE,
+    OFC_RESOLVE_FAILED,
+    OFC_RESOLVE_TIMEOUT,
+    OFC_RESOLVE_CANCELLED
+  } OFC_RESOLVE_STATUS ;
+
+/**
+ * A local stand in for the system resolver
+ *
+ * \param name
+ * The name to resolve
+ *
+ * \param num_addrs
+ * On input the size of the ip array.  Receives the number of addresses
+ * returned.
+ *
+ * \param ip
+ * Receives the addresses
+ *
+ * \returns
+ * Zero or a Winsock error such as WSAHOST_NOT_FOUND
+ */
+typedef OFC_INT (*OFC_RESOLVE_STUB)(OFC_LPCSTR name, OFC_UINT16 *num_addrs,
+                                    OFC_IPADDR *ip) ;
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif
+  /**
+   * Start resolving a name
+   *
+   * Literal addresses and cached names finish before this returns.
+   *
+   * \param name
+   * The name to resolve
+   *
+   * \param timeout
+   * Milliseconds to wait for an answer, or zero to wait indefinitely
+   *
+   * \returns
+   * The request or OFC_NULL if it could not be started
+   */
+  OFC_RESOLVE *ofc_resolve_start(OFC_LPCSTR name, OFC_MSTIME timeout) ;
+  /**
+   * Get the event set when the request finishes
+   *
+   * \param resolve
+   * The request
+   *
+   * \returns
+   * A manual reset event owned by the request
+   */
+  OFC_HANDLE ofc_resolve_event(OFC_RESOLVE *resolve) ;
+  /**
+   * Get the state and the addresses of a request
+   *
+   * \param resolve
+   * The request
+   *
+   * \param num_addrs
+   * On input the size of the ip array.  Receives the number of
+   * addresses returned, which is zero unless the request is done.
+   *
+   * \param ip
+   * Receives the addresses
+   *
+   * \returns
+   * The request status
+   */
+  OFC_RESOLVE_STATUS ofc_resolve_result(OFC_RESOLVE *resolve,
+                                        OFC_UINT16 *num_addrs,
+                                        OFC_IPADDR *ip) ;
+  /**
+   * Cancel a pending request
+   *
+   * The request finishes with OFC_RESOLVE_CANCELLED.  It has no effect
+   * on a request that already finished.
+   *
+   * \param resolve
+   * The request
+   */
+  OFC_VOID ofc_resolve_cancel(OFC_RESOLVE *resolve) ;
+  /**
+   * Release a request
+   *
+   * A pending request is cancelled first.  The event returned by
+   * ofc_resolve_event must be removed from any wait set beforehand.
+   *
+   * \param resolve
+   * The request
+   */
+  OFC_VOID ofc_resolve_destroy(OFC_RESOLVE *resolve) ;
+  /**
+   * Send lookups to a local stub instead of the system resolver
+   *
+   * Meant for tests.  The stub runs on a thread pool worker and may
+   * block to stand in for a slow server.  Its answers go through the
+   * resolver cache like any other.  Set it before starting requests.
+   *
+   * \param stub
+   * The stub, or OFC_NULL for the system resolver
+   */
+  OFC_VOID ofc_resolve_set_stub(OFC_RESOLVE_STUB stub) ;
+#if defined(__cplusplus)
+}
+#endif
+
+/** \} */
+#endif
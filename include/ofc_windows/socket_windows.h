@@ -6,11 +6,197 @@
 #if !defined(__OFC_SOCKET_WINDOWS_H__)
 #define __OFC_SOCKET_WINDOWS_H__
 
+#include "ofc_windows/sockmem_windows.h"
+
+/*
+ * A group of sockets sharing a single notification event
+ */
+typedef struct _OFC_SOCKET_GROUP OFC_SOCKET_GROUP ;
+/*
+ * A socket borrowed for I/O outside the handle lock
+ */
+typedef struct _OFC_SOCKET_IMPL OFC_SOCKET_BORROW ;
+
 #if defined(__cplusplus)
 extern "C"
 {
 #endif
+  OFC_VOID ofc_socket_win32_init (OFC_VOID) ;
+  /*
+   * Stop the background thread that finishes graceful closes.  Sockets
+   * still draining are reset.
+   *
+   * The core has no network teardown hook for this layer, so the
+   * application calls this during its own shutdown, after its last
+   * socket is closed and before WSACleanup or unloading the library.
+   * It must not be called from DllMain since it waits for the thread.
+   * Without the call the thread lives until the process exits, which
+   * also ends any drain still in progress.
+   */
+  OFC_VOID ofc_socket_win32_shutdown (OFC_VOID) ;
   HANDLE ofc_socket_get_win32_handle (OFC_HANDLE hSocket) ;
+  /*
+   * Receive into a buffer borrowed from the shared receive pool.
+   * On a non zero return, *pbuf holds the data and must be released
+   * with ofc_bufpool_free.
+   */
+  OFC_SIZET ofc_socket_win32_recv_pooled (OFC_HANDLE hSocket,
+                                          OFC_VOID **pbuf) ;
+  /*
+   * Socket groups.  Members of a group are bound to the group's event
+   * rather than an event of their own, so many sockets cost one kernel
+   * object and one wait slot.  When the event fires, sweep the group to
+   * find which members are ready.  The events found stay pending on each
+   * member until ofc_socket_impl_test reports them.
+   */
+  OFC_SOCKET_GROUP *ofc_socket_win32_group_create (OFC_VOID) ;
+  /*
+   * Fails if the group still has members
+   */
+  OFC_BOOL ofc_socket_win32_group_destroy (OFC_SOCKET_GROUP *group) ;
+  OFC_BOOL ofc_socket_win32_group_join (OFC_SOCKET_GROUP *group,
+                                        OFC_HANDLE hSocket) ;
+  OFC_VOID ofc_socket_win32_group_leave (OFC_HANDLE hSocket) ;
+  OFC_SOCKET_GROUP *ofc_socket_win32_get_group (OFC_HANDLE hSocket) ;
+  HANDLE ofc_socket_win32_group_event (OFC_SOCKET_GROUP *group) ;
+  OFC_INT ofc_socket_win32_group_count (OFC_SOCKET_GROUP *group) ;
+  /*
+   * Returns the number of members with pending events.  With the
+   * WSAPoll backend (OFC_SOCKET_WSAPOLL) this is a single WSAPoll over
+   * the group's persistent poll array, otherwise WSAEnumNetworkEvents
+   * on each member.
+   */
+  OFC_INT ofc_socket_win32_group_sweep (OFC_SOCKET_GROUP *group) ;
+  /*
+   * Events already known to be ready on a socket without a system call
+   */
+  OFC_SOCKET_EVENT_TYPE ofc_socket_win32_pending (OFC_HANDLE hSocket) ;
+  /*
+   * Connect a stream socket, sending the first payload with the SYN
+   * (TCP Fast Open).  *sent is the number of payload bytes queued with
+   * the connect.  It is zero when fast open is not available and the
+   * call fell back to a plain connect.
+   */
+  OFC_BOOL ofc_socket_win32_connect_fast (OFC_HANDLE hSocket,
+                                          const OFC_IPADDR *ip,
+                                          OFC_UINT16 port,
+                                          const OFC_VOID *buf,
+                                          OFC_SIZET len,
+                                          OFC_SIZET *sent) ;
+  OFC_BOOL ofc_socket_win32_fast_open_used (OFC_HANDLE hSocket) ;
+  /*
+   * Cork a socket so small sends are coalesced in a per socket buffer.
+   * The buffer is flushed on uncork, once it passes a size threshold,
+   * or after a short deadline.
+   */
+  OFC_BOOL ofc_socket_win32_cork (OFC_HANDLE hSocket, OFC_BOOL onoff) ;
+  /*
+   * Run deferred socket work.  Returns the milliseconds until the socket
+   * needs service again.  Called by the wait set on every wait.
+   */
+  OFC_MSTIME ofc_socket_win32_service (OFC_HANDLE hSocket) ;
+  OFC_VOID ofc_socket_win32_send_stats (OFC_UINT32 *calls,
+                                        OFC_UINT32 *syscalls) ;
+  /*
+   * Receive one complete NetBIOS session framed message from a stream
+   * socket.  The socket is read in large chunks into a per socket
+   * buffer and *msg points into that buffer until the next receive.
+   * Returns 0 if no complete message is available, -1 on error or
+   * close.
+   */
+  OFC_SIZET ofc_socket_win32_recv_frame (OFC_HANDLE hSocket,
+                                         OFC_VOID **msg) ;
+  OFC_VOID ofc_socket_win32_frame_stats (OFC_UINT32 *syscalls,
+                                         OFC_UINT32 *messages) ;
+  /*
+   * Close the socket in the background.  ofc_socket_impl_close shuts
+   * down the send side and returns at once.  A reaper thread drains the
+   * socket until the peer closes, resetting it if that takes longer
+   * than OFC_SOCKET_CLOSE_DEADLINE, and then releases it.  The default
+   * is set by OFC_SOCKET_GRACEFUL_CLOSE.
+   */
+  OFC_BOOL ofc_socket_win32_graceful_close (OFC_HANDLE hSocket,
+                                            OFC_BOOL onoff) ;
+  /*
+   * Idle mode for connections that are mostly quiet.  An idle socket
+   * holds no receive or cork buffer and shares one event with the other
+   * idle sockets.  It returns to full service when data or a close is
+   * reported.
+   */
+  OFC_BOOL ofc_socket_win32_idle (OFC_HANDLE hSocket, OFC_BOOL onoff) ;
+  /*
+   * Idle sockets, the user space bytes and kernel handles they hold and
+   * their kernel buffer sizes.  Divide by the count for the cost of one
+   * idle connection.
+   */
+  OFC_VOID ofc_socket_win32_idle_stats (OFC_INT *count, OFC_SIZET *bytes,
+                                        OFC_INT *handles, OFC_SIZET *kernel) ;
+  /*
+   * Receive timestamps, in performance counter ticks, for attributing
+   * request latency between the network and the scheduler.  Datagram
+   * sockets are stamped by the kernel where supported, others in
+   * software when unread data is first noticed.  Every receive path,
+   * pooled and framed included, reports the stamp of the data it
+   * returned.
+   */
+  OFC_BOOL ofc_socket_win32_timestamps (OFC_HANDLE hSocket, OFC_BOOL onoff) ;
+  OFC_BOOL ofc_socket_win32_rx_timestamp (OFC_HANDLE hSocket,
+                                          OFC_UINT64 *stamp,
+                                          OFC_BOOL *kernel) ;
+  OFC_UINT64 ofc_socket_win32_timestamp_age (OFC_UINT64 stamp) ;
+  /*
+   * Send buffer autotuning.  A tuned socket has SO_SNDBUF resized from
+   * its round trip time, congestion window and the stack's ideal send
+   * backlog.  The send window is what the upper layer should keep
+   * outstanding to fill the pipe without over-buffering.
+   */
+  OFC_BOOL ofc_socket_win32_autotune (OFC_HANDLE hSocket, OFC_BOOL onoff) ;
+  OFC_SIZET ofc_socket_win32_send_window (OFC_HANDLE hSocket) ;
+  /*
+   * Open a shard of a listening socket for one scheduler thread.  Each
+   * shard keeps its own AcceptEx outstanding on the shared listener and
+   * accepts only the connections the kernel completes on it.
+   * ofc_socket_impl_accept and ofc_socket_impl_test work on a shard as
+   * on the listener itself.  While a listener has shards it leaves
+   * accepts to them.  A shard that cannot post its next AcceptEx tries
+   * again from ofc_socket_win32_service.
+   */
+  OFC_HANDLE ofc_socket_win32_listen_shard (OFC_HANDLE hListen) ;
+  /*
+   * Cached readiness.  Events enumerated on a socket are kept until a
+   * receive, send or accept that would block consumes them.  *bytes is
+   * the data that can be read now, from FIONREAD only when the cached
+   * count is out of date.
+   */
+  OFC_SOCKET_EVENT_TYPE ofc_socket_win32_readiness (OFC_HANDLE hSocket,
+                                                    OFC_SIZET *bytes) ;
+  /*
+   * Check a connection at rest without consuming any of its events.
+   * Returns OFC_FALSE if data is waiting, the peer has closed it or the
+   * connection has failed.
+   */
+  OFC_BOOL ofc_socket_win32_quiet (OFC_HANDLE hSocket) ;
+  /*
+   * Borrow a socket so one thread can send while another receives
+   * without serializing on the handle lock.  The socket stays valid
+   * until returned, and a close while borrowed completes when the last
+   * borrower returns it.  Borrowed I/O bypasses corking and framed
+   * receives.
+   */
+  OFC_SOCKET_BORROW *ofc_socket_win32_borrow (OFC_HANDLE hSocket) ;
+  OFC_VOID ofc_socket_win32_return (OFC_SOCKET_BORROW *sock) ;
+  OFC_SIZET ofc_socket_win32_borrowed_send (OFC_SOCKET_BORROW *sock,
+                                            const OFC_VOID *buf,
+                                            OFC_SIZET len) ;
+  OFC_SIZET ofc_socket_win32_borrowed_recv (OFC_SOCKET_BORROW *sock,
+                                            OFC_VOID *buf,
+                                            OFC_SIZET len) ;
+  /*
+   * Priority of a socket's memory use.  Sends on a low priority socket
+   * would block while the socket memory budget is used up.
+   */
+  OFC_BOOL ofc_socket_win32_priority (OFC_HANDLE hSocket,
+                                      OFC_SOCKMEM_PRIORITY priority) ;
 #if defined(__cplusplus)
 }
 #endif
@@ -0,0 +1,86 @@
+/* Copyright (c) 2021 Connected Way, LLC. All rights reserved.
+ * Use of this source code is governed by a Creative Commons
+ * Attribution-NoDerivatives 4.0 International license that can be
+ * found in the LICENSE file.
+ */
+#if !defined(__OFC_SOCKMEM_WINDOWS_H__)
+#define __OFC_SOCKMEM_WINDOWS_H__
+
+#include "ofc/types.h"
+
+/**
+ * \defgroup sockmem_windows Windows Socket Memory Accounting
+ *
+ * A process wide budget for memory held on behalf of sockets: cork and
+ * framed receive buffers, pooled receive buffers and the send and
+ * receive buffer sizes requested from the kernel.  Normal priority
+ * charges always succeed so nothing already in progress fails.  Low
+ * priority charges are refused once the budget is used up, and the
+ * socket layer turns that into would-block backpressure.
+ */
+
+/** \{ */
+
+typedef enum
+  {
+    OFC_SOCKMEM_NORMAL = 0,
+    OFC_SOCKMEM_LOW
+  } OFC_SOCKMEM_PRIORITY ;
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif
+  /**
+   * Initialize accounting with the configured budget
+   */
+  OFC_VOID ofc_sockmem_init(OFC_VOID) ;
+  /**
+   * Change the budget
+   *
+   * \param budget
+   * Bytes sockets may hold before low priority charges are refused
+   */
+  OFC_VOID ofc_sockmem_set_budget(OFC_SIZET budget) ;
+  /**
+   * Charge memory to the budget
+   *
+   * \param bytes
+   * Bytes about to be held
+   *
+   * \param priority
+   * Priority of the socket holding them
+   *
+   * \returns
+   * OFC_FALSE if a low priority charge would exceed the budget.  Nothing
+   * is charged in that case.
+   */
+  OFC_BOOL ofc_sockmem_charge(OFC_SIZET bytes, OFC_SOCKMEM_PRIORITY priority) ;
+  /**
+   * Return memory charged with ofc_sockmem_charge
+   */
+  OFC_VOID ofc_sockmem_release(OFC_SIZET bytes) ;
+  /**
+   * Test whether the budget is used up
+   */
+  OFC_BOOL ofc_sockmem_exhausted(OFC_VOID) ;
+  /**
+   * Report accounting
+   *
+   * \param used
+   * Receives the bytes charged
+   *
+   * \param budget
+   * Receives the budget
+   *
+   * \param refused
+   * Receives the number of charges refused so far
+   */
+  OFC_VOID ofc_sockmem_stats(OFC_SIZET *used, OFC_SIZET *budget,
+                             OFC_UINT32 *refused) ;
+#if defined(__cplusplus)
+}
+#endif
+
+/** \} */
+#endif
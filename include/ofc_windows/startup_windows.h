@@ -0,0 +1,117 @@
+/* Copyright (c) 2021 Connected Way, LLC. All rights reserved.
+ * Use of this source code is governed by a Creative Commons
+ * Attribution-NoDerivatives 4.0 International license that can be
+ * found in the LICENSE file.
+ */
+#if !defined(__OFC_STARTUP_WINDOWS_H__)
+#define __OFC_STARTUP_WINDOWS_H__
+
+#include "ofc/types.h"
+
+/**
+ * \defgroup startup_windows Windows Startup Profiling
+ *
+ * Times the phases of platform startup with the performance counter.
+ * Each phase records when it first started, measured from process
+ * creation, along with its total duration and how many times it ran.
+ * Milestones such as the first accepted connection record only when
+ * they first happen.
+ */
+
+/** \{ */
+
+typedef enum
+  {
+    OFC_STARTUP_WSA = 0,
+    OFC_STARTUP_SOCKET,
+    OFC_STARTUP_SOCKMEM,
+    OFC_STARTUP_BUFPOOL,
+    OFC_STARTUP_CONNPOOL,
+    OFC_STARTUP_DNSCACHE,
+    OFC_STARTUP_INTERFACES,
+    OFC_STARTUP_ENV,
+    OFC_STARTUP_CONSOLE,
+    OFC_STARTUP_FIRST_ACCEPT,
+    OFC_STARTUP_NUM
+  } OFC_STARTUP_PHASE ;
+
+/**
+ * Timing of one phase.  All times are in microseconds.
+ */
+typedef struct
+{
+  /** Time from process creation to the first start of the phase */
+  OFC_UINT64 offset ;
+  /** Total time spent in the phase */
+  OFC_UINT64 duration ;
+  /** Number of times the phase ran */
+  OFC_UINT32 count ;
+} OFC_STARTUP_TIMING ;
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif
+  /**
+   * Read the clock at the start of a phase
+   *
+   * \returns
+   * A timestamp to pass to ofc_startup_end
+   */
+  OFC_UINT64 ofc_startup_begin(OFC_VOID) ;
+  /**
+   * Record the end of a phase
+   *
+   * \param phase
+   * The phase that ended
+   *
+   * \param begin
+   * The timestamp returned by ofc_startup_begin
+   */
+  OFC_VOID ofc_startup_end(OFC_STARTUP_PHASE phase, OFC_UINT64 begin) ;
+  /**
+   * Record a milestone the first time it is reached
+   *
+   * \param phase
+   * The milestone
+   */
+  OFC_VOID ofc_startup_milestone(OFC_STARTUP_PHASE phase) ;
+  /**
+   * Mark the end of startup
+   *
+   * Called when the first connection is accepted.  Phases that also
+   * run in steady state, such as environment lookups, stop being
+   * timed once startup is over.
+   */
+  OFC_VOID ofc_startup_done(OFC_VOID) ;
+  /**
+   * Find out whether startup is still in progress
+   *
+   * \returns
+   * OFC_TRUE until ofc_startup_done is called
+   */
+  OFC_BOOL ofc_startup_active(OFC_VOID) ;
+  /**
+   * Get the timing of a phase
+   *
+   * \param phase
+   * The phase to report
+   *
+   * \param timing
+   * Receives the timing
+   *
+   * \returns
+   * OFC_TRUE if the phase has run
+   */
+  OFC_BOOL ofc_startup_report(OFC_STARTUP_PHASE phase,
+                              OFC_STARTUP_TIMING *timing) ;
+  /**
+   * Log the timing of every phase that has run
+   */
+  OFC_VOID ofc_startup_log(OFC_VOID) ;
+#if defined(__cplusplus)
+}
+#endif
+
+/** \} */
+#endif
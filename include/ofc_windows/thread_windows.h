@@ -0,0 +1,68 @@
+/* Copyright (c) 2021 Connected Way, LLC. All rights reserved.
+ * Use of this source code is governed by a Creative Commons
+ * Attribution-NoDerivatives 4.0 International license that can be
+ * found in the LICENSE file.
+ */
+#if !defined(__OFC_THREAD_WINDOWS_H__)
+#define __OFC_THREAD_WINDOWS_H__
+
+#include "ofc/types.h"
+
+/**
+ * \defgroup thread_windows_ext Windows Thread Extensions
+ *
+ * Every thread started by ofc_thread_create is kept in a registry while
+ * it runs.  The OS thread description is set to the thread name and
+ * instance so debuggers and profilers show it.  CPU time and cycle
+ * counts of all registered threads can be sampled in one call.
+ */
+
+/** \{ */
+
+#define OFC_THREAD_WIN32_NAME_LEN 32
+
+/**
+ * CPU use of one thread since it started.  For a pooled thread this
+ * covers only the current run.
+ */
+typedef struct
+{
+  /** Name passed to ofc_thread_create */
+  OFC_CHAR name[OFC_THREAD_WIN32_NAME_LEN] ;
+  /** Instance passed to ofc_thread_create */
+  OFC_INT instance ;
+  /** OS thread id */
+  OFC_UINT32 tid ;
+  /** Kernel time in microseconds */
+  OFC_UINT64 kernel ;
+  /** User time in microseconds */
+  OFC_UINT64 user ;
+  /** Processor cycles */
+  OFC_UINT64 cycles ;
+} OFC_THREAD_WIN32_SAMPLE ;
+
+#if defined(__cplusplus)
+extern "C"
+{
+#endif
+  /**
+   * Sample the CPU use of every registered thread
+   *
+   * \param samples
+   * Receives one sample per thread
+   *
+   * \param max
+   * Size of the samples array
+   *
+   * \returns
+   * Number of registered threads.  Only the first max are sampled, so
+   * call again with a larger array if the result is larger than max.
+   */
+  OFC_INT ofc_thread_win32_sample(OFC_THREAD_WIN32_SAMPLE *samples,
+                                  OFC_INT max) ;
+#if defined(__cplusplus)
+}
+#endif
+
+/** \} */
+#endif
@@ -0,0 +1,309 @@
+/* Copyright (c) 2021 Connected Way, LLC. All rights reserved.
+ * Use of this source code is governed by a Creative Commons
+ * Attribution-NoDerivatives 4.0 International license that can be
+ * found in the LICENSE file.
+ */
+#define __OFC_CORE_DLL__
+
+#include <windows.h>
+
+#include "ofc/types.h"
+#include "ofc/lock.h"
+#include "ofc/libc.h"
+#include "ofc/heap.h"
+
+#include "ofc_windows/config.h"
+#include "ofc_windows/bufpool_windows.h"
+#include "ofc_windows/sockmem_windows.h"
+
+/** \{ */
+
+/*
+ * A free buffer holds the link to the next free buffer in its first
+ * bytes so the pool needs no bookkeeping memory of its own.
+ */
+typedef struct _BUFPOOL_ENTRY
+{
+  struct _BUFPOOL_ENTRY *next ;
+} BUFPOOL_ENTRY ;
+
+typedef struct
+{
+  OFC_INT count ;
+  BUFPOOL_ENTRY *free ;
+} BUFPOOL_CACHE ;
+
+static OFC_LOCK bufpool_lock = OFC_NULL ;
+static BUFPOOL_ENTRY *bufpool_free_list = OFC_NULL ;
+static OFC_INT bufpool_free_count = 0 ;
+static volatile LONG bufpool_outstanding = 0 ;
+static volatile LONG bufpool_primed = 0 ;
+static DWORD bufpool_tls = TLS_OUT_OF_INDEXES ;
+
+static BUFPOOL_CACHE *bufpool_get_cache(OFC_VOID)
+{
+  BUFPOOL_CACHE *cache ;
+
+  cache = OFC_NULL ;
+  if (bufpool_tls != TLS_OUT_OF_INDEXES)
+    {
+      cache = TlsGetValue (bufpool_tls) ;
+      if (cache == OFC_NULL)
+	{
+	  cache = ofc_malloc (sizeof (BUFPOOL_CACHE)) ;
+	  if (cache != OFC_NULL)
+	    {
+	      cache->count = 0 ;
+	      cache->free = OFC_NULL ;
+	      TlsSetValue (bufpool_tls, cache) ;
+	    }
+	}
+    }
+  return (cache) ;
+}
+
+/*
+ * Trim the shared list back to the low watermark once it passes the
+ * high watermark.  The buffers are released outside of the lock.
+ */
+static OFC_VOID bufpool_trim(OFC_VOID)
+{
+  BUFPOOL_ENTRY *excess ;
+  BUFPOOL_ENTRY *entry ;
+
+  excess = OFC_NULL ;
+  ofc_lock (bufpool_lock) ;
+  if (bufpool_free_count > OFC_SOCKET_POOL_HIGH_WATER)
+    {
+      while (bufpool_free_count > OFC_SOCKET_POOL_LOW_WATER)
+	{
+	  entry = bufpool_free_list ;
+	  bufpool_free_list = entry->next ;
+	  bufpool_free_count-- ;
+	  entry->next = excess ;
+	  excess = entry ;
+	}
+    }
+  ofc_unlock (bufpool_lock) ;
+
+  while (excess != OFC_NULL)
+    {
+      entry = excess ;
+      excess = entry->next ;
+      ofc_free (entry) ;
+      ofc_sockmem_release (OFC_SOCKET_POOL_BUFFER_SIZE) ;
+    }
+}
+
+/*
+ * Prefill the shared list to the low watermark.  This is put off until
+ * the first buffer is wanted so startup does not pay for it.
+ */
+static OFC_VOID bufpool_prime(OFC_VOID)
+{
+  BUFPOOL_ENTRY *entry ;
+  OFC_INT i ;
+
+  ofc_lock (bufpool_lock) ;
+  if (!bufpool_primed)
+    {
+      for (i = 0 ; i < OFC_SOCKET_POOL_LOW_WATER ; i++)
+	{
+	  entry = ofc_malloc (OFC_SOCKET_POOL_BUFFER_SIZE) ;
+	  if (entry != OFC_NULL)
+	    {
+	      ofc_sockmem_charge (OFC_SOCKET_POOL_BUFFER_SIZE,
+				  OFC_SOCKMEM_NORMAL) ;
+	      entry->next = bufpool_free_list ;
+	      bufpool_free_list = entry ;
+	      bufpool_free_count++ ;
+	    }
+	}
+      InterlockedExchange (&bufpool_primed, 1) ;
+    }
+  ofc_unlock (bufpool_lock) ;
+}
+
+OFC_VOID ofc_bufpool_init(OFC_VOID)
+{
+  if (bufpool_lock == OFC_NULL)
+    {
+      bufpool_lock = ofc_lock_init () ;
+      bufpool_tls = TlsAlloc () ;
+    }
+}
+
+OFC_SIZET ofc_bufpool_size(OFC_VOID)
+{
+  return (OFC_SOCKET_POOL_BUFFER_SIZE) ;
+}
+
+OFC_VOID *ofc_bufpool_alloc(OFC_VOID)
+{
+  BUFPOOL_CACHE *cache ;
+  BUFPOOL_ENTRY *entry ;
+
+  entry = OFC_NULL ;
+  cache = bufpool_get_cache () ;
+
+  if (!bufpool_primed && bufpool_lock != OFC_NULL)
+    bufpool_prime () ;
+
+  if (cache != OFC_NULL && cache->free == OFC_NULL &&
+      bufpool_lock != OFC_NULL)
+    {
+      /*
+       * Refill half of the thread cache in one trip to the shared list
+       */
+      ofc_lock (bufpool_lock) ;
+      while (bufpool_free_list != OFC_NULL &&
+	     cache->count < (OFC_SOCKET_POOL_CACHE + 1) / 2)
+	{
+	  entry = bufpool_free_list ;
+	  bufpool_free_list = entry->next ;
+	  bufpool_free_count-- ;
+	  entry->next = cache->free ;
+	  cache->free = entry ;
+	  cache->count++ ;
+	}
+      ofc_unlock (bufpool_lock) ;
+    }
+
+  if (cache != OFC_NULL && cache->free != OFC_NULL)
+    {
+      entry = cache->free ;
+      cache->free = entry->next ;
+      cache->count-- ;
+    }
+  else if (cache == OFC_NULL && bufpool_lock != OFC_NULL)
+    {
+      ofc_lock (bufpool_lock) ;
+      entry = bufpool_free_list ;
+      if (entry != OFC_NULL)
+	{
+	  bufpool_free_list = entry->next ;
+	  bufpool_free_count-- ;
+	}
+      ofc_unlock (bufpool_lock) ;
+    }
+  else
+    entry = OFC_NULL ;
+
+  if (entry == OFC_NULL)
+    {
+      entry = ofc_malloc (OFC_SOCKET_POOL_BUFFER_SIZE) ;
+      if (entry != OFC_NULL)
+	ofc_sockmem_charge (OFC_SOCKET_POOL_BUFFER_SIZE, OFC_SOCKMEM_NORMAL) ;
+    }
+
+  if (entry != OFC_NULL)
+    InterlockedIncrement (&bufpool_outstanding) ;
+
+  return (entry) ;
+}
+
+OFC_VOID ofc_bufpool_free(OFC_VOID *buf)
+{
+  BUFPOOL_CACHE *cache ;
+  BUFPOOL_ENTRY *entry ;
+  BUFPOOL_ENTRY *spill ;
+  BUFPOOL_ENTRY *last ;
+  OFC_INT count ;
+
+  if (buf != OFC_NULL)
+    {
+      InterlockedDecrement (&bufpool_outstanding) ;
+      entry = buf ;
+      cache = bufpool_get_cache () ;
+
+      if (bufpool_lock == OFC_NULL)
+	{
+	  ofc_free (entry) ;
+	  ofc_sockmem_release (OFC_SOCKET_POOL_BUFFER_SIZE) ;
+	}
+      else if (cache != OFC_NULL && cache->count < OFC_SOCKET_POOL_CACHE)
+	{
+	  entry->next = cache->free ;
+	  cache->free = entry ;
+	  cache->count++ ;
+	}
+      else
+	{
+	  /*
+	   * Cache is full (or there is none).  Spill this buffer and half
+	   * of the cache back to the shared list.
+	   */
+	  entry->next = OFC_NULL ;
+	  spill = entry ;
+	  last = entry ;
+	  count = 1 ;
+	  if (cache != OFC_NULL)
+	    {
+	      while (cache->count > OFC_SOCKET_POOL_CACHE / 2)
+		{
+		  entry = cache->free ;
+		  cache->free = entry->next ;
+		  cache->count-- ;
+		  entry->next = spill ;
+		  spill = entry ;
+		  count++ ;
+		}
+	    }
+
+	  ofc_lock (bufpool_lock) ;
+	  last->next = bufpool_free_list ;
+	  bufpool_free_list = spill ;
+	  bufpool_free_count += count ;
+	  ofc_unlock (bufpool_lock) ;
+
+	  bufpool_trim () ;
+	}
+    }
+}
+
+OFC_VOID ofc_bufpool_thread_flush(OFC_VOID)
+{
+  BUFPOOL_CACHE *cache ;
+  BUFPOOL_ENTRY *last ;
+
+  if (bufpool_tls != TLS_OUT_OF_INDEXES)
+    {
+      cache = TlsGetValue (bufpool_tls) ;
+      if (cache != OFC_NULL)
+	{
+	  if (cache->free != OFC_NULL)
+	    {
+	      for (last = cache->free ; last->next != OFC_NULL ;
+		   last = last->next) ;
+
+	      ofc_lock (bufpool_lock) ;
+	      last->next = bufpool_free_list ;
+	      bufpool_free_list = cache->free ;
+	      bufpool_free_count += cache->count ;
+	      ofc_unlock (bufpool_lock) ;
+	    }
+	  TlsSetValue (bufpool_tls, OFC_NULL) ;
+	  ofc_free (cache) ;
+	  bufpool_trim () ;
+	}
+    }
+}
+
+OFC_VOID ofc_bufpool_stats(OFC_INT *outstanding, OFC_INT *pooled)
+{
+  if (outstanding != OFC_NULL)
+    *outstanding = (OFC_INT) bufpool_outstanding ;
+  if (pooled != OFC_NULL)
+    {
+      if (bufpool_lock == OFC_NULL)
+	*pooled = 0 ;
+      else
+	{
+	  ofc_lock (bufpool_lock) ;
+	  *pooled = bufpool_free_count ;
+	  ofc_unlock (bufpool_lock) ;
+	}
+    }
+}
+
+/** \} */
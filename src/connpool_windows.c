@@ -0,0 +1,336 @@
+/* Copyright (c) 2021 Connected Way, LLC. All rights reserved.
+ * Use of this source code is governed by a Creative Commons
+ * Attribution-NoDerivatives 4.0 International license that can be
+ * found in the LICENSE file.
+ */
+#define __OFC_CORE_DLL__
+
+#include <winsock2.h>
+
+#include "ofc/types.h"
+#include "ofc/handle.h"
+#include "ofc/lock.h"
+#include "ofc/libc.h"
+#include "ofc/time.h"
+#include "ofc/socket.h"
+#include "ofc/impl/socketimpl.h"
+#include "ofc/net.h"
+#include "ofc/heap.h"
+
+#include "ofc_windows/config.h"
+#include "ofc_windows/socket_windows.h"
+#include "ofc_windows/connpool_windows.h"
+
+/** \{ */
+
+struct _CONNPOOL_KEY ;
+
+/*
+ * An idle socket.  It is on the idle list of its key, most recently
+ * checked in first, and on the pool wide list in the same order so the
+ * oldest can be evicted from the tail.
+ */
+typedef struct _CONNPOOL_ENTRY
+{
+  struct _CONNPOOL_ENTRY *key_next ;
+  struct _CONNPOOL_ENTRY *key_prev ;
+  struct _CONNPOOL_ENTRY *lru_next ;
+  struct _CONNPOOL_ENTRY *lru_prev ;
+  struct _CONNPOOL_KEY *key ;
+  OFC_HANDLE hSocket ;
+  OFC_MSTIME idle_since ;
+} CONNPOOL_ENTRY ;
+
+typedef struct _CONNPOOL_KEY
+{
+  struct _CONNPOOL_KEY *next ;
+  OFC_IPADDR ip ;
+  OFC_UINT16 port ;
+  OFC_INT count ;
+  CONNPOOL_ENTRY *idle ;
+} CONNPOOL_KEY ;
+
+static OFC_LOCK connpool_lock = OFC_NULL ;
+static CONNPOOL_KEY *connpool_buckets[OFC_CONNPOOL_BUCKETS] ;
+static CONNPOOL_ENTRY *connpool_lru_head = OFC_NULL ;
+static CONNPOOL_ENTRY *connpool_lru_tail = OFC_NULL ;
+/*
+ * Evicts idle sockets whether or not the pool is being used
+ */
+static HANDLE connpool_timer = NULL ;
+
+#define CONNPOOL_SWEEP (OFC_CONNPOOL_IDLE_TIMEOUT / 2 + 1)
+
+static OFC_UINT connpool_hash(const OFC_IPADDR *ip, OFC_UINT16 port)
+{
+  OFC_UINT hash ;
+  OFC_INT i ;
+
+  hash = port ;
+  if (ip->ip_version == OFC_FAMILY_IP)
+    hash ^= ip->u.ipv4.addr ;
+  else
+    {
+      for (i = 0 ; i < 16 ; i++)
+	hash = (hash * 31) + ip->u.ipv6._s6_addr[i] ;
+    }
+  return (hash % OFC_CONNPOOL_BUCKETS) ;
+}
+
+static OFC_BOOL connpool_match(const CONNPOOL_KEY *key,
+                               const OFC_IPADDR *ip, OFC_UINT16 port)
+{
+  OFC_BOOL ret ;
+
+  ret = OFC_FALSE ;
+  if (key->port == port && key->ip.ip_version == ip->ip_version)
+    {
+      if (ip->ip_version == OFC_FAMILY_IP)
+	ret = (key->ip.u.ipv4.addr == ip->u.ipv4.addr) ;
+      else
+	ret = (ofc_memcmp (key->ip.u.ipv6._s6_addr, ip->u.ipv6._s6_addr,
+			   16) == 0 &&
+	       key->ip.u.ipv6.scope == ip->u.ipv6.scope) ;
+    }
+  return (ret) ;
+}
+
+static CONNPOOL_KEY *connpool_find(const OFC_IPADDR *ip, OFC_UINT16 port,
+                                   OFC_BOOL create)
+{
+  CONNPOOL_KEY *key ;
+  OFC_UINT hash ;
+
+  hash = connpool_hash (ip, port) ;
+  for (key = connpool_buckets[hash] ;
+       key != OFC_NULL && !connpool_match (key, ip, port) ;
+       key = key->next) ;
+
+  if (key == OFC_NULL && create)
+    {
+      key = ofc_malloc (sizeof (CONNPOOL_KEY)) ;
+      if (key != OFC_NULL)
+	{
+	  key->ip = *ip ;
+	  key->port = port ;
+	  key->count = 0 ;
+	  key->idle = OFC_NULL ;
+	  key->next = connpool_buckets[hash] ;
+	  connpool_buckets[hash] = key ;
+	}
+    }
+  return (key) ;
+}
+
+/*
+ * Take an entry off both of its lists.  A key left without idle sockets
+ * is freed.  Called with the pool locked.
+ */
+static OFC_VOID connpool_unlink(CONNPOOL_ENTRY *entry)
+{
+  CONNPOOL_KEY *key ;
+  CONNPOOL_KEY **prev ;
+
+  key = entry->key ;
+  if (entry->key_prev != OFC_NULL)
+    entry->key_prev->key_next = entry->key_next ;
+  else
+    key->idle = entry->key_next ;
+  if (entry->key_next != OFC_NULL)
+    entry->key_next->key_prev = entry->key_prev ;
+  key->count-- ;
+
+  if (entry->lru_prev != OFC_NULL)
+    entry->lru_prev->lru_next = entry->lru_next ;
+  else
+    connpool_lru_head = entry->lru_next ;
+  if (entry->lru_next != OFC_NULL)
+    entry->lru_next->lru_prev = entry->lru_prev ;
+  else
+    connpool_lru_tail = entry->lru_prev ;
+
+  if (key->count == 0)
+    {
+      for (prev = &connpool_buckets[connpool_hash (&key->ip, key->port)] ;
+	   *prev != key ;
+	   prev = &(*prev)->next) ;
+      *prev = key->next ;
+      ofc_free (key) ;
+    }
+}
+
+static OFC_VOID connpool_close(OFC_HANDLE hSocket)
+{
+  ofc_socket_impl_close (hSocket) ;
+  ofc_socket_impl_destroy (hSocket) ;
+}
+
+/*
+ * An idle socket is healthy if it is still connected, the peer has not
+ * closed it and no unsolicited data is waiting on it.  The check leaves
+ * the socket's events for whoever checks it out.
+ */
+static OFC_BOOL connpool_healthy(OFC_HANDLE hSocket)
+{
+  OFC_BOOL ret ;
+
+  ret = OFC_FALSE ;
+  if (ofc_socket_impl_connected (hSocket) &&
+      ofc_socket_win32_quiet (hSocket))
+    ret = OFC_TRUE ;
+  return (ret) ;
+}
+
+static VOID CALLBACK connpool_sweep(PVOID context, BOOLEAN fired)
+{
+  ofc_connpool_evict () ;
+}
+
+OFC_VOID ofc_connpool_init(OFC_VOID)
+{
+  OFC_INT i ;
+
+  if (connpool_lock == OFC_NULL)
+    {
+      connpool_lock = ofc_lock_init () ;
+      for (i = 0 ; i < OFC_CONNPOOL_BUCKETS ; i++)
+	connpool_buckets[i] = OFC_NULL ;
+      if (!CreateTimerQueueTimer (&connpool_timer, NULL, connpool_sweep,
+				  NULL, CONNPOOL_SWEEP, CONNPOOL_SWEEP,
+				  WT_EXECUTEDEFAULT))
+	connpool_timer = NULL ;
+    }
+}
+
+OFC_VOID ofc_connpool_evict(OFC_VOID)
+{
+  CONNPOOL_ENTRY *entry ;
+  CONNPOOL_ENTRY *expired ;
+  OFC_MSTIME now ;
+
+  expired = OFC_NULL ;
+  now = ofc_time_get_now () ;
+
+  ofc_lock (connpool_lock) ;
+  while (connpool_lru_tail != OFC_NULL &&
+	 now - connpool_lru_tail->idle_since > OFC_CONNPOOL_IDLE_TIMEOUT)
+    {
+      entry = connpool_lru_tail ;
+      connpool_unlink (entry) ;
+      entry->lru_next = expired ;
+      expired = entry ;
+    }
+  ofc_unlock (connpool_lock) ;
+
+  while (expired != OFC_NULL)
+    {
+      entry = expired ;
+      expired = entry->lru_next ;
+      connpool_close (entry->hSocket) ;
+      ofc_free (entry) ;
+    }
+}
+
+OFC_VOID ofc_connpool_flush(OFC_VOID)
+{
+  CONNPOOL_ENTRY *entry ;
+
+  ofc_lock (connpool_lock) ;
+  while (connpool_lru_head != OFC_NULL)
+    {
+      entry = connpool_lru_head ;
+      connpool_unlink (entry) ;
+      ofc_unlock (connpool_lock) ;
+      connpool_close (entry->hSocket) ;
+      ofc_free (entry) ;
+      ofc_lock (connpool_lock) ;
+    }
+  ofc_unlock (connpool_lock) ;
+}
+
+OFC_HANDLE ofc_connpool_checkout(const OFC_IPADDR *ip, OFC_UINT16 port)
+{
+  CONNPOOL_KEY *key ;
+  CONNPOOL_ENTRY *entry ;
+  OFC_HANDLE hSocket ;
+
+  ofc_connpool_evict () ;
+
+  hSocket = OFC_HANDLE_NULL ;
+  while (hSocket == OFC_HANDLE_NULL)
+    {
+      entry = OFC_NULL ;
+      ofc_lock (connpool_lock) ;
+      key = connpool_find (ip, port, OFC_FALSE) ;
+      if (key != OFC_NULL && key->idle != OFC_NULL)
+	{
+	  entry = key->idle ;
+	  connpool_unlink (entry) ;
+	}
+      ofc_unlock (connpool_lock) ;
+
+      if (entry == OFC_NULL)
+	break ;
+
+      hSocket = entry->hSocket ;
+      ofc_free (entry) ;
+      if (!connpool_healthy (hSocket))
+	{
+	  connpool_close (hSocket) ;
+	  hSocket = OFC_HANDLE_NULL ;
+	}
+    }
+  return (hSocket) ;
+}
+
+OFC_VOID ofc_connpool_checkin(OFC_HANDLE hSocket,
+                              const OFC_IPADDR *ip, OFC_UINT16 port)
+{
+  CONNPOOL_KEY *key ;
+  CONNPOOL_ENTRY *entry ;
+  OFC_BOOL pooled ;
+
+  pooled = OFC_FALSE ;
+  if (ofc_socket_impl_connected (hSocket))
+    {
+      entry = ofc_malloc (sizeof (CONNPOOL_ENTRY)) ;
+      if (entry != OFC_NULL)
+	{
+	  entry->hSocket = hSocket ;
+	  entry->idle_since = ofc_time_get_now () ;
+
+	  ofc_lock (connpool_lock) ;
+	  key = connpool_find (ip, port, OFC_TRUE) ;
+	  if (key != OFC_NULL && key->count < OFC_CONNPOOL_MAX_IDLE)
+	    {
+	      entry->key = key ;
+	      entry->key_prev = OFC_NULL ;
+	      entry->key_next = key->idle ;
+	      if (key->idle != OFC_NULL)
+		key->idle->key_prev = entry ;
+	      key->idle = entry ;
+	      key->count++ ;
+
+	      entry->lru_prev = OFC_NULL ;
+	      entry->lru_next = connpool_lru_head ;
+	      if (connpool_lru_head != OFC_NULL)
+		connpool_lru_head->lru_prev = entry ;
+	      else
+		connpool_lru_tail = entry ;
+	      connpool_lru_head = entry ;
+	      pooled = OFC_TRUE ;
+	    }
+	  ofc_unlock (connpool_lock) ;
+
+	  if (!pooled)
+	    ofc_free (entry) ;
+	}
+    }
+
+  if (!pooled)
+    connpool_close (hSocket) ;
+
+  ofc_connpool_evict () ;
+}
+
+/** \} */
@@ -8,6 +8,7 @@
 #include "ofc/types.h"
 #include "ofc/impl/consoleimpl.h"
 #include "ofc/libc.h"
+#include "ofc_windows/startup_windows.h"
 
 /**
  * \defgroup console_windows Windows Console Interface
@@ -21,6 +22,9 @@
 HANDLE g_fd = INVALID_HANDLE_VALUE ;
 
 static OFC_VOID open_log(OFC_VOID) {
+  OFC_UINT64 begin ;
+
+  begin = ofc_startup_begin () ;
 #if defined(LOG_TO_FILE)
   g_fd = CreateFileA(LOG_FILE,
 		     GENERIC_WRITE,
@@ -32,6 +36,7 @@ static OFC_VOID open_log(OFC_VOID) {
 #else
   g_fd = GetStdHandle (STD_OUTPUT_HANDLE);
 #endif  
+  ofc_startup_end (OFC_STARTUP_CONSOLE, begin) ;
 }
 
 OFC_VOID ofc_write_stdout_impl(OFC_CCHAR *obuf, OFC_SIZET len) {
@@ -0,0 +1,187 @@
+/* Copyright (c) 2021 Connected Way, LLC. All rights reserved.
+ * Use of this source code is governed by a Creative Commons
+ * Attribution-NoDerivatives 4.0 International license that can be
+ * found in the LICENSE file.
+ */
+#define __OFC_CORE_DLL__
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#include "ofc/types.h"
+#include "ofc/handle.h"
+#include "ofc/lock.h"
+#include "ofc/libc.h"
+#include "ofc/socket.h"
+#include "ofc/impl/socketimpl.h"
+#include "ofc/net.h"
+#include "ofc/net_internal.h"
+#include "ofc/heap.h"
+
+#include "ofc_windows/net_windows.h"
+#include "ofc_windows/dgramset_windows.h"
+
+/** \{ */
+
+typedef struct
+{
+  OFC_HANDLE hSocket ;
+  OFC_IPADDR ip ;
+  OFC_IPADDR bcast ;
+} DGRAM_SET_ENTRY ;
+
+struct _OFC_DGRAM_SET
+{
+  OFC_LOCK lock ;
+  OFC_UINT16 port ;
+  OFC_INT count ;
+  DGRAM_SET_ENTRY *entries ;
+  /*
+   * Generation of the interface table the set was built from
+   */
+  OFC_UINT32 generation ;
+} ;
+
+static OFC_VOID dgram_set_clear(OFC_DGRAM_SET *set)
+{
+  OFC_INT i ;
+
+  for (i = 0 ; i < set->count ; i++)
+    {
+      ofc_socket_impl_close (set->entries[i].hSocket) ;
+      ofc_socket_impl_destroy (set->entries[i].hSocket) ;
+    }
+  ofc_free (set->entries) ;
+  set->entries = OFC_NULL ;
+  set->count = 0 ;
+}
+
+static OFC_VOID dgram_set_build(OFC_DGRAM_SET *set)
+{
+  DGRAM_SET_ENTRY *entry ;
+  OFC_INT max ;
+  OFC_INT i ;
+  OFC_IPADDR mask ;
+
+  /*
+   * Read the generation first.  A change while enumerating leaves the
+   * set one generation behind, so the next refresh rebuilds it.
+   */
+  set->generation = ofc_net_win32_generation () ;
+  max = ofc_net_interface_count_impl () ;
+  if (max > 0)
+    set->entries = ofc_malloc (sizeof (DGRAM_SET_ENTRY) * max) ;
+
+  for (i = 0 ; set->entries != OFC_NULL && i < max ; i++)
+    {
+      entry = &set->entries[set->count] ;
+      ofc_net_interface_addr_impl (i, &entry->ip, &entry->bcast, &mask) ;
+
+      entry->hSocket =
+	ofc_socket_impl_create (entry->ip.ip_version, SOCKET_TYPE_DGRAM) ;
+      if (entry->hSocket != OFC_HANDLE_NULL)
+	{
+	  ofc_socket_impl_reuse_addr (entry->hSocket, OFC_TRUE) ;
+	  if (ofc_socket_impl_bind (entry->hSocket, &entry->ip, set->port))
+	    set->count++ ;
+	  else
+	    {
+	      ofc_socket_impl_close (entry->hSocket) ;
+	      ofc_socket_impl_destroy (entry->hSocket) ;
+	    }
+	}
+    }
+}
+
+OFC_DGRAM_SET *ofc_dgram_set_create(OFC_UINT16 port)
+{
+  OFC_DGRAM_SET *set ;
+
+  set = ofc_malloc (sizeof (OFC_DGRAM_SET)) ;
+  if (set != OFC_NULL)
+    {
+      set->lock = ofc_lock_init () ;
+      set->port = port ;
+      set->count = 0 ;
+      set->entries = OFC_NULL ;
+      dgram_set_build (set) ;
+    }
+  return (set) ;
+}
+
+OFC_VOID ofc_dgram_set_destroy(OFC_DGRAM_SET *set)
+{
+  dgram_set_clear (set) ;
+  ofc_lock_destroy (set->lock) ;
+  ofc_free (set) ;
+}
+
+OFC_BOOL ofc_dgram_set_refresh(OFC_DGRAM_SET *set)
+{
+  OFC_BOOL ret ;
+
+  ret = OFC_FALSE ;
+  ofc_lock (set->lock) ;
+  /*
+   * The interface table tracks address changes of both families.  Only
+   * here are sockets replaced, so handles the caller holds stay valid
+   * until it asks for a refresh and is told they changed.
+   */
+  if (ofc_net_win32_generation () != set->generation)
+    {
+      dgram_set_clear (set) ;
+      dgram_set_build (set) ;
+      ret = OFC_TRUE ;
+    }
+  ofc_unlock (set->lock) ;
+  return (ret) ;
+}
+
+OFC_INT ofc_dgram_set_broadcast(OFC_DGRAM_SET *set,
+                                const OFC_VOID *buf, OFC_SIZET len,
+                                OFC_UINT16 port)
+{
+  OFC_INT ret ;
+  OFC_INT i ;
+
+  ret = 0 ;
+  ofc_lock (set->lock) ;
+  for (i = 0 ; i < set->count ; i++)
+    {
+      if (ofc_socket_impl_sendto (set->entries[i].hSocket, buf, len,
+				  &set->entries[i].bcast, port) == len)
+	ret++ ;
+    }
+  ofc_unlock (set->lock) ;
+
+  return (ret) ;
+}
+
+OFC_INT ofc_dgram_set_count(OFC_DGRAM_SET *set)
+{
+  OFC_INT ret ;
+
+  ofc_lock (set->lock) ;
+  ret = set->count ;
+  ofc_unlock (set->lock) ;
+  return (ret) ;
+}
+
+OFC_HANDLE ofc_dgram_set_socket(OFC_DGRAM_SET *set, OFC_INT index,
+                                OFC_IPADDR *ip)
+{
+  OFC_HANDLE ret ;
+
+  ret = OFC_HANDLE_NULL ;
+  ofc_lock (set->lock) ;
+  if (index >= 0 && index < set->count)
+    {
+      ret = set->entries[index].hSocket ;
+      if (ip != OFC_NULL)
+	*ip = set->entries[index].ip ;
+    }
+  ofc_unlock (set->lock) ;
+  return (ret) ;
+}
+
+/** \} */
@@ -0,0 +1,256 @@
+/* Copyright (c) 2021 Connected Way, LLC. All rights reserved.
+ * Use of this source code is governed by a Creative Commons
+ * Attribution-NoDerivatives 4.0 International license that can be
+ * found in the LICENSE file.
+ */
+#define __OFC_CORE_DLL__
+
+#include <windows.h>
+
+#include "ofc/types.h"
+#include "ofc/libc.h"
+#include "ofc/heap.h"
+#include "ofc/net.h"
+
+#include "ofc_windows/config.h"
+#include "ofc_windows/dnscache_windows.h"
+
+/** \{ */
+
+/*
+ * The name and addresses are stored in the same allocation as the entry.
+ * last is updated under the shared lock so it is only touched with
+ * interlocked operations.
+ */
+typedef struct _DNSCACHE_ENTRY
+{
+  struct _DNSCACHE_ENTRY *next ;
+  OFC_UINT32 hash ;
+  ULONGLONG expires ;
+  volatile LONG64 last ;
+  OFC_CHAR *name ;
+  OFC_UINT16 count ;
+  OFC_IPADDR addrs[1] ;
+} DNSCACHE_ENTRY ;
+
+static SRWLOCK dnscache_lock = SRWLOCK_INIT ;
+static DNSCACHE_ENTRY *dnscache_buckets[OFC_DNS_CACHE_SIZE] ;
+static OFC_INT dnscache_count = 0 ;
+static volatile LONG dnscache_hits = 0 ;
+static volatile LONG dnscache_misses = 0 ;
+
+static OFC_CHAR dnscache_fold(OFC_CHAR c)
+{
+  if (c >= 'A' && c <= 'Z')
+    c = c - 'A' + 'a' ;
+  return (c) ;
+}
+
+static OFC_UINT32 dnscache_hash(OFC_LPCSTR name)
+{
+  OFC_UINT32 hash ;
+
+  hash = 2166136261U ;
+  for ( ; *name != '\0' ; name++)
+    {
+      hash ^= (OFC_UINT8) dnscache_fold (*name) ;
+      hash *= 16777619U ;
+    }
+  return (hash) ;
+}
+
+static OFC_BOOL dnscache_match(OFC_LPCSTR a, OFC_LPCSTR b)
+{
+  while (*a != '\0' && dnscache_fold (*a) == dnscache_fold (*b))
+    {
+      a++ ;
+      b++ ;
+    }
+  return (*a == *b) ;
+}
+
+static DNSCACHE_ENTRY **dnscache_find(OFC_LPCSTR name, OFC_UINT32 hash)
+{
+  DNSCACHE_ENTRY **link ;
+
+  for (link = &dnscache_buckets[hash % OFC_DNS_CACHE_SIZE] ;
+       *link != OFC_NULL &&
+	 ((*link)->hash != hash || !dnscache_match ((*link)->name, name)) ;
+       link = &(*link)->next) ;
+  return (link) ;
+}
+
+/*
+ * Make room for one more entry.  An expired entry is preferred,
+ * otherwise the least recently used one goes.  Called with the lock
+ * held exclusively.
+ */
+static OFC_VOID dnscache_evict(ULONGLONG now)
+{
+  DNSCACHE_ENTRY **link ;
+  DNSCACHE_ENTRY **victim ;
+  DNSCACHE_ENTRY *entry ;
+  OFC_INT i ;
+
+  victim = OFC_NULL ;
+  for (i = 0 ; i < OFC_DNS_CACHE_SIZE ; i++)
+    {
+      for (link = &dnscache_buckets[i] ; *link != OFC_NULL ;
+	   link = &(*link)->next)
+	{
+	  if ((*link)->expires <= now)
+	    {
+	      victim = link ;
+	      break ;
+	    }
+	  if (victim == OFC_NULL || (*link)->last < (*victim)->last)
+	    victim = link ;
+	}
+      if (victim != OFC_NULL && (*victim)->expires <= now)
+	break ;
+    }
+
+  if (victim != OFC_NULL)
+    {
+      entry = *victim ;
+      *victim = entry->next ;
+      dnscache_count-- ;
+      ofc_free (entry) ;
+    }
+}
+
+OFC_VOID ofc_dnscache_init(OFC_VOID)
+{
+  ofc_dnscache_flush () ;
+}
+
+OFC_BOOL ofc_dnscache_lookup(OFC_LPCSTR name, OFC_UINT16 *num_addrs,
+                             OFC_IPADDR *ip)
+{
+  DNSCACHE_ENTRY *entry ;
+  ULONGLONG now ;
+  OFC_UINT16 i ;
+  OFC_BOOL ret ;
+
+  ret = OFC_FALSE ;
+  now = GetTickCount64 () ;
+
+  AcquireSRWLockShared (&dnscache_lock) ;
+  entry = *dnscache_find (name, dnscache_hash (name)) ;
+  if (entry != OFC_NULL && entry->expires > now)
+    {
+      InterlockedExchange64 (&entry->last, (LONG64) now) ;
+      for (i = 0 ; i < entry->count && i < *num_addrs ; i++)
+	ip[i] = entry->addrs[i] ;
+      *num_addrs = i ;
+      ret = OFC_TRUE ;
+    }
+  ReleaseSRWLockShared (&dnscache_lock) ;
+
+  if (ret)
+    InterlockedIncrement (&dnscache_hits) ;
+  else
+    InterlockedIncrement (&dnscache_misses) ;
+  return (ret) ;
+}
+
+OFC_VOID ofc_dnscache_insert(OFC_LPCSTR name, OFC_UINT16 num_addrs,
+                             const OFC_IPADDR *ip)
+{
+  DNSCACHE_ENTRY **link ;
+  DNSCACHE_ENTRY *entry ;
+  OFC_UINT32 hash ;
+  OFC_SIZET len ;
+  ULONGLONG now ;
+  OFC_UINT16 i ;
+
+  if (num_addrs > OFC_DNS_CACHE_ADDRS)
+    num_addrs = OFC_DNS_CACHE_ADDRS ;
+
+  len = ofc_strlen (name) ;
+  entry = ofc_malloc (sizeof (DNSCACHE_ENTRY) +
+		      sizeof (OFC_IPADDR) * num_addrs + len + 1) ;
+  if (entry != OFC_NULL)
+    {
+      now = GetTickCount64 () ;
+      hash = dnscache_hash (name) ;
+
+      entry->hash = hash ;
+      entry->count = num_addrs ;
+      for (i = 0 ; i < num_addrs ; i++)
+	entry->addrs[i] = ip[i] ;
+      entry->name = (OFC_CHAR *) &entry->addrs[num_addrs] ;
+      ofc_strcpy (entry->name, name) ;
+      entry->last = (LONG64) now ;
+      entry->expires = now + (num_addrs == 0 ?
+			      OFC_DNS_CACHE_NEGATIVE_TTL : OFC_DNS_CACHE_TTL) ;
+
+      AcquireSRWLockExclusive (&dnscache_lock) ;
+      link = dnscache_find (name, hash) ;
+      if (*link != OFC_NULL)
+	{
+	  /*
+	   * Replace the existing entry in place
+	   */
+	  entry->next = (*link)->next ;
+	  ofc_free (*link) ;
+	  *link = entry ;
+	}
+      else
+	{
+	  if (dnscache_count >= OFC_DNS_CACHE_SIZE)
+	    dnscache_evict (now) ;
+	  link = &dnscache_buckets[hash % OFC_DNS_CACHE_SIZE] ;
+	  entry->next = *link ;
+	  *link = entry ;
+	  dnscache_count++ ;
+	}
+      ReleaseSRWLockExclusive (&dnscache_lock) ;
+    }
+}
+
+OFC_VOID ofc_dnscache_flush(OFC_VOID)
+{
+  DNSCACHE_ENTRY *flushed ;
+  DNSCACHE_ENTRY *entry ;
+  OFC_INT i ;
+
+  flushed = OFC_NULL ;
+  AcquireSRWLockExclusive (&dnscache_lock) ;
+  for (i = 0 ; i < OFC_DNS_CACHE_SIZE ; i++)
+    {
+      while (dnscache_buckets[i] != OFC_NULL)
+	{
+	  entry = dnscache_buckets[i] ;
+	  dnscache_buckets[i] = entry->next ;
+	  entry->next = flushed ;
+	  flushed = entry ;
+	}
+    }
+  dnscache_count = 0 ;
+  ReleaseSRWLockExclusive (&dnscache_lock) ;
+
+  while (flushed != OFC_NULL)
+    {
+      entry = flushed ;
+      flushed = entry->next ;
+      ofc_free (entry) ;
+    }
+}
+
+OFC_VOID ofc_dnscache_stats(OFC_UINT32 *hits, OFC_UINT32 *misses,
+                            OFC_INT *entries)
+{
+  if (hits != OFC_NULL)
+    *hits = (OFC_UINT32) dnscache_hits ;
+  if (misses != OFC_NULL)
+    *misses = (OFC_UINT32) dnscache_misses ;
+  if (entries != OFC_NULL)
+    {
+      AcquireSRWLockShared (&dnscache_lock) ;
+      *entries = dnscache_count ;
+      ReleaseSRWLockShared (&dnscache_lock) ;
+    }
+}
+
+/** \} */
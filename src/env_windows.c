@@ -11,6 +11,7 @@
 #include "ofc/libc.h"
 
 #include "ofc/heap.h"
+#include "ofc_windows/startup_windows.h"
 
 static LPCTSTR env2str[OFC_ENV_NUM] =
   {
@@ -23,11 +24,23 @@ OFC_BOOL
 ofc_env_get_impl(OFC_ENV_VALUE value, OFC_TCHAR *ptr, OFC_SIZET len) {
   OFC_BOOL ret ;
   DWORD status ;
+  OFC_UINT64 begin ;
 
   ret = OFC_FALSE ;
   if (ptr != NULL && value < OFC_ENV_NUM)
     {
-      status = GetEnvironmentVariable (env2str[value], ptr, (DWORD) (len)) ;
+      /*
+       * Lookups are only timed while starting up
+       */
+      if (ofc_startup_active ())
+	{
+	  begin = ofc_startup_begin () ;
+	  status = GetEnvironmentVariable (env2str[value], ptr,
+					   (DWORD) (len)) ;
+	  ofc_startup_end (OFC_STARTUP_ENV, begin) ;
+	}
+      else
+	status = GetEnvironmentVariable (env2str[value], ptr, (DWORD) (len)) ;
 
       if (status > 0)
 	{
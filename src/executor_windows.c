@@ -0,0 +1,450 @@
+/* Copyright (c) 2021 Connected Way, LLC. All rights reserved.
+ * Use of this source code is governed by a Creative Commons
+ * Attribution-NoDerivatives 4.0 International license that can be
+ * found in the LICENSE file.
+ */
+#define __OFC_CORE_DLL__
+
+#include <windows.h>
+
+#include "ofc/types.h"
+#include "ofc/lock.h"
+#include "ofc/libc.h"
+#include "ofc/heap.h"
+
+#include "ofc_windows/config.h"
+#include "ofc_windows/executor_windows.h"
+
+/** \{ */
+
+/*
+ * A task that is waited for carries a manual reset event.  A posted
+ * task has none and is freed by the worker that runs it.
+ */
+struct _OFC_EXECUTOR_TASK
+{
+  OFC_EXECUTOR_FN fn ;
+  OFC_VOID *context ;
+  HANDLE done ;
+} ;
+
+/*
+ * The owner pushes and pops at the bottom.  Thieves take from the top.
+ * The ring is a power of two in size and top and bottom only grow
+ * until the deque empties.
+ */
+typedef struct
+{
+  OFC_LOCK lock ;
+  OFC_EXECUTOR_TASK **ring ;
+  OFC_INT size ;
+  OFC_INT top ;
+  OFC_INT bottom ;
+} EXECUTOR_DEQUE ;
+
+#define EXECUTOR_DEQUE_SIZE 64
+
+/*
+ * A parked OS thread waiting for ofc_executor_spawn to hand it work
+ */
+typedef struct _EXECUTOR_SPARE
+{
+  struct _EXECUTOR_SPARE *next ;
+  HANDLE wake ;
+  OFC_EXECUTOR_FN fn ;
+  OFC_VOID *context ;
+} EXECUTOR_SPARE ;
+
+static INIT_ONCE executor_once = INIT_ONCE_STATIC_INIT ;
+static EXECUTOR_DEQUE *executor_deques = OFC_NULL ;
+static OFC_INT executor_workers = 0 ;
+static HANDLE executor_wake = NULL ;
+static DWORD executor_tls = TLS_OUT_OF_INDEXES ;
+static volatile LONG executor_next = 0 ;
+static volatile LONG executor_queued = 0 ;
+static volatile LONG executor_stolen = 0 ;
+
+static SRWLOCK executor_spare_lock = SRWLOCK_INIT ;
+static EXECUTOR_SPARE *executor_spares = OFC_NULL ;
+
+static OFC_BOOL executor_push(EXECUTOR_DEQUE *deque, OFC_EXECUTOR_TASK *task)
+{
+  OFC_EXECUTOR_TASK **ring ;
+  OFC_BOOL ret ;
+  OFC_INT i ;
+
+  ret = OFC_TRUE ;
+  ofc_lock (deque->lock) ;
+  if (deque->bottom - deque->top == deque->size)
+    {
+      ring = ofc_malloc (sizeof (OFC_EXECUTOR_TASK *) * deque->size * 2) ;
+      if (ring == OFC_NULL)
+	ret = OFC_FALSE ;
+      else
+	{
+	  for (i = deque->top ; i < deque->bottom ; i++)
+	    ring[i & (deque->size * 2 - 1)] =
+	      deque->ring[i & (deque->size - 1)] ;
+	  ofc_free (deque->ring) ;
+	  deque->ring = ring ;
+	  deque->size *= 2 ;
+	}
+    }
+  if (ret)
+    {
+      deque->ring[deque->bottom & (deque->size - 1)] = task ;
+      deque->bottom++ ;
+    }
+  ofc_unlock (deque->lock) ;
+  return (ret) ;
+}
+
+static OFC_EXECUTOR_TASK *executor_pop(EXECUTOR_DEQUE *deque, OFC_BOOL steal)
+{
+  OFC_EXECUTOR_TASK *task ;
+
+  task = OFC_NULL ;
+  ofc_lock (deque->lock) ;
+  if (deque->bottom > deque->top)
+    {
+      if (steal)
+	{
+	  task = deque->ring[deque->top & (deque->size - 1)] ;
+	  deque->top++ ;
+	}
+      else
+	{
+	  deque->bottom-- ;
+	  task = deque->ring[deque->bottom & (deque->size - 1)] ;
+	}
+      if (deque->bottom == deque->top)
+	{
+	  deque->bottom = 0 ;
+	  deque->top = 0 ;
+	}
+    }
+  ofc_unlock (deque->lock) ;
+  return (task) ;
+}
+
+/*
+ * Index of the calling worker, or -1 if the caller is not a worker
+ */
+static OFC_INT executor_self(OFC_VOID)
+{
+  return ((OFC_INT) (OFC_DWORD_PTR) TlsGetValue (executor_tls) - 1) ;
+}
+
+/*
+ * Take and run one task.  The caller has already consumed a wake count
+ * so a task is queued somewhere, though a scan may pass a deque just
+ * before it is pushed to.
+ */
+static OFC_VOID executor_run_one(OFC_INT self)
+{
+  OFC_EXECUTOR_TASK *task ;
+  OFC_INT i ;
+
+  task = OFC_NULL ;
+  while (task == OFC_NULL)
+    {
+      if (self >= 0)
+	task = executor_pop (&executor_deques[self], OFC_FALSE) ;
+      for (i = 1 ; task == OFC_NULL && i <= executor_workers ; i++)
+	{
+	  task = executor_pop (&executor_deques[(self + i + executor_workers) %
+						executor_workers], OFC_TRUE) ;
+	  if (task != OFC_NULL)
+	    InterlockedIncrement (&executor_stolen) ;
+	}
+      if (task == OFC_NULL)
+	SwitchToThread () ;
+    }
+
+  InterlockedDecrement (&executor_queued) ;
+  (task->fn) (task->context) ;
+  if (task->done != NULL)
+    SetEvent (task->done) ;
+  else
+    ofc_free (task) ;
+}
+
+static DWORD WINAPI executor_worker(LPVOID arg)
+{
+  OFC_INT self ;
+
+  self = (OFC_INT) (OFC_DWORD_PTR) arg ;
+  TlsSetValue (executor_tls, (LPVOID) (OFC_DWORD_PTR) (self + 1)) ;
+  for (;;)
+    {
+      WaitForSingleObject (executor_wake, INFINITE) ;
+      executor_run_one (self) ;
+    }
+  return (0) ;
+}
+
+static BOOL CALLBACK executor_start(PINIT_ONCE once, PVOID param,
+				    PVOID *context)
+{
+  SYSTEM_INFO info ;
+  HANDLE thread ;
+  OFC_EXECUTOR_TASK **ring ;
+  OFC_INT count ;
+  OFC_INT ready ;
+  OFC_INT started ;
+
+  count = OFC_EXECUTOR_WORKERS ;
+  if (count <= 0)
+    {
+      GetSystemInfo (&info) ;
+      count = (OFC_INT) info.dwNumberOfProcessors ;
+    }
+
+  executor_tls = TlsAlloc () ;
+  executor_wake = CreateSemaphore (NULL, 0, MAXLONG, NULL) ;
+  executor_deques = ofc_malloc (sizeof (EXECUTOR_DEQUE) * count) ;
+
+  if (executor_tls != TLS_OUT_OF_INDEXES && executor_wake != NULL &&
+      executor_deques != OFC_NULL)
+    {
+      ready = 0 ;
+      do
+	{
+	  ring = ofc_malloc (sizeof (OFC_EXECUTOR_TASK *) *
+			     EXECUTOR_DEQUE_SIZE) ;
+	  if (ring != OFC_NULL)
+	    {
+	      executor_deques[ready].lock = ofc_lock_init () ;
+	      executor_deques[ready].size = EXECUTOR_DEQUE_SIZE ;
+	      executor_deques[ready].top = 0 ;
+	      executor_deques[ready].bottom = 0 ;
+	      executor_deques[ready].ring = ring ;
+	      ready++ ;
+	    }
+	}
+      while (ring != OFC_NULL && ready < count) ;
+      /*
+       * Deques are all set up before any worker can steal from them.
+       * Only workers that started, each with its deque, are counted.
+       */
+      started = 0 ;
+      do
+	{
+	  thread = NULL ;
+	  if (started < ready)
+	    thread = CreateThread (NULL, 0, executor_worker,
+				   (LPVOID) (OFC_DWORD_PTR) started, 0, NULL) ;
+	  if (thread != NULL)
+	    {
+	      CloseHandle (thread) ;
+	      started++ ;
+	    }
+	}
+      while (thread != NULL) ;
+      while (ready > started)
+	{
+	  ready-- ;
+	  ofc_lock_destroy (executor_deques[ready].lock) ;
+	  ofc_free (executor_deques[ready].ring) ;
+	}
+      executor_workers = started ;
+    }
+  return (TRUE) ;
+}
+
+OFC_VOID ofc_executor_init(OFC_VOID)
+{
+  InitOnceExecuteOnce (&executor_once, executor_start, NULL, NULL) ;
+}
+
+static OFC_BOOL executor_queue(OFC_EXECUTOR_TASK *task)
+{
+  OFC_INT self ;
+  OFC_BOOL ret ;
+
+  ret = OFC_FALSE ;
+  ofc_executor_init () ;
+  if (executor_workers > 0)
+    {
+      self = executor_self () ;
+      if (self < 0)
+	self = (OFC_INT) ((ULONG) InterlockedIncrement (&executor_next) %
+			  (ULONG) executor_workers) ;
+      if (executor_push (&executor_deques[self], task))
+	{
+	  InterlockedIncrement (&executor_queued) ;
+	  ReleaseSemaphore (executor_wake, 1, NULL) ;
+	  ret = OFC_TRUE ;
+	}
+    }
+  return (ret) ;
+}
+
+OFC_EXECUTOR_TASK *ofc_executor_submit(OFC_EXECUTOR_FN fn,
+                                       OFC_VOID *context)
+{
+  OFC_EXECUTOR_TASK *task ;
+
+  task = ofc_malloc (sizeof (OFC_EXECUTOR_TASK)) ;
+  if (task != OFC_NULL)
+    {
+      task->fn = fn ;
+      task->context = context ;
+      task->done = CreateEvent (NULL, TRUE, FALSE, NULL) ;
+      if (task->done == NULL || !executor_queue (task))
+	{
+	  if (task->done != NULL)
+	    CloseHandle (task->done) ;
+	  ofc_free (task) ;
+	  task = OFC_NULL ;
+	}
+    }
+  return (task) ;
+}
+
+OFC_BOOL ofc_executor_post(OFC_EXECUTOR_FN fn, OFC_VOID *context)
+{
+  OFC_EXECUTOR_TASK *task ;
+  OFC_BOOL ret ;
+
+  ret = OFC_FALSE ;
+  task = ofc_malloc (sizeof (OFC_EXECUTOR_TASK)) ;
+  if (task != OFC_NULL)
+    {
+      task->fn = fn ;
+      task->context = context ;
+      task->done = NULL ;
+      ret = executor_queue (task) ;
+      if (!ret)
+	ofc_free (task) ;
+    }
+  return (ret) ;
+}
+
+OFC_VOID ofc_executor_wait(OFC_EXECUTOR_TASK *task)
+{
+  HANDLE handles[2] ;
+  OFC_INT self ;
+
+  self = executor_self () ;
+  if (self < 0)
+    WaitForSingleObject (task->done, INFINITE) ;
+  else
+    {
+      /*
+       * A worker keeps running queued tasks while it waits so a task
+       * that waits on its own subtasks cannot starve the pool
+       */
+      handles[0] = task->done ;
+      handles[1] = executor_wake ;
+      while (WaitForMultipleObjects (2, handles, FALSE, INFINITE) ==
+	     WAIT_OBJECT_0 + 1)
+	executor_run_one (self) ;
+    }
+  CloseHandle (task->done) ;
+  ofc_free (task) ;
+}
+
+OFC_VOID ofc_executor_stats(OFC_INT *workers, OFC_INT *queued,
+                            OFC_UINT32 *stolen)
+{
+  if (workers != OFC_NULL)
+    *workers = executor_workers ;
+  if (queued != OFC_NULL)
+    *queued = (OFC_INT) executor_queued ;
+  if (stolen != OFC_NULL)
+    *stolen = (OFC_UINT32) executor_stolen ;
+}
+
+static DWORD WINAPI executor_spare_run(LPVOID arg)
+{
+  EXECUTOR_SPARE *spare ;
+  EXECUTOR_SPARE **link ;
+  OFC_BOOL parked ;
+
+  spare = arg ;
+  parked = OFC_TRUE ;
+  while (parked)
+    {
+      (spare->fn) (spare->context) ;
+
+      AcquireSRWLockExclusive (&executor_spare_lock) ;
+      spare->next = executor_spares ;
+      executor_spares = spare ;
+      ReleaseSRWLockExclusive (&executor_spare_lock) ;
+
+      if (WaitForSingleObject (spare->wake, OFC_THREAD_POOL_IDLE) ==
+	  WAIT_TIMEOUT)
+	{
+	  /*
+	   * Leave unless a spawn took us off the list in the meantime, in
+	   * which case its wake is on the way
+	   */
+	  AcquireSRWLockExclusive (&executor_spare_lock) ;
+	  for (link = &executor_spares ; *link != OFC_NULL && *link != spare ;
+	       link = &(*link)->next) ;
+	  if (*link == spare)
+	    {
+	      *link = spare->next ;
+	      parked = OFC_FALSE ;
+	    }
+	  ReleaseSRWLockExclusive (&executor_spare_lock) ;
+
+	  if (parked)
+	    WaitForSingleObject (spare->wake, INFINITE) ;
+	}
+    }
+
+  CloseHandle (spare->wake) ;
+  ofc_free (spare) ;
+  return (0) ;
+}
+
+OFC_BOOL ofc_executor_spawn(OFC_EXECUTOR_FN fn, OFC_VOID *context)
+{
+  EXECUTOR_SPARE *spare ;
+  HANDLE thread ;
+  OFC_BOOL ret ;
+
+  ret = OFC_FALSE ;
+  AcquireSRWLockExclusive (&executor_spare_lock) ;
+  spare = executor_spares ;
+  if (spare != OFC_NULL)
+    executor_spares = spare->next ;
+  ReleaseSRWLockExclusive (&executor_spare_lock) ;
+
+  if (spare != OFC_NULL)
+    {
+      spare->fn = fn ;
+      spare->context = context ;
+      SetEvent (spare->wake) ;
+      ret = OFC_TRUE ;
+    }
+  else
+    {
+      spare = ofc_malloc (sizeof (EXECUTOR_SPARE)) ;
+      if (spare != OFC_NULL)
+	{
+	  spare->fn = fn ;
+	  spare->context = context ;
+	  spare->wake = CreateEvent (NULL, FALSE, FALSE, NULL) ;
+	  thread = NULL ;
+	  if (spare->wake != NULL)
+	    thread = CreateThread (NULL, 0, executor_spare_run, spare, 0, NULL) ;
+	  if (thread != NULL)
+	    {
+	      CloseHandle (thread) ;
+	      ret = OFC_TRUE ;
+	    }
+	  else
+	    {
+	      if (spare->wake != NULL)
+		CloseHandle (spare->wake) ;
+	      ofc_free (spare) ;
+	    }
+	}
+    }
+  return (ret) ;
+}
+
+/** \} */
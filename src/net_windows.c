@@ -7,19 +7,28 @@
 
 #include <winsock2.h>
 #include <ws2tcpip.h>
-#if defined(_WINCE_)
-#include <Iphlpapi.h>
-#endif
+#include <mstcpip.h>
+#include <iphlpapi.h>
 
 #include "ofc/core.h"
 #include "ofc/types.h"
 #include "ofc/config.h"
 #include "ofc/libc.h"
 #include "ofc/heap.h"
+#include "ofc/lock.h"
+#include "ofc/event.h"
 #include "ofc/net.h"
+#include "ofc/socket.h"
 #include "ofc/net_internal.h"
 #include "ofc/file.h"
 #include "ofc_windows/config.h"
+#include "ofc_windows/net_windows.h"
+#include "ofc_windows/socket_windows.h"
+#include "ofc_windows/sockmem_windows.h"
+#include "ofc_windows/bufpool_windows.h"
+#include "ofc_windows/connpool_windows.h"
+#include "ofc_windows/dnscache_windows.h"
+#include "ofc_windows/startup_windows.h"
 
 /**
  * \defgroup net_windows Windows Network Implementation
@@ -27,18 +36,126 @@
 
 /** \{ */
 
+#if !defined(SIO_QUERY_RSS_SCALABILITY_INFO)
+#define SIO_QUERY_RSS_SCALABILITY_INFO _WSAIOR(IOC_VENDOR, 210)
+typedef struct _RSS_SCALABILITY_INFO
+{
+  BOOLEAN RssEnabled ;
+} RSS_SCALABILITY_INFO ;
+#endif
+
+/*
+ * The interface table is built once and published as an immutable
+ * snapshot.  Readers take the current snapshot without a lock.  A
+ * replaced snapshot is parked on the retired list and freed once no
+ * reader is inside the table.
+ */
+typedef struct
+{
+  OFC_IPADDR addr ;
+  OFC_IPADDR bcast ;
+  OFC_IPADDR mask ;
+  OFC_NET_WIN32_INFO info ;
+} NET_INTERFACE ;
+
+typedef struct _NET_SNAPSHOT
+{
+  struct _NET_SNAPSHOT *next ;
+  OFC_INT count ;
+  NET_INTERFACE iface[1] ;
+} NET_SNAPSHOT ;
+
+/*
+ * One address change watcher per family.  SIO_ADDRESS_LIST_CHANGE only
+ * reports changes for the family of the socket it is posted on.
+ */
+#define NET_WATCH_MAX 2
+
+typedef struct
+{
+  SOCKET notify ;
+  WSAOVERLAPPED overlapped ;
+} NET_WATCH ;
+
+static OFC_LOCK net_lock = OFC_NULL ;
+static NET_SNAPSHOT *volatile net_current = OFC_NULL ;
+static NET_SNAPSHOT *net_retired = OFC_NULL ;
+static volatile LONG net_readers = 0 ;
+static volatile LONG net_generation = 0 ;
+static NET_WATCH net_watch[NET_WATCH_MAX] ;
+static HANDLE net_watch_event = NULL ;
+static HANDLE net_watch_wait = NULL ;
+static OFC_HANDLE *net_config_events = OFC_NULL ;
+static OFC_INT net_config_count = 0 ;
+
 OFC_VOID ofc_net_init_impl(OFC_VOID) {
   WORD wVersionRequested ;
   WSADATA wsaData ;
+  OFC_INT i ;
+  OFC_UINT64 begin ;
 
+  begin = ofc_startup_begin () ;
   wVersionRequested = MAKEWORD (2, 0) ;
   WSAStartup (wVersionRequested, &wsaData) ;
+  ofc_startup_end (OFC_STARTUP_WSA, begin) ;
+
+  if (net_lock == OFC_NULL)
+    {
+      net_lock = ofc_lock_init () ;
+      for (i = 0 ; i < NET_WATCH_MAX ; i++)
+	net_watch[i].notify = INVALID_SOCKET ;
+    }
+
+  /*
+   * The interface table is not built here.  It is enumerated on first
+   * use, which is often well after startup.
+   */
+  begin = ofc_startup_begin () ;
+  ofc_socket_win32_init () ;
+  ofc_startup_end (OFC_STARTUP_SOCKET, begin) ;
+
+  begin = ofc_startup_begin () ;
+  ofc_sockmem_init () ;
+  ofc_startup_end (OFC_STARTUP_SOCKMEM, begin) ;
+
+  begin = ofc_startup_begin () ;
+  ofc_bufpool_init () ;
+  ofc_startup_end (OFC_STARTUP_BUFPOOL, begin) ;
+
+  begin = ofc_startup_begin () ;
+  ofc_connpool_init () ;
+  ofc_startup_end (OFC_STARTUP_CONNPOOL, begin) ;
+
+  begin = ofc_startup_begin () ;
+  ofc_dnscache_init () ;
+  ofc_startup_end (OFC_STARTUP_DNSCACHE, begin) ;
 }
 
 OFC_VOID ofc_net_register_config_impl(OFC_HANDLE hEvent) {
+  OFC_HANDLE *events ;
+
+  ofc_lock (net_lock) ;
+  events = ofc_realloc (net_config_events,
+			sizeof (OFC_HANDLE) * (net_config_count + 1)) ;
+  if (events != OFC_NULL)
+    {
+      events[net_config_count++] = hEvent ;
+      net_config_events = events ;
+    }
+  ofc_unlock (net_lock) ;
 }
 
 OFC_VOID ofc_net_unregister_config_impl(OFC_HANDLE hEvent) {
+  OFC_INT i ;
+
+  ofc_lock (net_lock) ;
+  for (i = 0 ; i < net_config_count && net_config_events[i] != hEvent ; i++) ;
+  if (i < net_config_count)
+    {
+      net_config_count-- ;
+      net_config_events[i] = net_config_events[net_config_count] ;
+    }
+  ofc_unlock (net_lock) ;
 }
 
 static OFC_BOOL match_families(INTERFACE_INFO *ifaddrp) {
@@ -59,46 +176,197 @@ static OFC_BOOL match_families(INTERFACE_INFO *ifaddrp) {
 
 }
 
-OFC_INT ofc_net_interface_count_impl(OFC_VOID) {
-  OFC_INT count ;
-  OFC_INT max_count ;
+/*
+ * Fetch the IPv4 interface list, growing the buffer until it fits.
+ * Receive side scaling is a stack wide setting so it is queried here
+ * on the same socket.
+ */
+static INTERFACE_INFO *net_interface_list(OFC_INT *count, OFC_BOOL *rss) {
   SOCKET dgramSocket ;
-  INTERFACE_INFO localAddr[OFC_MAX_NETWORK_INTERFACES];  
+  INTERFACE_INFO *localAddr ;
+  RSS_SCALABILITY_INFO rssInfo ;
+  DWORD size ;
   DWORD bytesReturned ;
+  OFC_BOOL retry ;
+
+  *count = 0 ;
+  *rss = OFC_FALSE ;
+  localAddr = OFC_NULL ;
+  dgramSocket = WSASocket (AF_INET, SOCK_DGRAM, IPPROTO_UDP, NULL, 0, 0) ;
+  if (dgramSocket != INVALID_SOCKET)
+    {
+      size = 16 * sizeof (INTERFACE_INFO) ;
+      do
+	{
+	  retry = OFC_FALSE ;
+	  localAddr = ofc_malloc (size) ;
+	  if (localAddr != OFC_NULL)
+	    {
+	      bytesReturned = 0 ;
+	      if (WSAIoctl (dgramSocket, SIO_GET_INTERFACE_LIST, NULL, 0,
+			    localAddr, size, &bytesReturned,
+			    NULL, NULL) == 0)
+		*count = bytesReturned / sizeof (INTERFACE_INFO) ;
+	      else
+		{
+		  if (WSAGetLastError () == WSAEFAULT ||
+		      WSAGetLastError () == WSAENOBUFS)
+		    {
+		      size *= 2 ;
+		      retry = OFC_TRUE ;
+		    }
+		  ofc_free (localAddr) ;
+		  localAddr = OFC_NULL ;
+		}
+	    }
+	}
+      while (retry) ;
+
+      if (WSAIoctl (dgramSocket, SIO_QUERY_RSS_SCALABILITY_INFO, NULL, 0,
+		    &rssInfo, sizeof (rssInfo), &bytesReturned,
+		    NULL, NULL) == 0)
+	*rss = rssInfo.RssEnabled ? OFC_TRUE : OFC_FALSE ;
+      closesocket (dgramSocket) ;
+    }
+  return (localAddr) ;
+}
+
+static OFC_VOID net_interface_none(NET_INTERFACE *iface) {
+  iface->addr.ip_version = OFC_FAMILY_IP ;
+  iface->addr.u.ipv4.addr = OFC_INADDR_NONE ;
+  iface->bcast.ip_version = OFC_FAMILY_IP ;
+  iface->bcast.u.ipv4.addr = OFC_INADDR_NONE ;
+  iface->mask.ip_version = OFC_FAMILY_IP ;
+  iface->mask.u.ipv4.addr = OFC_INADDR_NONE ;
+  ofc_memset (&iface->info, '\0', sizeof (OFC_NET_WIN32_INFO)) ;
+}
+
+/*
+ * Fetch the adapter list, growing the buffer until it fits
+ */
+static IP_ADAPTER_ADDRESSES *net_adapter_list(OFC_VOID) {
+  IP_ADAPTER_ADDRESSES *adapters ;
+  ULONG size ;
+  ULONG ret ;
+
+  size = 16384 ;
+  do
+    {
+      adapters = ofc_malloc (size) ;
+      if (adapters == OFC_NULL)
+	ret = ERROR_NOT_ENOUGH_MEMORY ;
+      else
+	{
+	  ret = GetAdaptersAddresses (AF_UNSPEC,
+				      GAA_FLAG_SKIP_ANYCAST |
+				      GAA_FLAG_SKIP_MULTICAST |
+				      GAA_FLAG_SKIP_DNS_SERVER,
+				      NULL, adapters, &size) ;
+	  if (ret != NO_ERROR)
+	    {
+	      ofc_free (adapters) ;
+	      adapters = OFC_NULL ;
+	    }
+	}
+    }
+  while (ret == ERROR_BUFFER_OVERFLOW) ;
+
+  return (adapters) ;
+}
+
+static OFC_BOOL net_adapter_match(IP_ADAPTER_ADDRESSES *adapter,
+				  OFC_IPADDR *ip) {
+  IP_ADAPTER_UNICAST_ADDRESS *unicast ;
+  SOCKADDR_IN *pAddrInet ;
+  SOCKADDR_IN6 *pAddrInet6 ;
+  OFC_BOOL ret ;
+  OFC_INT i ;
+
+  ret = OFC_FALSE ;
+  for (unicast = adapter->FirstUnicastAddress ;
+       unicast != NULL && !ret ; unicast = unicast->Next)
+    {
+      if (ip->ip_version == OFC_FAMILY_IP &&
+	  unicast->Address.lpSockaddr->sa_family == AF_INET)
+	{
+	  pAddrInet = (SOCKADDR_IN *) unicast->Address.lpSockaddr ;
+	  ret = (OFC_NET_NTOL (&pAddrInet->sin_addr.s_addr, 0) ==
+		 ip->u.ipv4.addr) ;
+	}
+      else if (ip->ip_version == OFC_FAMILY_IPV6 &&
+	       unicast->Address.lpSockaddr->sa_family == AF_INET6)
+	{
+	  pAddrInet6 = (SOCKADDR_IN6 *) unicast->Address.lpSockaddr ;
+	  for (i = 0 ; i < 16 &&
+		 ip->u.ipv6._s6_addr[i] == pAddrInet6->sin6_addr.s6_addr[i] ;
+	       i++) ;
+	  ret = (i == 16) ;
+	}
+    }
+  return (ret) ;
+}
+
+/*
+ * Fill in the link details of each interface from the adapter that
+ * carries its address
+ */
+static OFC_VOID net_snapshot_links(NET_SNAPSHOT *snap, OFC_BOOL rss) {
+  IP_ADAPTER_ADDRESSES *adapters ;
+  IP_ADAPTER_ADDRESSES *adapter ;
+  NET_INTERFACE *iface ;
   OFC_INT i ;
 
+  adapters = net_adapter_list () ;
+  for (i = 0 ; i < snap->count ; i++)
+    {
+      iface = &snap->iface[i] ;
+      iface->info.rss = rss ;
+      for (adapter = adapters ;
+	   adapter != NULL && !net_adapter_match (adapter, &iface->addr) ;
+	   adapter = adapter->Next) ;
+      if (adapter != NULL)
+	{
+	  iface->info.ifindex = adapter->IfIndex != 0 ?
+	    adapter->IfIndex : adapter->Ipv6IfIndex ;
+	  iface->info.mtu = adapter->Mtu ;
+	  iface->info.speed = adapter->TransmitLinkSpeed ;
+	  iface->info.type = adapter->IfType ;
+	}
+    }
+  if (adapters != OFC_NULL)
+    ofc_free (adapters) ;
+}
+
+/*
+ * Enumerate every interface once and build a snapshot of the result
+ */
+static NET_SNAPSHOT *net_snapshot_build(OFC_VOID) {
+  NET_SNAPSHOT *snap ;
+  NET_INTERFACE *iface ;
+  INTERFACE_INFO *localAddr ;
+  OFC_INT count ;
+  OFC_INT max_count ;
+  OFC_INT i ;
+  OFC_BOOL rss ;
+  SOCKADDR_IN *pAddrInet ;
+  SOCKADDR_IN *pMaskInet ;
+  SOCKADDR_IN *pBCastInet ;
 #if defined(OFC_DISCOVER_IPV6)
+  SOCKADDR_IN6 *pAddrInet6 ;
   ADDRINFOA *res ;
   ADDRINFOA *p ;
   ADDRINFOA hints ;
-  int ret ;
+  OFC_INT j ;
 #endif
 
-  max_count = 0 ;
-  /*
-   * Fist get IPv4 info
-   */
-  dgramSocket = socket(AF_INET, SOCK_DGRAM, 0);
-
-  WSAIoctl(dgramSocket,
-	   SIO_GET_INTERFACE_LIST, 
-	   NULL, 
-	   0, 
-	   &localAddr,
-	   sizeof(localAddr),
-	   &bytesReturned,
-	   NULL,
-	   NULL);
-
-  closesocket(dgramSocket);
-
-  count = bytesReturned / sizeof(INTERFACE_INFO) ;
+  localAddr = net_interface_list (&count, &rss) ;
 
+  max_count = 0 ;
   for (i = 0 ; i < count ; i++)
     {
       if ((localAddr[i].iiFlags & IFF_UP) &&
 	  match_families (&localAddr[i]))
-	  max_count++ ;
+	max_count++ ;
     }
 
 #if defined(OFC_DISCOVER_IPV6)
@@ -110,179 +378,287 @@ OFC_INT ofc_net_interface_count_impl(OFC_VOID) {
   hints.ai_family = AF_INET6 ;
   hints.ai_socktype = 0 ;
   hints.ai_flags = AI_ADDRCONFIG ;
- 
+
   res = NULL ;
-  ret = GetAddrInfoA ("", NULL, &hints, &res) ;
+  if (GetAddrInfoA ("", NULL, &hints, &res) != 0)
+    res = NULL ;
+
+  for (p = res ; p != NULL ; p = p->ai_next)
+    {
+      if (p->ai_family == AF_INET6)
+	max_count++ ;
+    }
+#endif
 
-  if (ret == 0)
+  snap = ofc_malloc (sizeof (NET_SNAPSHOT) +
+		     sizeof (NET_INTERFACE) * max_count) ;
+  if (snap != OFC_NULL)
     {
+      snap->next = OFC_NULL ;
+      snap->count = 0 ;
+
+      for (i = 0 ; i < count ; i++)
+	{
+	  if ((localAddr[i].iiFlags & IFF_UP) &&
+	      match_families (&localAddr[i]))
+	    {
+	      iface = &snap->iface[snap->count++] ;
+	      net_interface_none (iface) ;
+	      if (localAddr[i].iiAddress.Address.sa_family == AF_INET)
+		{
+		  pAddrInet = (SOCKADDR_IN *) &localAddr[i].iiAddress ;
+		  pMaskInet = (SOCKADDR_IN *) &localAddr[i].iiNetmask ;
+		  pBCastInet =
+		    (SOCKADDR_IN *) &localAddr[i].iiBroadcastAddress ;
+		  pBCastInet->sin_addr.s_addr &= ~pMaskInet->sin_addr.s_addr ;
+		  pBCastInet->sin_addr.s_addr |= pAddrInet->sin_addr.s_addr ;
+
+		  iface->addr.u.ipv4.addr =
+		    OFC_NET_NTOL (&pAddrInet->sin_addr.s_addr, 0) ;
+		  iface->bcast.u.ipv4.addr =
+		    OFC_NET_NTOL (&pBCastInet->sin_addr.s_addr, 0) ;
+		  iface->mask.u.ipv4.addr =
+		    OFC_NET_NTOL (&pMaskInet->sin_addr.s_addr, 0) ;
+		}
+	    }
+	}
+
+#if defined(OFC_DISCOVER_IPV6)
       for (p = res ; p != NULL ; p = p->ai_next)
 	{
 	  if (p->ai_family == AF_INET6)
 	    {
-	      max_count++ ;
+	      iface = &snap->iface[snap->count++] ;
+	      net_interface_none (iface) ;
+	      pAddrInet6 = (SOCKADDR_IN6 *) p->ai_addr ;
+	      iface->addr.ip_version = OFC_FAMILY_IPV6 ;
+	      for (j = 0 ; j < 16 ; j++)
+		iface->addr.u.ipv6._s6_addr[j] =
+		  pAddrInet6->sin6_addr.s6_addr[j] ;
+	      iface->addr.u.ipv6.scope = pAddrInet6->sin6_scope_id ;
+	      iface->bcast.ip_version = OFC_FAMILY_IPV6 ;
+	      iface->bcast.u.ipv6 = ofc_in6addr_bcast ;
+	      iface->bcast.u.ipv6.scope = pAddrInet6->sin6_scope_id ;
+	      iface->mask.ip_version = OFC_FAMILY_IPV6 ;
+	      iface->mask.u.ipv6 = ofc_in6addr_none ;
+	      iface->mask.u.ipv6.scope = pAddrInet6->sin6_scope_id ;
 	    }
 	}
-      freeaddrinfo (res) ;
-    }
 #endif
-  
-  return (max_count) ;
-}
-
-OFC_VOID ofc_net_interface_addr_impl(OFC_INT index,
-                                     OFC_IPADDR *pinaddr,
-                                     OFC_IPADDR *pbcast,
-                                     OFC_IPADDR *pmask) {
-  OFC_INT count ;
-  OFC_INT max_count ;
-  OFC_INT i ;
-  SOCKET dgramSocket ;
-  INTERFACE_INFO localAddr[OFC_MAX_NETWORK_INTERFACES];  
-  DWORD bytesReturned ;
-  SOCKADDR_IN *pAddrInet ;
-  SOCKADDR_IN *pBCastInet ;
+      net_snapshot_links (snap, rss) ;
+    }
 
 #if defined(OFC_DISCOVER_IPV6)
-  SOCKADDR_IN6 *pAddrInet6 ;
-  ADDRINFOA *res ;
-  ADDRINFOA *p ;
-  ADDRINFOA hints ;
-  int ret ;
+  if (res != NULL)
+    freeaddrinfo (res) ;
 #endif
+  if (localAddr != OFC_NULL)
+    ofc_free (localAddr) ;
 
-  if (pinaddr != OFC_NULL)
+  return (snap) ;
+}
+
+/*
+ * Free retired snapshots if no reader is inside the table.  The list is
+ * taken before the reader count is checked so a snapshot retired after
+ * the check is never freed under a reader that loaded it.
+ */
+static OFC_VOID net_snapshot_reclaim(OFC_VOID) {
+  NET_SNAPSHOT *retired ;
+  NET_SNAPSHOT *snap ;
+
+  ofc_lock (net_lock) ;
+  retired = net_retired ;
+  net_retired = OFC_NULL ;
+  if (InterlockedCompareExchange (&net_readers, 0, 0) != 0)
     {
-      pinaddr->ip_version = OFC_FAMILY_IP ;
-      pinaddr->u.ipv4.addr = OFC_INADDR_NONE ;
+      net_retired = retired ;
+      retired = OFC_NULL ;
     }
-  if (pbcast != OFC_NULL)
+  ofc_unlock (net_lock) ;
+
+  while (retired != OFC_NULL)
     {
-      pbcast->ip_version = OFC_FAMILY_IP ;
-      pbcast->u.ipv4.addr = OFC_INADDR_NONE ;
+      snap = retired ;
+      retired = snap->next ;
+      ofc_free (snap) ;
     }
-  if (pmask != OFC_NULL)
+}
+
+static OFC_VOID net_watch_arm(NET_WATCH *watch) {
+  DWORD bytes ;
+
+  if (watch->notify != INVALID_SOCKET)
     {
-      pmask->ip_version = OFC_FAMILY_IP ;
-      pmask->u.ipv4.addr = OFC_INADDR_NONE ;
+      watch->overlapped.hEvent = net_watch_event ;
+      WSAIoctl (watch->notify, SIO_ADDRESS_LIST_CHANGE, NULL, 0, NULL, 0,
+		&bytes, &watch->overlapped, NULL) ;
     }
-  /*
-   * See if it's an IPv4 
-   */
-  dgramSocket = WSASocket(AF_INET, SOCK_DGRAM, IPPROTO_UDP, NULL, 0, 0) ;
+}
 
-  WSAIoctl(dgramSocket,
-	   SIO_GET_INTERFACE_LIST, 
-	   NULL, 
-	   0, 
-	   &localAddr,
-	   sizeof(localAddr),
-	   &bytesReturned,
-	   NULL,
-	   NULL);
+static OFC_VOID net_snapshot_refresh(OFC_BOOL force) ;
+
+static VOID CALLBACK net_watch_fired(PVOID context, BOOLEAN timeout) {
+  OFC_INT i ;
+
+  for (i = 0 ; i < NET_WATCH_MAX ; i++)
+    {
+      if (net_watch[i].notify != INVALID_SOCKET &&
+	  HasOverlappedIoCompleted (&net_watch[i].overlapped))
+	{
+	  ofc_memset (&net_watch[i].overlapped, '\0', sizeof (WSAOVERLAPPED)) ;
+	  net_watch_arm (&net_watch[i]) ;
+	}
+    }
 
-  closesocket(dgramSocket);
+  net_snapshot_refresh (OFC_TRUE) ;
+  ofc_dnscache_flush () ;
 
-  count = bytesReturned / sizeof(INTERFACE_INFO) ;
+  ofc_lock (net_lock) ;
+  for (i = 0 ; i < net_config_count ; i++)
+    ofc_event_set (net_config_events[i]) ;
+  ofc_unlock (net_lock) ;
+}
 
-  max_count = 0 ;
+/*
+ * Post the address change watchers.  Called with net_lock held before
+ * the first enumeration so no change is missed.
+ */
+static OFC_VOID net_watch_start(OFC_VOID) {
+  OFC_INT i ;
 
-  for (i = 0 ; i < count && max_count < index ; i++)
+  net_watch_event = CreateEvent (NULL, FALSE, FALSE, NULL) ;
+  if (net_watch_event != NULL)
     {
-      if ((localAddr[i].iiFlags & IFF_UP) &&
-	  match_families(&localAddr[i]))
-	max_count++ ;
+      net_watch[0].notify = WSASocket (AF_INET, SOCK_DGRAM, IPPROTO_UDP,
+				       NULL, 0, WSA_FLAG_OVERLAPPED) ;
+#if defined(OFC_DISCOVER_IPV6)
+      net_watch[1].notify = WSASocket (AF_INET6, SOCK_DGRAM, IPPROTO_UDP,
+				       NULL, 0, WSA_FLAG_OVERLAPPED) ;
+#endif
+      for (i = 0 ; i < NET_WATCH_MAX ; i++)
+	{
+	  ofc_memset (&net_watch[i].overlapped, '\0', sizeof (WSAOVERLAPPED)) ;
+	  net_watch_arm (&net_watch[i]) ;
+	}
+
+      if (!RegisterWaitForSingleObject (&net_watch_wait, net_watch_event,
+					net_watch_fired, NULL, INFINITE,
+					WT_EXECUTEDEFAULT))
+	net_watch_wait = NULL ;
     }
+}
+
+/*
+ * Rebuild the table.  Unless forced, only build it if there is none yet.
+ */
+static OFC_VOID net_snapshot_refresh(OFC_BOOL force) {
+  NET_SNAPSHOT *snap ;
+  NET_SNAPSHOT *old ;
+  OFC_UINT64 begin ;
 
-  if ((max_count < count) && (max_count == index))
+  ofc_lock (net_lock) ;
+  if (force || net_current == OFC_NULL)
     {
-      /*
-       * Found it as an IPv4 addess
-       */
-      if (localAddr[index].iiAddress.Address.sa_family == AF_INET)
+      begin = ofc_startup_begin () ;
+      if (net_watch_event == NULL)
+	net_watch_start () ;
+
+      snap = net_snapshot_build () ;
+      ofc_startup_end (OFC_STARTUP_INTERFACES, begin) ;
+      if (snap != OFC_NULL)
 	{
-	  if (pinaddr != OFC_NULL)
-	    {
-	      pAddrInet = (SOCKADDR_IN *) &localAddr[index].iiAddress ;
-	      pinaddr->ip_version = OFC_FAMILY_IP ;
-	      pinaddr->u.ipv4.addr = 
-		OFC_NET_NTOL (&pAddrInet->sin_addr.s_addr, 0) ;
-	    }
-	  if (pbcast != OFC_NULL)
-	    {
-	      pBCastInet =
-		(SOCKADDR_IN *) &localAddr[index].iiBroadcastAddress ;
-	      pAddrInet = (SOCKADDR_IN *) &localAddr[index].iiNetmask ;
-	      pBCastInet->sin_addr.s_addr &= ~pAddrInet->sin_addr.s_addr ;
-	      pAddrInet = (SOCKADDR_IN *) &localAddr[index].iiAddress ;
-	      pBCastInet->sin_addr.s_addr |= pAddrInet->sin_addr.s_addr ;
-	      pbcast->ip_version = OFC_FAMILY_IP ;
-	      pbcast->u.ipv4.addr = 
-		OFC_NET_NTOL (&pBCastInet->sin_addr.s_addr, 0) ;
-	    }
-	  if (pmask != OFC_NULL)
+	  old = InterlockedExchangePointer ((PVOID volatile *) &net_current,
+					    snap) ;
+	  if (old != OFC_NULL)
 	    {
-	      pAddrInet = (SOCKADDR_IN *) &localAddr[index].iiNetmask  ;
-	      pmask->ip_version = OFC_FAMILY_IP ;
-	      pmask->u.ipv4.addr =
-		OFC_NET_NTOL (&pAddrInet->sin_addr.s_addr, 0) ;
+	      old->next = net_retired ;
+	      net_retired = old ;
 	    }
+	  InterlockedIncrement (&net_generation) ;
 	}
     }
+  ofc_unlock (net_lock) ;
 
-#if defined(OFC_DISCOVER_IPV6)
-  else if (max_count <= index)
+  net_snapshot_reclaim () ;
+}
+
+static NET_SNAPSHOT *net_snapshot_acquire(OFC_VOID) {
+  NET_SNAPSHOT *snap ;
+
+  InterlockedIncrement (&net_readers) ;
+  snap = InterlockedCompareExchangePointer ((PVOID volatile *) &net_current,
+					    OFC_NULL, OFC_NULL) ;
+  if (snap == OFC_NULL)
     {
-      /* Go through IPv6 addresses */
-      ofc_memset ((OFC_VOID *)&hints, 0, sizeof (hints)) ;
+      net_snapshot_refresh (OFC_FALSE) ;
+      snap = InterlockedCompareExchangePointer ((PVOID volatile *)
+						&net_current,
+						OFC_NULL, OFC_NULL) ;
+    }
+  return (snap) ;
+}
+
+static OFC_VOID net_snapshot_release(OFC_VOID) {
+  if (InterlockedDecrement (&net_readers) == 0 && net_retired != OFC_NULL)
+    net_snapshot_reclaim () ;
+}
 
-      hints.ai_family = AF_INET6 ;
-      hints.ai_socktype = 0 ;
-      hints.ai_flags = AI_ADDRCONFIG ;
+OFC_INT ofc_net_interface_count_impl(OFC_VOID) {
+  NET_SNAPSHOT *snap ;
+  OFC_INT max_count ;
 
-      res = NULL ;
-      ret = GetAddrInfoA ("", NULL, &hints, &res) ;
+  max_count = 0 ;
+  snap = net_snapshot_acquire () ;
+  if (snap != OFC_NULL)
+    max_count = snap->count ;
+  net_snapshot_release () ;
 
-      if (ret == 0)
-	{
-	  for (p = res ; p != NULL && max_count < index; )
-	    {
-	      max_count++ ;
-	      p = p->ai_next ;
-	    }
+  return (max_count) ;
+}
 
-	  if (max_count == index)
-	    {
-	      OFC_INT scope ;
-	  
-	      if (pinaddr != OFC_NULL)
-		{
-		  pAddrInet6 = (struct sockaddr_in6 *) p->ai_addr ;
-		  scope = pAddrInet6->sin6_scope_id ;
-		  pinaddr->ip_version = OFC_FAMILY_IPV6 ;
-		  for (i = 0 ; i < 16 ; i++)
-		    pinaddr->u.ipv6._s6_addr[i] =
-		      pAddrInet6->sin6_addr.s6_addr[i] ;
-		  pinaddr->u.ipv6.scope = scope ;
-		}
-	      if (pbcast != OFC_NULL)
-		{
-		  pbcast->ip_version = OFC_FAMILY_IPV6 ;
-		  pbcast->u.ipv6 = ofc_in6addr_bcast ;
-		  pbcast->u.ipv6.scope = scope ;
-		}
-	      if (pmask != OFC_NULL)
-		{
-		  pmask->ip_version = OFC_FAMILY_IPV6 ;
-		  pmask->u.ipv6 = ofc_in6addr_none ;
-		  pmask->u.ipv6.scope = scope ;
-		}
-	    }
+OFC_VOID ofc_net_interface_addr_impl(OFC_INT index,
+                                     OFC_IPADDR *pinaddr,
+                                     OFC_IPADDR *pbcast,
+                                     OFC_IPADDR *pmask) {
+  NET_SNAPSHOT *snap ;
+  NET_INTERFACE iface ;
 
-	  freeaddrinfo (res) ;
-	}
+  net_interface_none (&iface) ;
+
+  snap = net_snapshot_acquire () ;
+  if (snap != OFC_NULL && index >= 0 && index < snap->count)
+    iface = snap->iface[index] ;
+  net_snapshot_release () ;
+
+  if (pinaddr != OFC_NULL)
+    *pinaddr = iface.addr ;
+  if (pbcast != OFC_NULL)
+    *pbcast = iface.bcast ;
+  if (pmask != OFC_NULL)
+    *pmask = iface.mask ;
+}
+
+OFC_BOOL ofc_net_win32_interface_info(OFC_INT index,
+                                      OFC_NET_WIN32_INFO *info) {
+  NET_SNAPSHOT *snap ;
+  OFC_BOOL ret ;
+
+  ret = OFC_FALSE ;
+  snap = net_snapshot_acquire () ;
+  if (snap != OFC_NULL && index >= 0 && index < snap->count)
+    {
+      *info = snap->iface[index].info ;
+      ret = OFC_TRUE ;
     }
-#endif
+  net_snapshot_release () ;
+  return (ret) ;
+}
+
+OFC_UINT32 ofc_net_win32_generation(OFC_VOID) {
+  net_snapshot_acquire () ;
+  net_snapshot_release () ;
+  return ((OFC_UINT32) net_generation) ;
 }
 
 OFC_CORE_LIB OFC_VOID
@@ -297,9 +673,11 @@ ofc_net_interface_wins_impl(OFC_INT index, OFC_INT *num_wins,
     *winslist = OFC_NULL ;
 }
 
-OFC_VOID ofc_net_resolve_dns_name_impl(OFC_LPCSTR name,
-                                       OFC_UINT16 *num_addrs,
-                                       OFC_IPADDR *ip) {
+/*
+ * Returns the GetAddrInfoA status, zero when the name resolved
+ */
+static int net_resolve(OFC_LPCSTR name, OFC_UINT16 *num_addrs,
+                       OFC_IPADDR *ip) {
   ADDRINFOA *res ;
   ADDRINFOA *p ;
   ADDRINFOA hints ;
@@ -365,6 +743,45 @@ OFC_VOID ofc_net_resolve_dns_name_impl(OFC_LPCSTR name,
       freeaddrinfo (res) ;
       *num_addrs = i ;
     }
+  return (ret) ;
+}
+
+OFC_VOID ofc_net_resolve_dns_name_impl(OFC_LPCSTR name,
+                                       OFC_UINT16 *num_addrs,
+                                       OFC_IPADDR *ip) {
+  OFC_IPADDR temp ;
+  OFC_IPADDR found[OFC_DNS_CACHE_ADDRS] ;
+  OFC_UINT16 count ;
+  OFC_UINT16 i ;
+  int error ;
+
+  if (ofc_pton (name, &temp) != 0)
+    {
+      /*
+       * Literal addresses never go through the cache
+       */
+      net_resolve (name, num_addrs, ip) ;
+    }
+  else if (!ofc_dnscache_lookup (name, num_addrs, ip))
+    {
+      /*
+       * Resolve into a full sized list so a short caller array does not
+       * truncate what is cached
+       */
+      count = OFC_DNS_CACHE_ADDRS ;
+      error = net_resolve (name, &count, found) ;
+      /*
+       * Only an authoritative answer that the name does not exist is
+       * remembered.  A timeout or a network failure is retried on the
+       * next lookup.
+       */
+      if (error == 0 || error == WSAHOST_NOT_FOUND || error == WSANO_DATA)
+	ofc_dnscache_insert (name, count, found) ;
+
+      for (i = 0 ; i < count && i < *num_addrs ; i++)
+	ip[i] = found[i] ;
+      *num_addrs = i ;
+    }
 }
 
 OFC_CORE_LIB OFC_VOID
@@ -0,0 +1,389 @@
+/* Copyright (c) 2021 Connected Way, LLC. All rights reserved.
+ * Use of this source code is governed by a Creative Commons
+ * Attribution-NoDerivatives 4.0 International license that can be
+ * found in the LICENSE file.
+ */
+#define __OFC_CORE_DLL__
+
+#include <winsock2.h>
+#include <ws2tcpip.h>
+
+#include "ofc/types.h"
+#include "ofc/handle.h"
+#include "ofc/lock.h"
+#include "ofc/event.h"
+#include "ofc/libc.h"
+#include "ofc/heap.h"
+#include "ofc/net.h"
+#include "ofc/net_internal.h"
+
+#include "ofc_windows/config.h"
+#include "ofc_windows/dnscache_windows.h"
+#include "ofc_windows/resolve_windows.h"
+
+/** \{ */
+
+/*
+ * Overlapped GetAddrInfoExW needs Windows 8
+ */
+#if defined(_WIN32_WINNT) && (_WIN32_WINNT >= 0x0602)
+#define RESOLVE_OVERLAPPED
+#endif
+
+/*
+ * A request holds one reference for the caller and one for the lookup
+ * in flight.  The timer holds none since destroy waits for it.
+ */
+struct _OFC_RESOLVE
+{
+  volatile LONG refs ;
+  volatile LONG status ;
+  OFC_HANDLE hEvent ;
+  HANDLE timer ;
+  OFC_LOCK lock ;
+  OFC_BOOL inflight ;
+  WCHAR *name ;
+  OFC_UINT16 count ;
+  OFC_IPADDR addrs[OFC_DNS_CACHE_ADDRS] ;
+#if defined(RESOLVE_OVERLAPPED)
+  OVERLAPPED overlapped ;
+  ADDRINFOEXW *result ;
+  HANDLE cancel ;
+#endif
+  OFC_CHAR cname[1] ;
+} ;
+
+static OFC_RESOLVE_STUB resolve_stub = OFC_NULL ;
+
+static OFC_VOID resolve_put(OFC_RESOLVE *resolve)
+{
+  if (InterlockedDecrement (&resolve->refs) == 0)
+    {
+      ofc_event_destroy (resolve->hEvent) ;
+      ofc_lock_destroy (resolve->lock) ;
+      ofc_free (resolve->name) ;
+      ofc_free (resolve) ;
+    }
+}
+
+/*
+ * Move the request out of pending.  Only the first caller wins.
+ */
+static OFC_BOOL resolve_finish(OFC_RESOLVE *resolve, OFC_RESOLVE_STATUS status)
+{
+  OFC_BOOL ret ;
+
+  ret = OFC_FALSE ;
+  if (InterlockedCompareExchange (&resolve->status, status,
+				  OFC_RESOLVE_PENDING) == OFC_RESOLVE_PENDING)
+    {
+      ofc_event_set (resolve->hEvent) ;
+      ret = OFC_TRUE ;
+    }
+  return (ret) ;
+}
+
+static OFC_VOID resolve_abort(OFC_RESOLVE *resolve, OFC_RESOLVE_STATUS status)
+{
+  if (resolve_finish (resolve, status))
+    {
+#if defined(RESOLVE_OVERLAPPED)
+      ofc_lock (resolve->lock) ;
+      if (resolve->inflight)
+	GetAddrInfoExCancel (&resolve->cancel) ;
+      ofc_unlock (resolve->lock) ;
+#endif
+    }
+}
+
+static VOID CALLBACK resolve_expired(PVOID context, BOOLEAN fired)
+{
+  resolve_abort (context, OFC_RESOLVE_TIMEOUT) ;
+}
+
+static OFC_VOID resolve_add(OFC_RESOLVE *resolve, struct sockaddr *addr)
+{
+  struct sockaddr_in *sa ;
+  struct sockaddr_in6 *sa6 ;
+  OFC_IPADDR *ip ;
+  OFC_INT j ;
+
+  if (resolve->count < OFC_DNS_CACHE_ADDRS)
+    {
+      ip = &resolve->addrs[resolve->count] ;
+      if (addr->sa_family == AF_INET)
+	{
+	  sa = (struct sockaddr_in *) addr ;
+	  ip->ip_version = OFC_FAMILY_IP ;
+	  ip->u.ipv4.addr = OFC_NET_NTOL (&sa->sin_addr.s_addr, 0) ;
+	  resolve->count++ ;
+	}
+      else if (addr->sa_family == AF_INET6)
+	{
+	  sa6 = (struct sockaddr_in6 *) addr ;
+	  ip->ip_version = OFC_FAMILY_IPV6 ;
+	  for (j = 0 ; j < 16 ; j++)
+	    ip->u.ipv6._s6_addr[j] = sa6->sin6_addr.s6_addr[j] ;
+	  ip->u.ipv6.scope = sa6->sin6_scope_id ;
+	  resolve->count++ ;
+	}
+    }
+}
+
+/*
+ * Record the answer once the lookup is over.  A name that does not
+ * exist is cached as a failure.  Other errors are not cached.
+ */
+static OFC_VOID resolve_done(OFC_RESOLVE *resolve, DWORD error)
+{
+  if (error == 0)
+    {
+      ofc_dnscache_insert (resolve->cname, resolve->count, resolve->addrs) ;
+      resolve_finish (resolve, resolve->count > 0 ?
+		      OFC_RESOLVE_DONE : OFC_RESOLVE_FAILED) ;
+    }
+  else
+    {
+      if (error == WSAHOST_NOT_FOUND || error == WSANO_DATA)
+	ofc_dnscache_insert (resolve->cname, 0, OFC_NULL) ;
+      resolve_finish (resolve, OFC_RESOLVE_FAILED) ;
+    }
+  resolve_put (resolve) ;
+}
+
+static OFC_INT resolve_family(OFC_VOID)
+{
+#if defined(OFC_DISCOVER_IPV6)
+#if defined(OFC_DISCOVER_IPV4)
+  return (AF_UNSPEC) ;
+#else
+  return (AF_INET6) ;
+#endif
+#else
+  return (AF_INET) ;
+#endif
+}
+
+#if defined(RESOLVE_OVERLAPPED)
+static OFC_VOID resolve_complete_result(OFC_RESOLVE *resolve, DWORD error)
+{
+  ADDRINFOEXW *p ;
+
+  ofc_lock (resolve->lock) ;
+  resolve->inflight = OFC_FALSE ;
+  ofc_unlock (resolve->lock) ;
+
+  if (error == 0)
+    {
+      for (p = resolve->result ; p != NULL ; p = p->ai_next)
+	resolve_add (resolve, p->ai_addr) ;
+    }
+  if (resolve->result != NULL)
+    FreeAddrInfoExW (resolve->result) ;
+  resolve->result = NULL ;
+
+  if (error == WSA_E_CANCELLED)
+    resolve_put (resolve) ;
+  else
+    resolve_done (resolve, error) ;
+}
+
+static VOID CALLBACK resolve_complete(DWORD error, DWORD bytes,
+				      LPWSAOVERLAPPED overlapped)
+{
+  resolve_complete_result (CONTAINING_RECORD (overlapped, OFC_RESOLVE,
+					      overlapped), error) ;
+}
+
+static OFC_VOID resolve_post_system(OFC_RESOLVE *resolve)
+{
+  ADDRINFOEXW hints ;
+  INT ret ;
+
+  ofc_memset (&hints, 0, sizeof (hints)) ;
+  hints.ai_family = resolve_family () ;
+  hints.ai_flags = AI_ADDRCONFIG ;
+
+  ofc_memset (&resolve->overlapped, 0, sizeof (OVERLAPPED)) ;
+  resolve->result = NULL ;
+  resolve->cancel = NULL ;
+
+  ofc_lock (resolve->lock) ;
+  resolve->inflight = OFC_TRUE ;
+  ret = GetAddrInfoExW (resolve->name, NULL, NS_ALL, NULL, &hints,
+			&resolve->result, NULL, &resolve->overlapped,
+			resolve_complete, &resolve->cancel) ;
+  ofc_unlock (resolve->lock) ;
+
+  /*
+   * Completion routines only run for lookups that went pending
+   */
+  if (ret != WSA_IO_PENDING)
+    resolve_complete_result (resolve, ret) ;
+}
+#else
+static DWORD WINAPI resolve_work(LPVOID context)
+{
+  OFC_RESOLVE *resolve ;
+  ADDRINFOW hints ;
+  ADDRINFOW *res ;
+  ADDRINFOW *p ;
+  INT ret ;
+
+  resolve = context ;
+  ofc_memset (&hints, 0, sizeof (hints)) ;
+  hints.ai_family = resolve_family () ;
+  hints.ai_flags = AI_ADDRCONFIG ;
+
+  res = NULL ;
+  ret = GetAddrInfoW (resolve->name, NULL, &hints, &res) ;
+  if (ret == 0)
+    {
+      for (p = res ; p != NULL ; p = p->ai_next)
+	resolve_add (resolve, p->ai_addr) ;
+      FreeAddrInfoW (res) ;
+    }
+  resolve_done (resolve, ret) ;
+  return (0) ;
+}
+
+static OFC_VOID resolve_post_system(OFC_RESOLVE *resolve)
+{
+  if (!QueueUserWorkItem (resolve_work, resolve, WT_EXECUTELONGFUNCTION))
+    {
+      resolve_finish (resolve, OFC_RESOLVE_FAILED) ;
+      resolve_put (resolve) ;
+    }
+}
+#endif
+
+static DWORD WINAPI resolve_stub_work(LPVOID context)
+{
+  OFC_RESOLVE *resolve ;
+  OFC_UINT16 count ;
+  OFC_INT error ;
+
+  resolve = context ;
+  count = OFC_DNS_CACHE_ADDRS ;
+  error = (*resolve_stub) (resolve->cname, &count, resolve->addrs) ;
+  resolve->count = (error == 0) ? count : 0 ;
+  resolve_done (resolve, (DWORD) error) ;
+  return (0) ;
+}
+
+static OFC_VOID resolve_post(OFC_RESOLVE *resolve)
+{
+  if (resolve_stub == OFC_NULL)
+    resolve_post_system (resolve) ;
+  else if (!QueueUserWorkItem (resolve_stub_work, resolve,
+			       WT_EXECUTELONGFUNCTION))
+    {
+      resolve_finish (resolve, OFC_RESOLVE_FAILED) ;
+      resolve_put (resolve) ;
+    }
+}
+
+OFC_VOID ofc_resolve_set_stub(OFC_RESOLVE_STUB stub)
+{
+  resolve_stub = stub ;
+}
+
+OFC_RESOLVE *ofc_resolve_start(OFC_LPCSTR name, OFC_MSTIME timeout)
+{
+  OFC_RESOLVE *resolve ;
+  OFC_SIZET len ;
+  OFC_INT wlen ;
+
+  len = ofc_strlen (name) ;
+  resolve = ofc_malloc (sizeof (OFC_RESOLVE) + len) ;
+  if (resolve != OFC_NULL)
+    {
+      resolve->refs = 1 ;
+      resolve->status = OFC_RESOLVE_PENDING ;
+      resolve->timer = NULL ;
+      resolve->inflight = OFC_FALSE ;
+      resolve->count = 0 ;
+      ofc_strcpy (resolve->cname, name) ;
+
+      wlen = MultiByteToWideChar (CP_UTF8, 0, name, -1, NULL, 0) ;
+      resolve->name = ofc_malloc (sizeof (WCHAR) * (wlen + 1)) ;
+      resolve->hEvent = ofc_event_create (OFC_EVENT_MANUAL) ;
+      resolve->lock = ofc_lock_init () ;
+
+      if (resolve->name == OFC_NULL || resolve->hEvent == OFC_HANDLE_NULL)
+	{
+	  if (resolve->hEvent != OFC_HANDLE_NULL)
+	    ofc_event_destroy (resolve->hEvent) ;
+	  ofc_lock_destroy (resolve->lock) ;
+	  ofc_free (resolve->name) ;
+	  ofc_free (resolve) ;
+	  resolve = OFC_NULL ;
+	}
+    }
+
+  if (resolve != OFC_NULL)
+    {
+      MultiByteToWideChar (CP_UTF8, 0, name, -1, resolve->name, wlen + 1) ;
+      resolve->count = OFC_DNS_CACHE_ADDRS ;
+
+      if (ofc_pton (name, &resolve->addrs[0]) != 0)
+	{
+	  resolve->count = 1 ;
+	  resolve_finish (resolve, OFC_RESOLVE_DONE) ;
+	}
+      else if (ofc_dnscache_lookup (name, &resolve->count, resolve->addrs))
+	resolve_finish (resolve, resolve->count > 0 ?
+			OFC_RESOLVE_DONE : OFC_RESOLVE_FAILED) ;
+      else
+	{
+	  resolve->count = 0 ;
+	  if (timeout > 0 &&
+	      !CreateTimerQueueTimer (&resolve->timer, NULL, resolve_expired,
+				      resolve, timeout, 0,
+				      WT_EXECUTEONLYONCE))
+	    resolve->timer = NULL ;
+
+	  InterlockedIncrement (&resolve->refs) ;
+	  resolve_post (resolve) ;
+	}
+    }
+  return (resolve) ;
+}
+
+OFC_HANDLE ofc_resolve_event(OFC_RESOLVE *resolve)
+{
+  return (resolve->hEvent) ;
+}
+
+OFC_RESOLVE_STATUS ofc_resolve_result(OFC_RESOLVE *resolve,
+                                      OFC_UINT16 *num_addrs,
+                                      OFC_IPADDR *ip)
+{
+  OFC_RESOLVE_STATUS status ;
+  OFC_UINT16 i ;
+
+  status = (OFC_RESOLVE_STATUS) resolve->status ;
+  i = 0 ;
+  if (status == OFC_RESOLVE_DONE)
+    {
+      for (i = 0 ; i < resolve->count && i < *num_addrs ; i++)
+	ip[i] = resolve->addrs[i] ;
+    }
+  *num_addrs = i ;
+  return (status) ;
+}
+
+OFC_VOID ofc_resolve_cancel(OFC_RESOLVE *resolve)
+{
+  resolve_abort (resolve, OFC_RESOLVE_CANCELLED) ;
+}
+
+OFC_VOID ofc_resolve_destroy(OFC_RESOLVE *resolve)
+{
+  if (resolve->timer != NULL)
+    DeleteTimerQueueTimer (NULL, resolve->timer, INVALID_HANDLE_VALUE) ;
+  resolve_abort (resolve, OFC_RESOLVE_CANCELLED) ;
+  resolve_put (resolve) ;
+}
+
+/** \} */
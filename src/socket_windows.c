@@ -7,14 +7,25 @@
 
 #include <winsock2.h>
 #include <ws2tcpip.h>
+#include <mswsock.h>
+#include <mstcpip.h>
 
+#include "ofc/config.h"
 #include "ofc/types.h"
 #include "ofc/handle.h"
+#include "ofc/lock.h"
 #include "ofc/libc.h"
+#include "ofc/time.h"
+#include "ofc/process.h"
 #include "ofc/socket.h"
 #include "ofc/impl/socketimpl.h"
 #include "ofc/net.h"
 #include "ofc/net_internal.h"
+#include "ofc_windows/config.h"
+#include "ofc_windows/socket_windows.h"
+#include "ofc_windows/bufpool_windows.h"
+#include "ofc_windows/sockmem_windows.h"
+#include "ofc_windows/startup_windows.h"
 
 #include "ofc/heap.h"
 /*
@@ -33,823 +44,4052 @@
  *    Status (STATE_SUCCESS or STATE_FAIL)
  */
 
+#define OFC_SOCKET_DEFAULT_EVENTS \
+  (FD_ACCEPT | FD_READ | FD_WRITE | FD_CONNECT | FD_CLOSE)
+
+#if !defined(TCP_FASTOPEN)
+#define TCP_FASTOPEN 15
+#endif
+
+/*
+ * Receive timestamping, from newer SDKs
+ */
+#if !defined(SIO_TIMESTAMPING)
+#define SIO_TIMESTAMPING _WSAIOW(IOC_VENDOR, 235)
+#endif
+#if !defined(TIMESTAMPING_FLAG_RX)
+#define TIMESTAMPING_FLAG_RX 0x1
+#endif
+#if !defined(SO_TIMESTAMP)
+#define SO_TIMESTAMP 0x300A
+#endif
+
+typedef struct
+{
+  ULONG Flags ;
+  USHORT TxTimestampsBuffered ;
+} SOCKET_TIMESTAMPING ;
+
+/*
+ * Connection statistics, from newer SDKs
+ */
+#if !defined(SIO_IDEAL_SEND_BACKLOG_QUERY)
+#define SIO_IDEAL_SEND_BACKLOG_QUERY _IOR('t', 123, ULONG)
+#endif
+#if !defined(SIO_TCP_INFO)
+#define SIO_TCP_INFO _WSAIORW(IOC_VENDOR, 39)
+
+typedef struct
+{
+  INT State ;
+  ULONG Mss ;
+  ULONG64 ConnectionTimeMs ;
+  BOOLEAN TimestampsEnabled ;
+  ULONG RttUs ;
+  ULONG MinRttUs ;
+  ULONG BytesInFlight ;
+  ULONG Cwnd ;
+  ULONG SndWnd ;
+  ULONG RcvWnd ;
+  ULONG RcvBuf ;
+  ULONG64 BytesOut ;
+  ULONG64 BytesIn ;
+  ULONG BytesReordered ;
+  ULONG BytesRetrans ;
+  ULONG FastRetrans ;
+  ULONG DupAcksIn ;
+  ULONG TimeoutEpisodes ;
+  UCHAR SynRetrans ;
+} TCP_INFO_v0 ;
+#endif
+
+/*
+ * Send buffer autotuning state.  window is how much the upper layer
+ * should keep outstanding on the socket.  sampled, bytes_out and
+ * retrans are the time and counters of the last look at the connection,
+ * for the delivery rate over the interval.  sampled is zero until the
+ * first look.
+ */
+typedef struct
+{
+  OFC_MSTIME next ;
+  OFC_INT sndbuf ;
+  OFC_SIZET window ;
+  OFC_MSTIME sampled ;
+  OFC_UINT64 bytes_out ;
+  OFC_UINT32 retrans ;
+} SOCKET_TUNE ;
+
+/*
+ * A listener shard.  Shards share their primary's listening socket and
+ * each keeps one AcceptEx outstanding on it with an event of its own,
+ * so the kernel hands each connection to exactly one shard.
+ */
+#define SOCKET_SHARD_ADDR_LEN (sizeof (struct sockaddr_in6) + 16)
+
+typedef struct
+{
+  WSAOVERLAPPED overlapped ;
+  SOCKET accept ;
+  /*
+   * The listener the shard was opened on, and when to post AcceptEx
+   * again after it could not be posted
+   */
+  OFC_HANDLE hListen ;
+  OFC_MSTIME retry ;
+  LPFN_ACCEPTEX lpfnAcceptEx ;
+  LPFN_GETACCEPTEXSOCKADDRS lpfnGetAcceptExSockaddrs ;
+  OFC_CHAR addrs[SOCKET_SHARD_ADDR_LEN * 2] ;
+} SOCKET_SHARD ;
+
+/*
+ * State of an outstanding ConnectEx.  The initial payload is copied
+ * here so it outlives the caller's buffer.  While the connect is
+ * pending, the socket is waited on through the overlapped event.
+ */
+typedef struct
+{
+  WSAOVERLAPPED overlapped ;
+  OFC_CHAR *data ;
+  OFC_BOOL fast_open ;
+} SOCKET_CONNECT_EX ;
+
+/*
+ * Write coalescing state of a corked socket.  buf grows with the data
+ * held, up to OFC_SOCKET_CORK_SIZE, and is freed whenever it empties,
+ * so the memory charged for it follows its fill.
+ */
 typedef struct
+{
+  OFC_BOOL corked ;
+  OFC_SIZET len ;
+  OFC_SIZET size ;
+  OFC_MSTIME deadline ;
+  OFC_CHAR *buf ;
+} SOCKET_CORK ;
+
+#define SOCKET_CORK_MIN 512
+
+/*
+ * Receive buffer of a socket read with ofc_socket_win32_recv_frame.
+ * Data between head and tail has been read from the kernel but not yet
+ * handed out.  The message handed out by the last call occupies the
+ * first consumed bytes after head and is released on the next call.
+ */
+typedef struct
+{
+  OFC_CHAR *buf ;
+  OFC_SIZET size ;
+  OFC_SIZET head ;
+  OFC_SIZET tail ;
+  OFC_SIZET consumed ;
+  /*
+   * Receive timestamp of the oldest data in the buffer
+   */
+  OFC_UINT64 stamp ;
+} SOCKET_FRAME ;
+
+#define SOCKET_FRAME_HEADER 4
+
+typedef struct _OFC_SOCKET_IMPL
 {
   SOCKET socket ;
   OFC_FAMILY_TYPE family ;
   HANDLE hEvent ;
   OFC_IPADDR ip ;
+  long mask ;
+  /*
+   * Group membership.  group_index is protected by the group lock and
+   * pending is updated by group sweeps with interlocked operations.
+   */
+  OFC_SOCKET_GROUP *group ;
+  OFC_INT group_index ;
+  volatile LONG pending ;
+  /*
+   * Readiness state used by the WSAPoll backend.  A stream socket is
+   * armed once it is connecting, listening or accepted.  Writability is
+   * only polled for after a write would have blocked, which gives the
+   * same edge behavior as FD_WRITE.  POLLRDNORM is level triggered, so
+   * once readability has been reported it is not polled for again until
+   * the socket has been read or accepted from, or found empty.
+   */
+  OFC_BOOL armed ;
+  OFC_BOOL listening ;
+  volatile LONG write_blocked ;
+  volatile LONG read_reported ;
+  SOCKET_CONNECT_EX *connect_ex ;
+  OFC_BOOL fast_open ;
+  SOCKET_CORK *cork ;
+  SOCKET_FRAME *frame ;
+  OFC_BOOL graceful ;
+  /*
+   * Idle mode.  idle_bytes, idle_handles and idle_kernel are the
+   * footprint counted when the socket went idle.
+   */
+  OFC_BOOL idle ;
+  OFC_SIZET idle_bytes ;
+  OFC_INT idle_handles ;
+  OFC_SIZET idle_kernel ;
+  /*
+   * Receive timestamps in performance counter ticks.  recvmsg is set
+   * when the kernel stamps datagrams.  Otherwise rx_seen is taken when
+   * unread data is first noticed, by a test, a group sweep or FIONREAD,
+   * and is kept until a receive leaves the socket empty.
+   */
+  OFC_BOOL timestamps ;
+  LPFN_WSARECVMSG recvmsg ;
+  OFC_UINT64 rx_stamp ;
+  OFC_BOOL rx_kernel ;
+  volatile LONGLONG rx_seen ;
+  SOCKET_TUNE *tune ;
+  SOCKET_SHARD *shard ;
+  /*
+   * Open shards of a listener.  While it has any, the listener leaves
+   * accepts to them and does not select FD_ACCEPT itself.
+   */
+  OFC_INT shards ;
+  /*
+   * Readiness cache.  ready accumulates the events enumerated on the
+   * socket until a receive, send or accept that would block consumes
+   * them.  rx_bytes is the kernel's count of unread bytes when
+   * rx_known is set.  Only a positive count is ever trusted, data can
+   * arrive on an empty socket before any event is enumerated.  Borrowed
+   * receives run without the handle lock and only set rx_stale, which
+   * the locked path checks before trusting the count.
+   */
+  volatile LONG ready ;
+  OFC_SIZET rx_bytes ;
+  OFC_BOOL rx_known ;
+  volatile LONG rx_stale ;
+  /*
+   * One reference for the handle and one for each borrow, which is
+   * also counted in borrows.  A close while borrowed parks the socket
+   * in close_socket and the last borrower to return closes it.
+   */
+  volatile LONG refs ;
+  volatile LONG borrows ;
+  volatile LONG close_todo ;
+  SOCKET close_socket ;
+  /*
+   * Memory accounting.  The kernel buffer sizes set on the socket are
+   * charged along with its cork and frame buffers.  A low priority
+   * socket is throttled while the budget is used up.  Without a send
+   * buffer size to charge, the bytes in flight are charged instead,
+   * sampled every OFC_SOCKET_AUTOTUNE_INTERVAL while anything is sent.
+   */
+  OFC_SOCKMEM_PRIORITY priority ;
+  volatile LONG throttled ;
+  OFC_SIZET mem_sndbuf ;
+  OFC_SIZET mem_rcvbuf ;
+  OFC_SIZET mem_inflight ;
+  OFC_MSTIME inflight_next ;
+  volatile LONG tx_dirty ;
 } OFC_SOCKET_IMPL ;
 
-OFC_HANDLE ofc_socket_impl_create(OFC_FAMILY_TYPE family,
-                                  OFC_SOCKET_TYPE socktype)
+/*
+ * Calls to ofc_socket_impl_send and the send system calls they made
+ */
+static volatile LONG socket_send_calls = 0 ;
+static volatile LONG socket_send_syscalls = 0 ;
+/*
+ * Kernel reads made for framed receives and the messages they produced
+ */
+static volatile LONG socket_frame_syscalls = 0 ;
+static volatile LONG socket_frame_messages = 0 ;
+/*
+ * Sockets in idle mode and the bytes they hold.  Idle sockets share the
+ * idle group's event rather than owning one.
+ */
+static OFC_SOCKET_GROUP *socket_idle_group = OFC_NULL ;
+static volatile LONG socket_idle_count = 0 ;
+static volatile LONG socket_idle_handles = 0 ;
+/*
+ * Byte totals run past 2GB at the socket counts idle mode is for
+ */
+static volatile LONG64 socket_idle_bytes = 0 ;
+static volatile LONG64 socket_idle_kernel = 0 ;
+
+static OFC_BOOL socket_reap(SOCKET s, const OFC_CHAR *tail, OFC_SIZET len) ;
+static OFC_INT socket_cork_flush(OFC_SOCKET_IMPL *sock) ;
+
+/*
+ * A group of sockets sharing one notification event.  When the event
+ * fires, the members are swept with WSAEnumNetworkEvents and the events
+ * found are left pending on each member until ofc_socket_impl_test
+ * consumes them.
+ *
+ * Lock order is socket handle, then group.  The sweep only holds the
+ * group lock.
+ */
+struct _OFC_SOCKET_GROUP
 {
-  OFC_HANDLE hSocket ;
-  OFC_SOCKET_IMPL *sock ;
+  HANDLE hEvent ;
+  OFC_BOOL manual ;
+  OFC_LOCK lock ;
+  OFC_INT count ;
+  OFC_INT size ;
+  OFC_SOCKET_IMPL **members ;
+#if defined(OFC_SOCKET_WSAPOLL)
+  /*
+   * Persistent poll array, parallel to members
+   */
+  WSAPOLLFD *fds ;
+#endif
+} ;
 
-  int stype ;
-  int fam ;
-  int proto ;
-  BOOL on ;
-  
-  hSocket = OFC_HANDLE_NULL ;
-  sock = ofc_malloc (sizeof (OFC_SOCKET_IMPL)) ;
+static OFC_SOCKET_EVENT_TYPE socket_events(long lNetworkEvents)
+{
+  OFC_SOCKET_EVENT_TYPE TestEvents ;
 
-  if (sock != OFC_NULL)
+  TestEvents = 0 ;
+  if (lNetworkEvents & FD_CLOSE)
+    TestEvents |= OFC_SOCKET_EVENT_CLOSE ;
+  if (lNetworkEvents & FD_ACCEPT)
+    TestEvents |= OFC_SOCKET_EVENT_ACCEPT ;
+  if (lNetworkEvents & FD_ADDRESS_LIST_CHANGE)
+    TestEvents |= OFC_SOCKET_EVENT_ADDRESSCHANGE ;
+  if (lNetworkEvents & FD_QOS)
+    TestEvents |= OFC_SOCKET_EVENT_QOS ;
+  if (lNetworkEvents & FD_OOB)
+    TestEvents |= OFC_SOCKET_EVENT_QOB ;
+  if (lNetworkEvents & FD_READ)
+    TestEvents |= OFC_SOCKET_EVENT_READ ;
+  if (lNetworkEvents & FD_WRITE)
+    TestEvents |= OFC_SOCKET_EVENT_WRITE ;
+
+  return (TestEvents) ;
+}
+
+/*
+ * Take a socket out of its group.  Called with the socket handle locked.
+ */
+static OFC_VOID socket_group_remove(OFC_SOCKET_IMPL *sock)
+{
+  OFC_SOCKET_GROUP *group ;
+  OFC_SOCKET_IMPL *last ;
+
+  group = sock->group ;
+  if (group != OFC_NULL)
     {
-      sock->family = family ;
-      if (sock->family == OFC_FAMILY_IP)
-	{
-	  sock->ip.ip_version = OFC_FAMILY_IP ;
-	  sock->ip.u.ipv4.addr = OFC_INADDR_ANY ;
-	  fam = AF_INET;
-	}
-      else
-	{
-	  sock->ip.ip_version = OFC_FAMILY_IPV6 ;
-	  sock->ip.u.ipv6 = ofc_in6addr_any ;
-	  fam = AF_INET6 ;
-	}
-      
-      if (socktype == SOCKET_TYPE_STREAM)
-	{
-	  stype = SOCK_STREAM;
-	  proto = IPPROTO_TCP;
-	}
-      else if (socktype == SOCKET_TYPE_ICMP)
-	{
-	  stype = SOCK_RAW ;
-	  if (sock->ip.ip_version == OFC_FAMILY_IP)
-	    proto = IPPROTO_ICMP ;
-	  else
-	    proto = IPPROTO_ICMPV6 ;
-	}
-      else
-	{
-	  stype = SOCK_DGRAM;
-	  proto = IPPROTO_UDP;
-	}
+      ofc_lock (group->lock) ;
+      group->count-- ;
+      last = group->members[group->count] ;
+      group->members[sock->group_index] = last ;
+#if defined(OFC_SOCKET_WSAPOLL)
+      group->fds[sock->group_index] = group->fds[group->count] ;
+#endif
+      last->group_index = sock->group_index ;
+      ofc_unlock (group->lock) ;
 
-      sock->socket = socket (fam, stype, proto) ;
+      sock->group = OFC_NULL ;
+      sock->group_index = -1 ;
+    }
+}
 
-      if (sock->socket == INVALID_SOCKET)
+/*
+ * Allocate a group.  A group shared by several wait sets needs a
+ * manual reset event so every waiter sees it.  Sweeps reset it once
+ * no member is left pending.
+ */
+static OFC_SOCKET_GROUP *socket_group_alloc(OFC_BOOL manual)
+{
+  OFC_SOCKET_GROUP *group ;
+
+  group = ofc_malloc (sizeof (OFC_SOCKET_GROUP)) ;
+  if (group != OFC_NULL)
+    {
+      group->hEvent = CreateEvent (NULL, manual, FALSE, NULL) ;
+      group->manual = manual ;
+      if (group->hEvent == NULL)
 	{
-	  ofc_free (sock) ;
+	  ofc_free (group) ;
+	  group = OFC_NULL ;
 	}
       else
 	{
-	  if (socktype == SOCKET_TYPE_DGRAM)
-	    {
-	      on = TRUE ;
-	      setsockopt (sock->socket, SOL_SOCKET, SO_BROADCAST, 
-			  (char *) &on, sizeof(on)) ;
-	    }
-	  sock->hEvent = CreateEvent (NULL, FALSE, FALSE, NULL) ;
-	  WSAEventSelect (sock->socket, sock->hEvent,
-			  FD_ACCEPT | FD_READ | FD_WRITE | 
-			  FD_CONNECT | FD_CLOSE) ;
-	  hSocket = ofc_handle_create (OFC_HANDLE_SOCKET_IMPL, sock) ;
+	  group->lock = ofc_lock_init () ;
+	  group->count = 0 ;
+	  group->size = 0 ;
+	  group->members = OFC_NULL ;
+#if defined(OFC_SOCKET_WSAPOLL)
+	  group->fds = OFC_NULL ;
+#endif
 	}
     }
-  return (hSocket) ;
+  return (group) ;
 }
 
-OFC_VOID ofc_socket_impl_destroy(OFC_HANDLE hSocket)
+/*
+ * Add a socket that is in no group to a group.  Called with the socket
+ * handle locked.
+ */
+static OFC_BOOL socket_group_attach(OFC_SOCKET_GROUP *group,
+                                    OFC_SOCKET_IMPL *sock)
 {
-  OFC_SOCKET_IMPL *sock ;
+  OFC_SOCKET_IMPL **members ;
+#if defined(OFC_SOCKET_WSAPOLL)
+  WSAPOLLFD *fds ;
+#endif
+  OFC_BOOL ret ;
 
-  sock = ofc_handle_lock (hSocket) ;
-  if (sock != OFC_NULL)
+  ret = OFC_FALSE ;
+  ofc_lock (group->lock) ;
+  members = group->members ;
+  if (group->count == group->size)
+    {
+      members = ofc_realloc (group->members,
+			     sizeof (OFC_SOCKET_IMPL *) *
+			     (group->size + 64)) ;
+      if (members != OFC_NULL)
+	group->members = members ;
+#if defined(OFC_SOCKET_WSAPOLL)
+      if (members != OFC_NULL)
+	{
+	  fds = ofc_realloc (group->fds,
+			     sizeof (WSAPOLLFD) * (group->size + 64)) ;
+	  if (fds != OFC_NULL)
+	    group->fds = fds ;
+	  else
+	    members = OFC_NULL ;
+	}
+#endif
+      if (members != OFC_NULL)
+	group->size += 64 ;
+    }
+  if (members != OFC_NULL)
+    {
+      sock->group = group ;
+      sock->group_index = group->count ;
+#if defined(OFC_SOCKET_WSAPOLL)
+      group->fds[group->count].fd = sock->socket ;
+      group->fds[group->count].events = 0 ;
+      group->fds[group->count].revents = 0 ;
+#endif
+      group->members[group->count++] = sock ;
+      ret = OFC_TRUE ;
+    }
+  ofc_unlock (group->lock) ;
+
+  if (ret == OFC_TRUE)
     {
+      /*
+       * Rebinding the socket moves its notifications to the shared
+       * event.  The private event is no longer needed.
+       */
+      WSAEventSelect (sock->socket, group->hEvent, sock->mask) ;
       CloseHandle (sock->hEvent) ;
-      ofc_free(sock) ;
-      ofc_handle_destroy (hSocket) ;
-      ofc_handle_unlock (hSocket) ;
+      sock->hEvent = NULL ;
+      /*
+       * Let the next sweep find anything already outstanding
+       */
+      SetEvent (group->hEvent) ;
     }
+  return (ret) ;
 }
 
 /*
- * PSP_Bind - Bind an IP Address and port to a socket
- *
- * Accepts:
- *    hSock - Handle of socket
- *    ip - 32 bit representation of ip address in host order
- *    port - 16 bit representation of the port in host order
- *
- * Returns:
- *    status (STATE_SUCCESS or STATE_FAIL)
+ * Take a socket out of its group and give it back an event of its own.
+ * Called with the socket handle locked.
  */
-static OFC_VOID make_sockaddr(struct sockaddr **mysockaddr,
-                              socklen_t *mysocklen,
-                              const OFC_IPADDR *ip,
-                              OFC_UINT16 port)
+static OFC_VOID socket_group_detach(OFC_SOCKET_IMPL *sock)
 {
-  struct sockaddr_in *mysockaddr_in ;
-  struct sockaddr_in6 *mysockaddr_in6 ;
-  OFC_INT i ;
-  
-  if (ip->ip_version == OFC_FAMILY_IP)
-    {
-      mysockaddr_in = ofc_malloc (sizeof (struct sockaddr_in)) ;
-      ofc_memset (mysockaddr_in, '\0', sizeof (struct sockaddr_in)) ;
-
-      mysockaddr_in->sin_family = AF_INET ;
-      OFC_NET_STON (&mysockaddr_in->sin_port, 0, port) ;
-      OFC_NET_LTON (&mysockaddr_in->sin_addr.s_addr, 0,
-		     ip->u.ipv4.addr) ;
-      *mysockaddr = (struct sockaddr *) mysockaddr_in ;
-      *mysocklen = sizeof (struct sockaddr_in) ;
-    }
-  else
+  if (sock->group != OFC_NULL)
     {
-      mysockaddr_in6 = ofc_malloc (sizeof (struct sockaddr_in6)) ;
-      ofc_memset (mysockaddr_in6, '\0', sizeof (struct sockaddr_in6)) ;
-
-      mysockaddr_in6->sin6_family = AF_INET6 ;
-      mysockaddr_in6->sin6_scope_id = ip->u.ipv6.scope ;
-
-      OFC_NET_STON (&mysockaddr_in6->sin6_port, 0, port) ;
-      for (i = 0 ; i < 16 ; i++)
-	mysockaddr_in6->sin6_addr.s6_addr[i] = 
-	  ip->u.ipv6._s6_addr[i] ;
-      *mysockaddr = (struct sockaddr *) mysockaddr_in6 ;
-      *mysocklen = sizeof (struct sockaddr_in6) ;
+      socket_group_remove (sock) ;
+      sock->hEvent = CreateEvent (NULL, FALSE, FALSE, NULL) ;
+      WSAEventSelect (sock->socket, sock->hEvent, sock->mask) ;
+      if (sock->pending != 0)
+	SetEvent (sock->hEvent) ;
     }
 }
 
-OFC_VOID unmake_sockaddr(struct sockaddr *mysockaddr,
-                         OFC_IPADDR *ip,
-                         OFC_UINT16 *port)
+/*
+ * Leave idle mode without touching the socket's event binding
+ */
+static OFC_VOID socket_idle_release(OFC_SOCKET_IMPL *sock)
 {
-  struct sockaddr_in *mysockaddr_in ;
-  struct sockaddr_in6 *mysockaddr_in6 ;
-  OFC_INT i ;
-
-  if (mysockaddr->sa_family == AF_INET)
-    {
-      mysockaddr_in = (struct sockaddr_in *) mysockaddr ;
-      ip->ip_version = OFC_FAMILY_IP ;
-      *port = OFC_NET_NTOS (&mysockaddr_in->sin_port, 0) ;
-      ip->u.ipv4.addr = OFC_NET_NTOL (&mysockaddr_in->sin_addr.s_addr, 0) ;
-    }
-  else
+  if (sock->idle)
     {
-      mysockaddr_in6 = (struct sockaddr_in6 *) mysockaddr ;
-      if (ip != OFC_NULL)
-	{
-	  ip->ip_version = OFC_FAMILY_IPV6 ;
-	  for (i = 0 ; i < 16 ; i++)
-	    ip->u.ipv6._s6_addr[i] = 
-	      mysockaddr_in6->sin6_addr.s6_addr[i] ; 
-	}
-      if (port != OFC_NULL)
-	*port = OFC_NET_NTOS (&mysockaddr_in6->sin6_port, 0) ;
+      sock->idle = OFC_FALSE ;
+      InterlockedDecrement (&socket_idle_count) ;
+      InterlockedExchangeAdd64 (&socket_idle_bytes,
+				-(LONG64) sock->idle_bytes) ;
+      InterlockedExchangeAdd (&socket_idle_handles,
+			      -(LONG) sock->idle_handles) ;
+      InterlockedExchangeAdd64 (&socket_idle_kernel,
+				-(LONG64) sock->idle_kernel) ;
     }
 }
 
-OFC_BOOL ofc_socket_impl_bind(OFC_HANDLE hSocket, const OFC_IPADDR *ip,
-                              OFC_UINT16 port)
+/*
+ * Leave idle mode.  A socket parked on the idle group gets its own
+ * event back.  Buffers are allocated again as they are next used.
+ */
+static OFC_VOID socket_idle_exit(OFC_SOCKET_IMPL *sock)
 {
-  OFC_SOCKET_IMPL *sock ;
-  OFC_BOOL ret ;
-
-  int status ;
-  struct sockaddr *mysockaddr;
-  socklen_t mysocklen ;
-
-  ret = OFC_FALSE ;
-
-  sock = ofc_handle_lock (hSocket) ;
-  if (sock != OFC_NULL)
+  if (sock->idle)
     {
-      make_sockaddr (&mysockaddr, &mysocklen, ip, port) ;
-
-      status = bind(sock->socket, mysockaddr, mysocklen) ;
-
-      if (status != SOCKET_ERROR)
-	ret = OFC_TRUE ;
-
-      ofc_free (mysockaddr) ;
-
-      ofc_handle_unlock(hSocket) ;
+      socket_idle_release (sock) ;
+      if (sock->group != OFC_NULL && sock->group == socket_idle_group)
+	socket_group_detach (sock) ;
     }
-  return (ret) ;
+}
+
+static OFC_VOID socket_init_impl(OFC_SOCKET_IMPL *sock, OFC_BOOL armed)
+{
+  sock->mask = OFC_SOCKET_DEFAULT_EVENTS ;
+  sock->group = OFC_NULL ;
+  sock->group_index = -1 ;
+  sock->pending = 0 ;
+  sock->armed = armed ;
+  sock->listening = OFC_FALSE ;
+  sock->write_blocked = 1 ;
+  sock->read_reported = 0 ;
+  sock->connect_ex = OFC_NULL ;
+  sock->fast_open = OFC_FALSE ;
+  sock->cork = OFC_NULL ;
+  sock->frame = OFC_NULL ;
+#if defined(OFC_SOCKET_GRACEFUL_CLOSE)
+  sock->graceful = OFC_TRUE ;
+#else
+  sock->graceful = OFC_FALSE ;
+#endif
+  sock->idle = OFC_FALSE ;
+  sock->idle_bytes = 0 ;
+  sock->idle_handles = 0 ;
+  sock->idle_kernel = 0 ;
+  sock->timestamps = OFC_FALSE ;
+  sock->recvmsg = NULL ;
+  sock->rx_stamp = 0 ;
+  sock->rx_kernel = OFC_FALSE ;
+  sock->rx_seen = 0 ;
+  sock->tune = OFC_NULL ;
+  sock->shard = OFC_NULL ;
+  sock->shards = 0 ;
+  sock->ready = 0 ;
+  sock->rx_bytes = 0 ;
+  sock->rx_known = OFC_FALSE ;
+  sock->rx_stale = 0 ;
+  sock->refs = 1 ;
+  sock->borrows = 0 ;
+  sock->close_todo = 0 ;
+  sock->close_socket = INVALID_SOCKET ;
+  sock->priority = OFC_SOCKMEM_NORMAL ;
+  sock->throttled = 0 ;
+  sock->mem_sndbuf = 0 ;
+  sock->mem_rcvbuf = 0 ;
+  sock->mem_inflight = 0 ;
+  sock->inflight_next = 0 ;
+  sock->tx_dirty = 0 ;
 }
 
 /*
- * PSP_close - Close a socket
- *
- * Accepts:
- *    hSock - Socket handle to close
+ * Charge a new kernel buffer size.  Growth of a low priority socket's
+ * send buffer is refused while the budget is used up.  Receive buffers
+ * are always charged, since refusing them would stall the peer rather
+ * than the sender we want to slow down.
  *
  * Returns:
- *    status (STATE_SUCCESS or STATE_FAIL)
+ *    OFC_FALSE if the size should not be set
  */
-OFC_BOOL ofc_socket_impl_close(OFC_HANDLE hSocket)
+static OFC_BOOL socket_mem_resize(OFC_SOCKET_IMPL *sock, OFC_SIZET *charged,
+                                  OFC_INT size, OFC_SOCKMEM_PRIORITY priority)
 {
-  OFC_SOCKET_IMPL *sock ;
   OFC_BOOL ret ;
 
-  int status;
-
-  ret = OFC_FALSE ;
+  ret = OFC_TRUE ;
+  if (size < 0)
+    size = 0 ;
+  if ((OFC_SIZET) size > *charged)
+    ret = ofc_sockmem_charge ((OFC_SIZET) size - *charged, priority) ;
+  else
+    ofc_sockmem_release (*charged - (OFC_SIZET) size) ;
+  if (ret == OFC_TRUE)
+    *charged = (OFC_SIZET) size ;
+  return (ret) ;
+}
+
+/*
+ * Make room for len more bytes in the cork buffer
+ *
+ * Returns:
+ *    OFC_FALSE if the memory could not be had
+ */
+static OFC_BOOL socket_cork_reserve(OFC_SOCKET_IMPL *sock, OFC_SIZET len)
+{
+  SOCKET_CORK *cork ;
+  OFC_CHAR *buf ;
+  OFC_SIZET size ;
+  OFC_BOOL ret ;
+
+  ret = OFC_TRUE ;
+  cork = sock->cork ;
+  if (cork->len + len > cork->size)
+    {
+      size = OFC_MAX (cork->size * 2, SOCKET_CORK_MIN) ;
+      size = OFC_MAX (size, cork->len + len) ;
+      size = OFC_MIN (size, OFC_SOCKET_CORK_SIZE) ;
+      ret = OFC_FALSE ;
+      if (ofc_sockmem_charge (size - cork->size, sock->priority))
+	{
+	  buf = ofc_realloc (cork->buf, size) ;
+	  if (buf != OFC_NULL)
+	    {
+	      cork->buf = buf ;
+	      cork->size = size ;
+	      ret = OFC_TRUE ;
+	    }
+	  else
+	    ofc_sockmem_release (size - cork->size) ;
+	}
+    }
+  return (ret) ;
+}
+
+/*
+ * Free the cork buffer once it is empty
+ */
+static OFC_VOID socket_cork_trim(SOCKET_CORK *cork)
+{
+  if (cork->len == 0 && cork->buf != OFC_NULL)
+    {
+      ofc_free (cork->buf) ;
+      ofc_sockmem_release (cork->size) ;
+      cork->buf = OFC_NULL ;
+      cork->size = 0 ;
+    }
+}
+
+static OFC_VOID socket_cork_release(OFC_SOCKET_IMPL *sock)
+{
+  if (sock->cork != OFC_NULL)
+    {
+      sock->cork->len = 0 ;
+      socket_cork_trim (sock->cork) ;
+      ofc_free (sock->cork) ;
+      sock->cork = OFC_NULL ;
+      ofc_sockmem_release (sizeof (SOCKET_CORK)) ;
+    }
+}
+
+/*
+ * Note the first sighting of unread data for a software timestamp.
+ * Group sweeps call this holding only the group lock.
+ */
+static OFC_VOID socket_stamp_seen(OFC_SOCKET_IMPL *sock)
+{
+  LARGE_INTEGER now ;
+
+  if (sock->timestamps && sock->rx_seen == 0)
+    {
+      QueryPerformanceCounter (&now) ;
+      InterlockedCompareExchange64 (&sock->rx_seen, now.QuadPart, 0) ;
+    }
+}
+
+/*
+ * Software timestamp of a receive of up to len bytes that returned
+ * status.  A short receive, or one that would block, leaves the socket
+ * empty, so the next data is stamped when it is noticed.
+ */
+static OFC_VOID socket_stamp_take(OFC_SOCKET_IMPL *sock, int status,
+                                  OFC_SIZET len)
+{
+  LARGE_INTEGER now ;
+
+  if (status > 0)
+    {
+      if (sock->rx_seen != 0)
+	sock->rx_stamp = sock->rx_seen ;
+      else
+	{
+	  QueryPerformanceCounter (&now) ;
+	  sock->rx_stamp = now.QuadPart ;
+	}
+      sock->rx_kernel = OFC_FALSE ;
+    }
+  if (status == SOCKET_ERROR || (OFC_SIZET) status < len)
+    InterlockedExchange64 (&sock->rx_seen, 0) ;
+}
+
+/*
+ * Record events enumerated on a socket.  Called with the socket handle
+ * locked.
+ */
+static OFC_VOID socket_ready_note(OFC_SOCKET_IMPL *sock,
+                                  OFC_SOCKET_EVENT_TYPE events)
+{
+  InterlockedOr (&sock->ready, (LONG) events) ;
+  if (events & OFC_SOCKET_EVENT_READ)
+    {
+      sock->rx_known = OFC_FALSE ;
+      socket_stamp_seen (sock) ;
+    }
+}
+
+/*
+ * Update the cache after a kernel receive returned status.  Must be
+ * called before anything else can change the last socket error.
+ */
+static OFC_VOID socket_ready_recv(OFC_SOCKET_IMPL *sock, int status)
+{
+  InterlockedExchange (&sock->read_reported, 0) ;
+  if (status > 0)
+    {
+      if (sock->rx_known && sock->rx_bytes > (OFC_SIZET) status)
+	sock->rx_bytes -= status ;
+      else
+	sock->rx_known = OFC_FALSE ;
+    }
+  else if (status == 0 || WSAGetLastError () == WSAEWOULDBLOCK)
+    {
+      InterlockedAnd (&sock->ready, ~(LONG) OFC_SOCKET_EVENT_READ) ;
+      sock->rx_bytes = 0 ;
+      sock->rx_known = OFC_FALSE ;
+    }
+}
+
+/*
+ * Kernel's count of unread bytes, from the cache when it is current
+ * and non zero
+ */
+static OFC_SIZET socket_ready_bytes(OFC_SOCKET_IMPL *sock)
+{
+  u_long count ;
+
+  if (InterlockedExchange (&sock->rx_stale, 0) != 0)
+    sock->rx_known = OFC_FALSE ;
+  if (!sock->rx_known || sock->rx_bytes == 0)
+    {
+      if (ioctlsocket (sock->socket, FIONREAD, &count) == 0)
+	{
+	  sock->rx_bytes = count ;
+	  sock->rx_known = OFC_TRUE ;
+	  if (count > 0)
+	    {
+	      InterlockedOr (&sock->ready, (LONG) OFC_SOCKET_EVENT_READ) ;
+	      socket_stamp_seen (sock) ;
+	    }
+	  else
+	    InterlockedExchange (&sock->read_reported, 0) ;
+	}
+      else
+	sock->rx_bytes = 0 ;
+    }
+  return (sock->rx_bytes) ;
+}
+
+/*
+ * Length of the complete message at the head of the frame buffer, not
+ * counting one already handed out, or zero if it is not all here yet
+ */
+static OFC_SIZET socket_frame_complete(SOCKET_FRAME *frame)
+{
+  OFC_SIZET ret ;
+  OFC_SIZET head ;
+  OFC_UCHAR *p ;
+
+  ret = 0 ;
+  head = frame->head + frame->consumed ;
+  if (frame->tail - head >= SOCKET_FRAME_HEADER)
+    {
+      p = (OFC_UCHAR *) frame->buf + head ;
+      ret = SOCKET_FRAME_HEADER +
+	(((OFC_SIZET) p[1] << 16) | ((OFC_SIZET) p[2] << 8) | p[3]) ;
+      if (frame->tail - head < ret)
+	ret = 0 ;
+    }
+  return (ret) ;
+}
+
+static OFC_VOID socket_frame_release(OFC_SOCKET_IMPL *sock)
+{
+  if (sock->frame != OFC_NULL)
+    {
+      ofc_sockmem_release (sizeof (SOCKET_FRAME) + sock->frame->size) ;
+      ofc_free (sock->frame->buf) ;
+      ofc_free (sock->frame) ;
+      sock->frame = OFC_NULL ;
+    }
+}
+
+/*
+ * Release the state of a ConnectEx.  If it is still outstanding it is
+ * cancelled and we wait for the cancellation so the kernel is done with
+ * the overlapped structure.
+ */
+static OFC_VOID socket_connect_ex_release(OFC_SOCKET_IMPL *sock)
+{
+  SOCKET_CONNECT_EX *connect_ex ;
+  DWORD bytes ;
+  DWORD flags ;
+
+  connect_ex = sock->connect_ex ;
+  if (connect_ex != OFC_NULL)
+    {
+      if (!WSAGetOverlappedResult (sock->socket, &connect_ex->overlapped,
+				   &bytes, FALSE, &flags) &&
+	  WSAGetLastError () == WSA_IO_INCOMPLETE)
+	{
+	  CancelIoEx ((HANDLE) sock->socket, &connect_ex->overlapped) ;
+	  WSAGetOverlappedResult (sock->socket, &connect_ex->overlapped,
+				  &bytes, TRUE, &flags) ;
+	}
+      CloseHandle (connect_ex->overlapped.hEvent) ;
+      ofc_free (connect_ex->data) ;
+      ofc_free (connect_ex) ;
+      sock->connect_ex = OFC_NULL ;
+    }
+}
+
+/*
+ * Check an outstanding ConnectEx.  Completion is reported the way
+ * FD_CONNECT followed by FD_WRITE would be.
+ */
+static OFC_SOCKET_EVENT_TYPE socket_connect_ex_test(OFC_SOCKET_IMPL *sock)
+{
+  SOCKET_CONNECT_EX *connect_ex ;
+  OFC_SOCKET_EVENT_TYPE TestEvents ;
+  DWORD bytes ;
+  DWORD flags ;
+
+  TestEvents = 0 ;
+  connect_ex = sock->connect_ex ;
+  if (connect_ex != OFC_NULL)
+    {
+      if (WSAGetOverlappedResult (sock->socket, &connect_ex->overlapped,
+				  &bytes, FALSE, &flags))
+	{
+	  /*
+	   * Make getpeername and friends work on the connected socket
+	   */
+	  setsockopt (sock->socket, SOL_SOCKET, SO_UPDATE_CONNECT_CONTEXT,
+		      NULL, 0) ;
+	  InterlockedExchange (&sock->write_blocked, 0) ;
+	  TestEvents |= OFC_SOCKET_EVENT_WRITE ;
+	  socket_connect_ex_release (sock) ;
+	}
+      else if (WSAGetLastError () != WSA_IO_INCOMPLETE)
+	{
+	  TestEvents |= OFC_SOCKET_EVENT_CLOSE ;
+	  socket_connect_ex_release (sock) ;
+	}
+    }
+  return (TestEvents) ;
+}
+
+/*
+ * Events a socket selects.  A listener with shards leaves FD_ACCEPT to
+ * them so it does not compete for connections.
+ */
+static long socket_mask(OFC_SOCKET_IMPL *sock)
+{
+  long mask ;
+
+  mask = sock->mask ;
+  if (sock->shards > 0)
+    mask &= ~FD_ACCEPT ;
+  return (mask) ;
+}
+
+/*
+ * Select a socket's events on its own event or its group's.  Called
+ * with the socket handle locked.
+ */
+static OFC_VOID socket_select(OFC_SOCKET_IMPL *sock)
+{
+  WSAEventSelect (sock->socket,
+		  sock->group == OFC_NULL ? sock->hEvent : sock->group->hEvent,
+		  socket_mask (sock)) ;
+}
+
+/*
+ * Count a shard opened or closed on a listener and select the
+ * listener's events to match
+ */
+static OFC_VOID socket_shard_count(OFC_HANDLE hListen, OFC_INT delta)
+{
+  OFC_SOCKET_IMPL *listener ;
+
+  listener = ofc_handle_lock (hListen) ;
+  if (listener != OFC_NULL)
+    {
+      listener->shards += delta ;
+      if (listener->socket != INVALID_SOCKET)
+	socket_select (listener) ;
+      ofc_handle_unlock (hListen) ;
+    }
+}
+
+/*
+ * Post the next AcceptEx of a listener shard.  On failure the shard
+ * tries again from ofc_socket_win32_service.
+ */
+static OFC_BOOL socket_shard_post(OFC_SOCKET_IMPL *sock)
+{
+  SOCKET_SHARD *shard ;
+  HANDLE hEvent ;
+  DWORD bytes ;
+  OFC_BOOL ret ;
+  int error ;
+
+  ret = OFC_FALSE ;
+  shard = sock->shard ;
+  hEvent = shard->overlapped.hEvent ;
+  ofc_memset (&shard->overlapped, '\0', sizeof (WSAOVERLAPPED)) ;
+  shard->overlapped.hEvent = hEvent ;
+  ResetEvent (hEvent) ;
+
+  shard->accept = socket (sock->family == OFC_FAMILY_IP ? AF_INET : AF_INET6,
+			  SOCK_STREAM, IPPROTO_TCP) ;
+  if (shard->accept != INVALID_SOCKET)
+    {
+      if (shard->lpfnAcceptEx (sock->socket, shard->accept, shard->addrs, 0,
+			       SOCKET_SHARD_ADDR_LEN, SOCKET_SHARD_ADDR_LEN,
+			       &bytes, &shard->overlapped) ||
+	  WSAGetLastError () == WSA_IO_PENDING)
+	ret = OFC_TRUE ;
+      else
+	{
+	  error = WSAGetLastError () ;
+	  closesocket (shard->accept) ;
+	  shard->accept = INVALID_SOCKET ;
+	}
+    }
+  else
+    error = WSAGetLastError () ;
+
+  if (ret == OFC_FALSE)
+    {
+      ofc_log (OFC_LOG_WARN,
+	       "Listener shard could not post an accept, error %d, "
+	       "retrying in %d ms\n", error, OFC_SOCKET_SHARD_RETRY) ;
+      shard->retry = ofc_time_get_now () + OFC_SOCKET_SHARD_RETRY ;
+    }
+  return (ret) ;
+}
+
+/*
+ * Cancel a shard's outstanding AcceptEx and release the shard.  The
+ * listening socket belongs to the primary and is left open.
+ */
+static OFC_VOID socket_shard_release(OFC_SOCKET_IMPL *sock)
+{
+  SOCKET_SHARD *shard ;
+  DWORD bytes ;
+  DWORD flags ;
+
+  shard = sock->shard ;
+  if (shard != OFC_NULL)
+    {
+      if (shard->accept != INVALID_SOCKET)
+	{
+	  if (!HasOverlappedIoCompleted (&shard->overlapped))
+	    {
+	      CancelIoEx ((HANDLE) sock->socket, &shard->overlapped) ;
+	      WSAGetOverlappedResult (sock->socket, &shard->overlapped,
+				      &bytes, TRUE, &flags) ;
+	    }
+	  closesocket (shard->accept) ;
+	}
+      if (shard->hListen != OFC_HANDLE_NULL)
+	socket_shard_count (shard->hListen, -1) ;
+      CloseHandle (shard->overlapped.hEvent) ;
+      ofc_free (shard) ;
+      sock->shard = OFC_NULL ;
+      sock->socket = INVALID_SOCKET ;
+    }
+}
+
+/*
+ * Take the connection a shard's AcceptEx completed with and post the
+ * next one
+ */
+static OFC_SOCKET_IMPL *socket_shard_accept(OFC_SOCKET_IMPL *sock,
+                                            OFC_IPADDR *ip,
+                                            OFC_UINT16 *port)
+{
+  SOCKET_SHARD *shard ;
+  OFC_SOCKET_IMPL *newsock ;
+  SOCKET s ;
+  struct sockaddr *local ;
+  struct sockaddr *remote ;
+  int locallen ;
+  int remotelen ;
+  DWORD bytes ;
+  DWORD flags ;
+
+  newsock = OFC_NULL ;
+  shard = sock->shard ;
+  if (shard->accept != INVALID_SOCKET &&
+      HasOverlappedIoCompleted (&shard->overlapped))
+    {
+      s = shard->accept ;
+      shard->accept = INVALID_SOCKET ;
+      if (WSAGetOverlappedResult (sock->socket, &shard->overlapped,
+				  &bytes, FALSE, &flags) &&
+	  setsockopt (s, SOL_SOCKET, SO_UPDATE_ACCEPT_CONTEXT,
+		      (const char *) &sock->socket, sizeof (SOCKET)) == 0)
+	newsock = ofc_malloc (sizeof (OFC_SOCKET_IMPL)) ;
+
+      if (newsock != OFC_NULL)
+	{
+	  shard->lpfnGetAcceptExSockaddrs (shard->addrs, 0,
+					   SOCKET_SHARD_ADDR_LEN,
+					   SOCKET_SHARD_ADDR_LEN,
+					   &local, &locallen,
+					   &remote, &remotelen) ;
+	  unmake_sockaddr (remote, ip, port) ;
+
+	  newsock->socket = s ;
+	  newsock->family = sock->family ;
+	  socket_init_impl (newsock, OFC_TRUE) ;
+	  newsock->hEvent = CreateEvent (NULL, FALSE, FALSE, NULL) ;
+	  WSAEventSelect (newsock->socket, newsock->hEvent, newsock->mask) ;
+	}
+      else
+	closesocket (s) ;
+
+      socket_shard_post (sock) ;
+    }
+  return (newsock) ;
+}
+
+#if defined(OFC_SOCKET_WSAPOLL)
+static SHORT socket_poll_events(OFC_SOCKET_IMPL *sock)
+{
+  SHORT events ;
+
+  events = 0 ;
+  if (sock->armed)
+    {
+      if ((socket_mask (sock) & (FD_READ | FD_ACCEPT | FD_CLOSE)) &&
+	  !sock->read_reported)
+	events |= POLLRDNORM ;
+      if ((sock->mask & (FD_WRITE | FD_CONNECT)) && sock->write_blocked)
+	events |= POLLWRNORM ;
+    }
+  return (events) ;
+}
+
+static OFC_SOCKET_EVENT_TYPE socket_poll_results(OFC_SOCKET_IMPL *sock,
+                                                 SHORT revents)
+{
+  OFC_SOCKET_EVENT_TYPE TestEvents ;
+
+  TestEvents = 0 ;
+  if (sock->armed)
+    {
+      if ((revents & (POLLHUP | POLLERR)) && (sock->mask & FD_CLOSE))
+	TestEvents |= OFC_SOCKET_EVENT_CLOSE ;
+      if (revents & POLLRDNORM)
+	{
+	  if (sock->listening && (socket_mask (sock) & FD_ACCEPT))
+	    TestEvents |= OFC_SOCKET_EVENT_ACCEPT ;
+	  else if (!sock->listening && (sock->mask & FD_READ))
+	    TestEvents |= OFC_SOCKET_EVENT_READ ;
+	  if (TestEvents & (OFC_SOCKET_EVENT_ACCEPT | OFC_SOCKET_EVENT_READ))
+	    InterlockedExchange (&sock->read_reported, 1) ;
+	}
+      if (revents & POLLWRNORM)
+	{
+	  InterlockedExchange (&sock->write_blocked, 0) ;
+	  TestEvents |= OFC_SOCKET_EVENT_WRITE ;
+	}
+    }
+  return (TestEvents) ;
+}
+#endif
+
+OFC_HANDLE ofc_socket_impl_create(OFC_FAMILY_TYPE family,
+                                  OFC_SOCKET_TYPE socktype)
+{
+  OFC_HANDLE hSocket ;
+  OFC_SOCKET_IMPL *sock ;
+
+  int stype ;
+  int fam ;
+  int proto ;
+  BOOL on ;
+  
+  hSocket = OFC_HANDLE_NULL ;
+  sock = ofc_malloc (sizeof (OFC_SOCKET_IMPL)) ;
+
+  if (sock != OFC_NULL)
+    {
+      sock->family = family ;
+      if (sock->family == OFC_FAMILY_IP)
+	{
+	  sock->ip.ip_version = OFC_FAMILY_IP ;
+	  sock->ip.u.ipv4.addr = OFC_INADDR_ANY ;
+	  fam = AF_INET;
+	}
+      else
+	{
+	  sock->ip.ip_version = OFC_FAMILY_IPV6 ;
+	  sock->ip.u.ipv6 = ofc_in6addr_any ;
+	  fam = AF_INET6 ;
+	}
+      
+      if (socktype == SOCKET_TYPE_STREAM)
+	{
+	  stype = SOCK_STREAM;
+	  proto = IPPROTO_TCP;
+	}
+      else if (socktype == SOCKET_TYPE_ICMP)
+	{
+	  stype = SOCK_RAW ;
+	  if (sock->ip.ip_version == OFC_FAMILY_IP)
+	    proto = IPPROTO_ICMP ;
+	  else
+	    proto = IPPROTO_ICMPV6 ;
+	}
+      else
+	{
+	  stype = SOCK_DGRAM;
+	  proto = IPPROTO_UDP;
+	}
+
+      sock->socket = socket (fam, stype, proto) ;
+
+      if (sock->socket == INVALID_SOCKET)
+	{
+	  ofc_free (sock) ;
+	}
+      else
+	{
+	  if (socktype == SOCKET_TYPE_DGRAM)
+	    {
+	      on = TRUE ;
+	      setsockopt (sock->socket, SOL_SOCKET, SO_BROADCAST, 
+			  (char *) &on, sizeof(on)) ;
+	    }
+	  socket_init_impl (sock, socktype != SOCKET_TYPE_STREAM) ;
+	  sock->hEvent = CreateEvent (NULL, FALSE, FALSE, NULL) ;
+	  WSAEventSelect (sock->socket, sock->hEvent, sock->mask) ;
+	  hSocket = ofc_handle_create (OFC_HANDLE_SOCKET_IMPL, sock) ;
+	}
+    }
+  return (hSocket) ;
+}
+
+/*
+ * Send the corked tail of a socket the reaper could not take.  The
+ * socket is switched to blocking mode with a send timeout so the close
+ * waits no longer than a reaped one would.
+ */
+static OFC_VOID socket_send_tail(SOCKET s, const OFC_CHAR *tail,
+				 OFC_SIZET len)
+{
+  u_long nonblocking ;
+  DWORD timeout ;
+  int status ;
+
+  nonblocking = 0 ;
+  timeout = OFC_SOCKET_CLOSE_DEADLINE ;
+  if (WSAEventSelect (s, NULL, 0) != SOCKET_ERROR &&
+      ioctlsocket (s, FIONBIO, &nonblocking) != SOCKET_ERROR &&
+      setsockopt (s, SOL_SOCKET, SO_SNDTIMEO,
+		  (const char *) &timeout, sizeof (timeout)) == 0)
+    {
+      status = 0 ;
+      while (len > 0 && status != SOCKET_ERROR)
+	{
+	  status = send (s, tail, (int) len, 0) ;
+	  if (status > 0)
+	    {
+	      tail += status ;
+	      len -= status ;
+	    }
+	}
+    }
+}
+
+/*
+ * Close a socket now, in the background if it closes gracefully or
+ * corked data is still waiting to go out
+ */
+static OFC_BOOL socket_close_now(OFC_SOCKET_IMPL *sock, SOCKET s)
+{
+  const OFC_CHAR *tail ;
+  OFC_SIZET len ;
+  OFC_BOOL ret ;
+
+  ret = OFC_FALSE ;
+  tail = OFC_NULL ;
+  len = 0 ;
+  if (sock->cork != OFC_NULL && sock->cork->len > 0)
+    {
+      tail = sock->cork->buf ;
+      len = sock->cork->len ;
+    }
+  if ((sock->graceful || len > 0) && socket_reap (s, tail, len))
+    ret = OFC_TRUE ;
+  else
+    {
+      if (len > 0)
+	socket_send_tail (s, tail, len) ;
+      if (closesocket (s) != SOCKET_ERROR)
+	ret = OFC_TRUE ;
+    }
+  return (ret) ;
+}
+
+static OFC_VOID socket_free(OFC_SOCKET_IMPL *sock)
+{
+  socket_idle_release (sock) ;
+  socket_group_remove (sock) ;
+  socket_connect_ex_release (sock) ;
+  socket_shard_release (sock) ;
+  socket_cork_release (sock) ;
+  ofc_free (sock->tune) ;
+  socket_frame_release (sock) ;
+  ofc_sockmem_release (sock->mem_sndbuf + sock->mem_rcvbuf +
+		       sock->mem_inflight) ;
+  if (sock->hEvent != NULL)
+    CloseHandle (sock->hEvent) ;
+  ofc_free(sock) ;
+}
+
+/*
+ * Finish a deferred close once no borrower holds the socket.  Both the
+ * close and the last borrower out call this, and only one of them gets
+ * to close.
+ *
+ * Returns:
+ *    OFC_FALSE if a close done here failed
+ */
+static OFC_BOOL socket_close_deferred(OFC_SOCKET_IMPL *sock)
+{
+  OFC_BOOL ret ;
+
+  ret = OFC_TRUE ;
+  if (sock->borrows == 0 && InterlockedExchange (&sock->close_todo, 0) != 0)
+    ret = socket_close_now (sock, sock->close_socket) ;
+  return (ret) ;
+}
+
+/*
+ * Drop a reference.  The last one frees the socket.
+ */
+static OFC_VOID socket_release(OFC_SOCKET_IMPL *sock)
+{
+  if (InterlockedDecrement (&sock->refs) == 0)
+    {
+      socket_close_deferred (sock) ;
+      socket_free (sock) ;
+    }
+}
+
+/*
+ * Return a borrow.  The last borrower out finishes a deferred close.
+ *
+ * Returns:
+ *    OFC_FALSE if a close done here failed
+ */
+static OFC_BOOL socket_unborrow(OFC_SOCKET_IMPL *sock)
+{
+  OFC_BOOL ret ;
+
+  ret = OFC_TRUE ;
+  if (InterlockedDecrement (&sock->borrows) == 0)
+    ret = socket_close_deferred (sock) ;
+  socket_release (sock) ;
+  return (ret) ;
+}
+
+OFC_VOID ofc_socket_impl_destroy(OFC_HANDLE hSocket)
+{
+  OFC_SOCKET_IMPL *sock ;
+
+  sock = ofc_handle_lock (hSocket) ;
+  if (sock != OFC_NULL)
+    {
+      /*
+       * Borrowers keep the socket until they return it
+       */
+      ofc_handle_destroy (hSocket) ;
+      socket_release (sock) ;
+      ofc_handle_unlock (hSocket) ;
+    }
+}
+
+/*
+ * PSP_Bind - Bind an IP Address and port to a socket
+ *
+ * Accepts:
+ *    hSock - Handle of socket
+ *    ip - 32 bit representation of ip address in host order
+ *    port - 16 bit representation of the port in host order
+ *
+ * Returns:
+ *    status (STATE_SUCCESS or STATE_FAIL)
+ */
+static OFC_VOID make_sockaddr(struct sockaddr **mysockaddr,
+                              socklen_t *mysocklen,
+                              const OFC_IPADDR *ip,
+                              OFC_UINT16 port)
+{
+  struct sockaddr_in *mysockaddr_in ;
+  struct sockaddr_in6 *mysockaddr_in6 ;
+  OFC_INT i ;
+  
+  if (ip->ip_version == OFC_FAMILY_IP)
+    {
+      mysockaddr_in = ofc_malloc (sizeof (struct sockaddr_in)) ;
+      ofc_memset (mysockaddr_in, '\0', sizeof (struct sockaddr_in)) ;
+
+      mysockaddr_in->sin_family = AF_INET ;
+      OFC_NET_STON (&mysockaddr_in->sin_port, 0, port) ;
+      OFC_NET_LTON (&mysockaddr_in->sin_addr.s_addr, 0,
+		     ip->u.ipv4.addr) ;
+      *mysockaddr = (struct sockaddr *) mysockaddr_in ;
+      *mysocklen = sizeof (struct sockaddr_in) ;
+    }
+  else
+    {
+      mysockaddr_in6 = ofc_malloc (sizeof (struct sockaddr_in6)) ;
+      ofc_memset (mysockaddr_in6, '\0', sizeof (struct sockaddr_in6)) ;
+
+      mysockaddr_in6->sin6_family = AF_INET6 ;
+      mysockaddr_in6->sin6_scope_id = ip->u.ipv6.scope ;
+
+      OFC_NET_STON (&mysockaddr_in6->sin6_port, 0, port) ;
+      for (i = 0 ; i < 16 ; i++)
+	mysockaddr_in6->sin6_addr.s6_addr[i] = 
+	  ip->u.ipv6._s6_addr[i] ;
+      *mysockaddr = (struct sockaddr *) mysockaddr_in6 ;
+      *mysocklen = sizeof (struct sockaddr_in6) ;
+    }
+}
+
+OFC_VOID unmake_sockaddr(struct sockaddr *mysockaddr,
+                         OFC_IPADDR *ip,
+                         OFC_UINT16 *port)
+{
+  struct sockaddr_in *mysockaddr_in ;
+  struct sockaddr_in6 *mysockaddr_in6 ;
+  OFC_INT i ;
+
+  if (mysockaddr->sa_family == AF_INET)
+    {
+      mysockaddr_in = (struct sockaddr_in *) mysockaddr ;
+      ip->ip_version = OFC_FAMILY_IP ;
+      *port = OFC_NET_NTOS (&mysockaddr_in->sin_port, 0) ;
+      ip->u.ipv4.addr = OFC_NET_NTOL (&mysockaddr_in->sin_addr.s_addr, 0) ;
+    }
+  else
+    {
+      mysockaddr_in6 = (struct sockaddr_in6 *) mysockaddr ;
+      if (ip != OFC_NULL)
+	{
+	  ip->ip_version = OFC_FAMILY_IPV6 ;
+	  for (i = 0 ; i < 16 ; i++)
+	    ip->u.ipv6._s6_addr[i] = 
+	      mysockaddr_in6->sin6_addr.s6_addr[i] ; 
+	}
+      if (port != OFC_NULL)
+	*port = OFC_NET_NTOS (&mysockaddr_in6->sin6_port, 0) ;
+    }
+}
+
+OFC_BOOL ofc_socket_impl_bind(OFC_HANDLE hSocket, const OFC_IPADDR *ip,
+                              OFC_UINT16 port)
+{
+  OFC_SOCKET_IMPL *sock ;
+  OFC_BOOL ret ;
+
+  int status ;
+  struct sockaddr *mysockaddr;
+  socklen_t mysocklen ;
+
+  ret = OFC_FALSE ;
+
+  sock = ofc_handle_lock (hSocket) ;
+  if (sock != OFC_NULL)
+    {
+      make_sockaddr (&mysockaddr, &mysocklen, ip, port) ;
+
+      status = bind(sock->socket, mysockaddr, mysocklen) ;
+
+      if (status != SOCKET_ERROR)
+	ret = OFC_TRUE ;
+
+      ofc_free (mysockaddr) ;
+
+      ofc_handle_unlock(hSocket) ;
+    }
+  return (ret) ;
+}
+
+/*
+ * A socket closed in the background.  The reaper thread sends what was left in
+ * the cork buffer, shuts down the send side, then reads and discards
+ * whatever the peer still sends until the peer closes or the deadline
+ * passes.
+ */
+typedef struct _SOCKET_REAP
+{
+  struct _SOCKET_REAP *next ;
+  SOCKET socket ;
+  OFC_MSTIME deadline ;
+  OFC_BOOL shut ;
+  OFC_SIZET len ;
+  OFC_SIZET sent ;
+  OFC_CHAR tail[1] ;
+} SOCKET_REAP ;
+
+static OFC_LOCK socket_reap_lock = OFC_NULL ;
+static SOCKET_REAP *socket_reap_list = OFC_NULL ;
+static HANDLE socket_reap_event = NULL ;
+static HANDLE socket_reap_thread = NULL ;
+static volatile LONG socket_reap_stop = 0 ;
+
+/*
+ * Drain a reaped socket.  Returns OFC_TRUE once it can be closed.
+ */
+static OFC_BOOL socket_reap_drain(SOCKET_REAP *reap, OFC_MSTIME now)
+{
+  OFC_CHAR buf[512] ;
+  OFC_BOOL ret ;
+  struct linger linger ;
+  int status ;
+
+  ret = OFC_FALSE ;
+  status = 1 ;
+  while (!reap->shut && status > 0)
+    {
+      if (reap->sent < reap->len)
+	{
+	  status = send (reap->socket, reap->tail + reap->sent,
+			 (int) (reap->len - reap->sent), 0) ;
+	  if (status > 0)
+	    reap->sent += status ;
+	}
+      else if (shutdown (reap->socket, SD_SEND) == 0)
+	reap->shut = OFC_TRUE ;
+      else
+	status = SOCKET_ERROR ;
+    }
+
+  if (status != SOCKET_ERROR)
+    {
+      do
+	{
+	  status = recv (reap->socket, buf, sizeof (buf), 0) ;
+	}
+      while (status > 0) ;
+    }
+
+  if ((reap->shut && status == 0) || WSAGetLastError () != WSAEWOULDBLOCK)
+    ret = OFC_TRUE ;
+  else if ((OFC_INT) (reap->deadline - now) <= 0)
+    {
+      /*
+       * The peer is too slow.  Reset the connection rather than let
+       * closesocket linger.
+       */
+      linger.l_onoff = 1 ;
+      linger.l_linger = 0 ;
+      setsockopt (reap->socket, SOL_SOCKET, SO_LINGER,
+		  (const char *) &linger, sizeof (linger)) ;
+      ret = OFC_TRUE ;
+    }
+  return (ret) ;
+}
+
+static DWORD WINAPI socket_reap_run(LPVOID context)
+{
+  SOCKET_REAP **prev ;
+  SOCKET_REAP *reap ;
+  SOCKET_REAP *done ;
+  OFC_MSTIME now ;
+  OFC_BOOL stop ;
+  DWORD wait ;
+
+  wait = INFINITE ;
+  stop = OFC_FALSE ;
+  while (!stop)
+    {
+      WaitForSingleObject (socket_reap_event, wait) ;
+
+      stop = (socket_reap_stop != 0) ;
+      now = ofc_time_get_now () ;
+      wait = INFINITE ;
+      done = OFC_NULL ;
+
+      ofc_lock (socket_reap_lock) ;
+      prev = &socket_reap_list ;
+      while (*prev != OFC_NULL)
+	{
+	  reap = *prev ;
+	  /*
+	   * Once stopping, every socket is past its deadline
+	   */
+	  if (stop)
+	    reap->deadline = now ;
+	  if (socket_reap_drain (reap, now))
+	    {
+	      *prev = reap->next ;
+	      reap->next = done ;
+	      done = reap ;
+	    }
+	  else
+	    {
+	      if ((DWORD) (reap->deadline - now) < wait)
+		wait = (DWORD) (reap->deadline - now) ;
+	      prev = &reap->next ;
+	    }
+	}
+      ofc_unlock (socket_reap_lock) ;
+
+      while (done != OFC_NULL)
+	{
+	  reap = done ;
+	  done = reap->next ;
+	  closesocket (reap->socket) ;
+	  ofc_free (reap) ;
+	}
+    }
+  return (0) ;
+}
+
+/*
+ * Hand a socket to the reaper along with len bytes at tail that must be
+ * sent before the send side is shut down.  Returns OFC_FALSE if the send
+ * side could not be shut down, in which case the caller closes the
+ * socket itself.
+ */
+static OFC_BOOL socket_reap(SOCKET s, const OFC_CHAR *tail, OFC_SIZET len)
+{
+  SOCKET_REAP *reap ;
+  OFC_BOOL ret ;
+
+  ret = OFC_FALSE ;
+  if (socket_reap_lock != OFC_NULL &&
+      (len > 0 || shutdown (s, SD_SEND) == 0))
+    {
+      reap = ofc_malloc (sizeof (SOCKET_REAP) + len) ;
+      if (reap != OFC_NULL)
+	{
+	  reap->socket = s ;
+	  reap->deadline = ofc_time_get_now () + OFC_SOCKET_CLOSE_DEADLINE ;
+	  reap->shut = (len == 0) ;
+	  reap->len = len ;
+	  reap->sent = 0 ;
+	  if (len > 0)
+	    ofc_memcpy (reap->tail, tail, len) ;
+
+	  ofc_lock (socket_reap_lock) ;
+	  if (!socket_reap_stop && socket_reap_thread == NULL)
+	    socket_reap_thread = CreateThread (NULL, 0, socket_reap_run,
+					       OFC_NULL, 0, NULL) ;
+	  /*
+	   * Rebinding the socket to the reaper's event releases it from
+	   * its own, so that event can be closed with the handle.
+	   */
+	  if (!socket_reap_stop && socket_reap_thread != NULL &&
+	      WSAEventSelect (s, socket_reap_event,
+			      FD_READ | FD_WRITE | FD_CLOSE) != SOCKET_ERROR)
+	    {
+	      reap->next = socket_reap_list ;
+	      socket_reap_list = reap ;
+	      ret = OFC_TRUE ;
+	    }
+	  ofc_unlock (socket_reap_lock) ;
+
+	  if (ret == OFC_TRUE)
+	    SetEvent (socket_reap_event) ;
+	  else
+	    ofc_free (reap) ;
+	}
+    }
+  return (ret) ;
+}
+
+OFC_VOID ofc_socket_win32_init(OFC_VOID)
+{
+  if (socket_reap_lock == OFC_NULL)
+    {
+      socket_reap_event = CreateEvent (NULL, FALSE, FALSE, NULL) ;
+      if (socket_reap_event != NULL)
+	socket_reap_lock = ofc_lock_init () ;
+#if !defined(OFC_SOCKET_WSAPOLL)
+      socket_idle_group = socket_group_alloc (OFC_TRUE) ;
+#endif
+    }
+}
+
+/*
+ * Stop the reaper thread and wait for it to exit.  Sockets it is still
+ * draining are reset and closed.  Graceful closes after this close the
+ * socket in the foreground.
+ *
+ * Nothing in the platform layer calls this.  The application calls it
+ * at shutdown, see socket_windows.h.
+ */
+OFC_VOID ofc_socket_win32_shutdown(OFC_VOID)
+{
+  HANDLE thread ;
+
+  thread = NULL ;
+  if (socket_reap_lock != OFC_NULL)
+    {
+      ofc_lock (socket_reap_lock) ;
+      InterlockedExchange (&socket_reap_stop, 1) ;
+      thread = socket_reap_thread ;
+      socket_reap_thread = NULL ;
+      ofc_unlock (socket_reap_lock) ;
+    }
+
+  if (thread != NULL)
+    {
+      SetEvent (socket_reap_event) ;
+      WaitForSingleObject (thread, INFINITE) ;
+      CloseHandle (thread) ;
+    }
+}
+
+/*
+ * Choose how a socket is closed.  A graceful close shuts down the send
+ * side and leaves draining and release of the socket to a background
+ * thread, so ofc_socket_impl_close never waits on the peer.
+ *
+ * Accepts:
+ *    hSocket - Socket handle
+ *    onoff - OFC_TRUE for a graceful close
+ *
+ * Returns:
+ *    OFC_FALSE if the handle is not a socket
+ */
+OFC_BOOL ofc_socket_win32_graceful_close(OFC_HANDLE hSocket, OFC_BOOL onoff)
+{
+  OFC_SOCKET_IMPL *sock ;
+  OFC_BOOL ret ;
+
+  ret = OFC_FALSE ;
+  sock = ofc_handle_lock (hSocket) ;
+  if (sock != OFC_NULL)
+    {
+      sock->graceful = onoff ;
+      ret = OFC_TRUE ;
+      ofc_handle_unlock (hSocket) ;
+    }
+  return (ret) ;
+}
+
+/*
+ * PSP_close - Close a socket
+ *
+ * Accepts:
+ *    hSock - Socket handle to close
+ *
+ * Returns:
+ *    status (STATE_SUCCESS or STATE_FAIL)
+ */
+OFC_BOOL ofc_socket_impl_close(OFC_HANDLE hSocket)
+{
+  OFC_SOCKET_IMPL *sock ;
+  OFC_BOOL ret ;
+
+  ret = OFC_FALSE ;
+  sock = ofc_handle_lock(hSocket) ;
+  if (sock != OFC_NULL)
+    {
+      socket_group_remove (sock) ;
+      socket_connect_ex_release (sock) ;
+      if (sock->shard != OFC_NULL)
+	{
+	  socket_shard_release (sock) ;
+	  ret = OFC_TRUE ;
+	}
+      else if (sock->socket != INVALID_SOCKET)
+	{
+	  /*
+	   * Corked data goes out first.  Whatever the socket won't take
+	   * now is handed to the reaper with the socket.
+	   */
+	  socket_cork_flush (sock) ;
+	  /*
+	   * Park the socket before checking for borrowers so a borrower
+	   * returning meanwhile cannot miss the close.  Borrowers that
+	   * come later see an invalid socket.
+	   */
+	  sock->close_socket = sock->socket ;
+	  sock->socket = INVALID_SOCKET ;
+	  InterlockedExchange (&sock->close_todo, 1) ;
+	  ret = socket_close_deferred (sock) ;
+	}
+      ofc_handle_unlock(hSocket) ;
+    }
+
+  return(ret);
+}
+
+/*
+ * PSP_Connect - Connect to a remote ip and port
+ *
+ * Accepts:
+ *    hSock - Handle of socket to connect
+ *    ip - 32 bit ip in host order
+ *    port - 16 bit port in host order
+ *
+ * Returns:
+ *    status (STATE_SUCCESS or STATE_FAIL)
+ */
+OFC_BOOL ofc_socket_impl_connect(OFC_HANDLE hSocket,
+                                 const OFC_IPADDR *ip, OFC_UINT16 port)
+{
+  OFC_SOCKET_IMPL *sock ;
+  OFC_BOOL ret ;
+
+  int status ;
+  struct sockaddr *mysockaddr;
+  socklen_t mysocklen ;
+
+  ret = OFC_FALSE ;
+  sock = ofc_handle_lock(hSocket) ;
+  if (sock != OFC_NULL)
+    {
+      make_sockaddr (&mysockaddr, &mysocklen, ip, port) ;
+
+      status = connect(sock->socket, mysockaddr, mysocklen) ;
+
+      if (((status == SOCKET_ERROR) && 
+	   (WSAGetLastError() == WSAEWOULDBLOCK)) ||
+	  (status != SOCKET_ERROR))
+	{
+	  sock->armed = OFC_TRUE ;
+	  InterlockedExchange (&sock->write_blocked, 1) ;
+	  ret = OFC_TRUE ;
+	}
+      ofc_free(mysockaddr) ;
+
+      ofc_handle_unlock(hSocket) ;
+    }
+
+  return (ret) ;
+}
+
+/*
+ * Connect with TCP Fast Open
+ *
+ * The initial payload is sent with the SYN through ConnectEx.  If the
+ * peer does not accept the fast open cookie, the stack sends the payload
+ * once the handshake completes, so the caller sees the same result
+ * either way.  If fast open or ConnectEx is not available, this falls
+ * back to a plain connect and nothing is sent.
+ *
+ * Accepts:
+ *    hSocket - Handle of a stream socket to connect
+ *    ip - ip address to connect to
+ *    port - port in host order
+ *    buf - Initial payload
+ *    len - Size of the payload
+ *    sent - Receives the number of payload bytes queued with the connect.
+ *           When zero, the caller must send the payload after the
+ *           connect completes.
+ *
+ * Returns:
+ *    OFC_TRUE if the connect was started
+ */
+OFC_BOOL ofc_socket_win32_connect_fast(OFC_HANDLE hSocket,
+                                       const OFC_IPADDR *ip,
+                                       OFC_UINT16 port,
+                                       const OFC_VOID *buf,
+                                       OFC_SIZET len,
+                                       OFC_SIZET *sent)
+{
+  OFC_SOCKET_IMPL *sock ;
+  SOCKET_CONNECT_EX *connect_ex ;
+  OFC_BOOL ret ;
+  OFC_IPADDR any ;
+
+  LPFN_CONNECTEX lpfnConnectEx ;
+  GUID guidConnectEx = WSAID_CONNECTEX ;
+  DWORD bytes ;
+  DWORD on ;
+  int status ;
+  struct sockaddr *mysockaddr;
+  socklen_t mysocklen ;
+  struct sockaddr_in6 local ;
+  int locallen ;
+
+  ret = OFC_FALSE ;
+  *sent = 0 ;
+  sock = ofc_handle_lock(hSocket) ;
+  if (sock != OFC_NULL)
+    {
+      lpfnConnectEx = NULL ;
+      connect_ex = OFC_NULL ;
+      on = 1 ;
+      /*
+       * Grouped sockets are waited on through their group and have no
+       * way to wait on the overlapped completion, so they do not use
+       * ConnectEx.
+       */
+      if (sock->group == OFC_NULL && sock->connect_ex == OFC_NULL &&
+	  setsockopt (sock->socket, IPPROTO_TCP, TCP_FASTOPEN,
+		      (const char *) &on, sizeof (on)) != SOCKET_ERROR)
+	WSAIoctl (sock->socket, SIO_GET_EXTENSION_FUNCTION_POINTER,
+		  &guidConnectEx, sizeof (guidConnectEx),
+		  &lpfnConnectEx, sizeof (lpfnConnectEx),
+		  &bytes, NULL, NULL) ;
+
+      if (lpfnConnectEx != NULL)
+	{
+	  /*
+	   * ConnectEx requires a bound socket
+	   */
+	  locallen = sizeof (local) ;
+	  if (getsockname (sock->socket, (struct sockaddr *) &local,
+			   &locallen) == SOCKET_ERROR)
+	    {
+	      any = sock->ip ;
+	      make_sockaddr (&mysockaddr, &mysocklen, &any, 0) ;
+	      bind (sock->socket, mysockaddr, mysocklen) ;
+	      ofc_free (mysockaddr) ;
+	    }
+
+	  connect_ex = ofc_malloc (sizeof (SOCKET_CONNECT_EX)) ;
+	  if (connect_ex != OFC_NULL)
+	    {
+	      ofc_memset (connect_ex, '\0', sizeof (SOCKET_CONNECT_EX)) ;
+	      connect_ex->overlapped.hEvent =
+		CreateEvent (NULL, TRUE, FALSE, NULL) ;
+	      connect_ex->data = ofc_malloc (len) ;
+	      if (connect_ex->overlapped.hEvent == NULL ||
+		  (len > 0 && connect_ex->data == OFC_NULL))
+		{
+		  if (connect_ex->overlapped.hEvent != NULL)
+		    CloseHandle (connect_ex->overlapped.hEvent) ;
+		  ofc_free (connect_ex->data) ;
+		  ofc_free (connect_ex) ;
+		  connect_ex = OFC_NULL ;
+		}
+	      else
+		ofc_memcpy (connect_ex->data, buf, len) ;
+	    }
+	}
+
+      make_sockaddr (&mysockaddr, &mysocklen, ip, port) ;
+
+      if (connect_ex != OFC_NULL)
+	{
+	  if ((*lpfnConnectEx) (sock->socket, mysockaddr, mysocklen,
+				connect_ex->data, (DWORD) len, &bytes,
+				&connect_ex->overlapped) ||
+	      WSAGetLastError () == WSA_IO_PENDING)
+	    {
+	      sock->connect_ex = connect_ex ;
+	      sock->fast_open = OFC_TRUE ;
+	      sock->armed = OFC_TRUE ;
+	      *sent = len ;
+	      ret = OFC_TRUE ;
+	    }
+	  else
+	    {
+	      CloseHandle (connect_ex->overlapped.hEvent) ;
+	      ofc_free (connect_ex->data) ;
+	      ofc_free (connect_ex) ;
+	    }
+	}
+
+      if (ret == OFC_FALSE)
+	{
+	  /*
+	   * Fall back to a plain connect
+	   */
+	  sock->fast_open = OFC_FALSE ;
+	  status = connect (sock->socket, mysockaddr, mysocklen) ;
+	  if (((status == SOCKET_ERROR) && 
+	       (WSAGetLastError() == WSAEWOULDBLOCK)) ||
+	      (status != SOCKET_ERROR))
+	    {
+	      sock->armed = OFC_TRUE ;
+	      InterlockedExchange (&sock->write_blocked, 1) ;
+	      ret = OFC_TRUE ;
+	    }
+	}
+      ofc_free (mysockaddr) ;
+
+      ofc_handle_unlock(hSocket) ;
+    }
+
+  return (ret) ;
+}
+
+/*
+ * Report whether the last connect on a socket went through TCP Fast
+ * Open.  Whether the peer accepted the data with the SYN is not visible
+ * through Winsock.
+ */
+OFC_BOOL ofc_socket_win32_fast_open_used(OFC_HANDLE hSocket)
+{
+  OFC_SOCKET_IMPL *sock ;
+  OFC_BOOL ret ;
+
+  ret = OFC_FALSE ;
+  sock = ofc_handle_lock(hSocket) ;
+  if (sock != OFC_NULL)
+    {
+      ret = sock->fast_open ;
+      ofc_handle_unlock(hSocket) ;
+    }
+  return (ret) ;
+}
+
+/*
+ * PSP_Listen - Listen for a connection from remote
+ *
+ * Accepts:
+ *    hSock - Handle of Socket to set to listen
+ *    backlog - Number of simultaneous open connections to accept
+ *
+ * Returns:
+ *    status (STATE_SUCCESS or STATE_FAIL)
+ */
+OFC_BOOL ofc_socket_impl_listen(OFC_HANDLE hSocket, OFC_INT backlog)
+{
+  OFC_SOCKET_IMPL *sock ;
+  OFC_BOOL ret ;
+  int status ;
+
+  ret = OFC_FALSE ;
+  sock = ofc_handle_lock (hSocket) ;
+  if (sock != OFC_NULL)
+    {
+      status = listen(sock->socket, (int) backlog) ;
+      if (status != SOCKET_ERROR)
+	{
+	  sock->armed = OFC_TRUE ;
+	  sock->listening = OFC_TRUE ;
+	  ret = OFC_TRUE ;
+	}
+
+      ofc_handle_unlock (hSocket) ;
+    }
+  return(ret);
+}
+
+/*
+ * PSP_Accept - Accept a connection on socket
+ * 
+ * Accepts:
+ *    sock - Pointer to socket structure of listening socket
+ *    newsock - Pointer to new socket structure
+ *
+ * Returns:
+ *    status (STATE_SUCCESS or STATE_FAIL)
+ */
+OFC_HANDLE ofc_socket_impl_accept(OFC_HANDLE hSocket,
+                                  OFC_IPADDR *ip, OFC_UINT16 *port)
+{
+  OFC_SOCKET_IMPL *sock ;
+  OFC_SOCKET_IMPL *newsock ;
+  OFC_HANDLE hNewSock ;
+
+  socklen_t addrlen;
+  struct sockaddr *mysockaddr;	
+
+  hNewSock = OFC_HANDLE_NULL ;
+  sock = ofc_handle_lock (hSocket) ;
+  if (sock != OFC_NULL && sock->shard != OFC_NULL)
+    {
+      newsock = socket_shard_accept (sock, ip, port) ;
+      if (newsock != OFC_NULL)
+	hNewSock = ofc_handle_create (OFC_HANDLE_SOCKET_IMPL, newsock) ;
+      ofc_handle_unlock (hSocket) ;
+    }
+  else if (sock != OFC_NULL)
+    {
+      InterlockedExchange (&sock->read_reported, 0) ;
+      newsock = ofc_malloc (sizeof (OFC_SOCKET_IMPL)) ;
+
+      addrlen = (OFC_MAX (sizeof (struct sockaddr_in6),
+			  sizeof (struct sockaddr_in))) ;
+
+      mysockaddr = ofc_malloc (addrlen) ;
+
+      newsock->socket = accept(sock->socket, mysockaddr, &addrlen);
+
+      if (newsock->socket != INVALID_SOCKET)
+	{
+	  socket_init_impl (newsock, OFC_TRUE) ;
+	  newsock->hEvent = CreateEvent (NULL, FALSE, FALSE, NULL) ;
+	  WSAEventSelect (newsock->socket, newsock->hEvent, newsock->mask) ;
+
+	  unmake_sockaddr (mysockaddr, ip, port) ;
+
+	  hNewSock = ofc_handle_create (OFC_HANDLE_SOCKET_IMPL, newsock) ;
+	}
+      else
+	{
+	  if (WSAGetLastError () == WSAEWOULDBLOCK)
+	    InterlockedAnd (&sock->ready, ~(LONG) OFC_SOCKET_EVENT_ACCEPT) ;
+	  ofc_free (newsock) ;
+	}
+      ofc_free(mysockaddr) ;
+
+      ofc_handle_unlock(hSocket) ;
+    }
+
+  if (hNewSock != OFC_HANDLE_NULL)
+    ofc_startup_milestone (OFC_STARTUP_FIRST_ACCEPT) ;
+  return (hNewSock) ;
+}
+
+/*
+ * PSP_Reuseaddr - Clean up socket so we use it again
+ * 
+ * Accepts:
+ *    hSock - Socket to set the port reuseable on
+ *    onoff - TRUE for on, FALSE for off
+ */
+OFC_BOOL ofc_socket_impl_reuse_addr(OFC_HANDLE hSocket, OFC_BOOL onoff)
+{
+  OFC_SOCKET_IMPL *sock ;
+  OFC_BOOL ret ;
+
+  int status ;
+  BOOL on;
+
+  ret = OFC_FALSE ;
   sock = ofc_handle_lock(hSocket) ;
   if (sock != OFC_NULL)
     {
-      status = closesocket (sock->socket);
-      if (status != SOCKET_ERROR)
+      on = (onoff == OFC_TRUE ? TRUE : FALSE) ;
+      status = setsockopt(sock->socket, SOL_SOCKET, SO_REUSEADDR, 
+			  (const char *) &on, sizeof(on));
+      if (status != SOCKET_ERROR)
+	ret = OFC_TRUE ;
+      ofc_handle_unlock (hSocket) ;
+    }
+  return (ret) ;
+}
+
+/*
+ * PSP_Is_Connected - Test if the socket is connected or not
+ *
+ * Accepts:
+ *     hSock - Socket to test for
+ *
+ * Returns:
+ *   True if connected, false otherwise
+ */
+OFC_BOOL ofc_socket_impl_connected(OFC_HANDLE hSocket)
+{
+  OFC_SOCKET_IMPL *sock ;
+  OFC_BOOL ret ;
+
+  int status ;
+  int *namelenp;
+  int len ;
+  struct sockaddr sa;
+
+  ret = OFC_FALSE ;
+  sock = ofc_handle_lock (hSocket) ;
+  if (sock != OFC_NULL)
+    {
+      len = sizeof(sa);
+      namelenp = &len ;
+      status = getpeername(sock->socket, &sa, namelenp);
+      if (status != SOCKET_ERROR)
+	ret = OFC_TRUE ;
+      ofc_handle_unlock (hSocket) ;
+    }
+
+  return (ret) ;
+}
+
+/*
+ * PSP_NoBlock - Set socket block mode
+ *
+ * Accepts:
+ *    hSock - Socket to set the function on 
+ *    onoff - Whether setting blocking on or off
+ *    option - The option for the command
+ *
+ * Returns:
+ *    status - Success of failure
+ */
+OFC_BOOL ofc_socket_impl_no_block(OFC_HANDLE hSocket, OFC_BOOL onoff)
+{
+  OFC_SOCKET_IMPL *sock ;
+  OFC_BOOL ret ;
+
+  int status ;
+  u_long cmd;
+
+  ret = OFC_FALSE ;
+  sock = ofc_handle_lock (hSocket) ;
+  if (sock != OFC_NULL)
+    {
+      cmd = (onoff == OFC_TRUE ? 1 : 0) ;
+      status = ioctlsocket (sock->socket, FIONBIO, &cmd) ;
+      if (status != SOCKET_ERROR)
+	ret = OFC_TRUE ;
+      ofc_handle_unlock (hSocket) ;
+    }
+  return (ret) ;
+}
+
+/*
+ * Send straight to the kernel.  Returns as ofc_socket_impl_send does.
+ */
+static OFC_SIZET socket_send(OFC_SOCKET_IMPL *sock, const OFC_VOID *buf,
+                             OFC_SIZET len)
+{
+  OFC_SIZET ret ;
+  int status ;
+
+  ret = -1 ;
+  InterlockedIncrement (&socket_send_syscalls) ;
+  status = send(sock->socket, (const char *) buf, (int) len, 0) ;
+  if ((status == SOCKET_ERROR) && (WSAGetLastError() == WSAEWOULDBLOCK))
+    {
+      InterlockedExchange (&sock->write_blocked, 1) ;
+      InterlockedAnd (&sock->ready, ~(LONG) OFC_SOCKET_EVENT_WRITE) ;
+      ret = 0 ;
+    }
+  else if (status != SOCKET_ERROR)
+    {
+      InterlockedExchange (&sock->tx_dirty, 1) ;
+      ret = status ;
+    }
+
+  return (ret) ;
+}
+
+/*
+ * Push out as much of the cork buffer as the socket will take
+ *
+ * Returns:
+ *    1 if the buffer is empty, 0 if data remains, -1 on error.  On error
+ *    the buffered data is discarded.
+ */
+static OFC_INT socket_cork_flush(OFC_SOCKET_IMPL *sock)
+{
+  SOCKET_CORK *cork ;
+  OFC_SIZET status ;
+  OFC_INT ret ;
+
+  ret = 1 ;
+  cork = sock->cork ;
+  if (cork != OFC_NULL && cork->len > 0)
+    {
+      status = socket_send (sock, cork->buf, cork->len) ;
+      if (status == (OFC_SIZET) -1)
+	{
+	  cork->len = 0 ;
+	  ret = -1 ;
+	}
+      else
+	{
+	  if (status > 0)
+	    {
+	      cork->len -= status ;
+	      MoveMemory (cork->buf, cork->buf + status, cork->len) ;
+	    }
+	  if (cork->len > 0)
+	    ret = 0 ;
+	}
+      socket_cork_trim (cork) ;
+    }
+  return (ret) ;
+}
+
+/*
+ * PSP_Send - Send data on a socket
+ *
+ * Accepts:
+ *    hSock - Socket to send data on
+ *    buf - Pointer to buffer to write
+ *    len - Number of bytes to write
+ *
+ * Returns:
+ *    Number of bytes written
+ */
+OFC_SIZET ofc_socket_impl_send(OFC_HANDLE hSocket, const OFC_VOID *buf,
+                               OFC_SIZET len)
+{
+  OFC_SOCKET_IMPL *sock ;
+  SOCKET_CORK *cork ;
+  OFC_SIZET ret ;
+  OFC_INT flushed ;
+
+  ret = -1 ;
+  sock = ofc_handle_lock (hSocket) ;
+  if (sock != OFC_NULL)
+    {
+      InterlockedIncrement (&socket_send_calls) ;
+      cork = sock->cork ;
+      if (sock->priority == OFC_SOCKMEM_LOW && ofc_sockmem_exhausted ())
+	{
+	  /*
+	   * Backpressure.  The service routine reports the socket
+	   * writable again once memory is released.
+	   */
+	  InterlockedExchange (&sock->throttled, 1) ;
+	  ret = 0 ;
+	}
+      else if (cork == OFC_NULL || (!cork->corked && cork->len == 0))
+	ret = socket_send (sock, buf, len) ;
+      else
+	{
+	  flushed = 1 ;
+	  if (!cork->corked || len >= OFC_SOCKET_CORK_THRESHOLD ||
+	      cork->len + len > OFC_SOCKET_CORK_SIZE)
+	    flushed = socket_cork_flush (sock) ;
+
+	  if (flushed < 0)
+	    ret = -1 ;
+	  else if (cork->corked && len < OFC_SOCKET_CORK_THRESHOLD &&
+		   cork->len + len <= OFC_SOCKET_CORK_SIZE &&
+		   socket_cork_reserve (sock, len))
+	    {
+	      /*
+	       * Small write.  Hold it until the buffer passes the
+	       * threshold, the socket is uncorked or the deadline passes.
+	       */
+	      if (cork->len == 0)
+		cork->deadline = ofc_time_get_now () + OFC_SOCKET_CORK_DEADLINE ;
+	      ofc_memcpy (cork->buf + cork->len, buf, len) ;
+	      cork->len += len ;
+	      ret = len ;
+	      if (cork->len >= OFC_SOCKET_CORK_THRESHOLD)
+		socket_cork_flush (sock) ;
+	    }
+	  else if (flushed == 0)
+	    /*
+	     * Buffered data must go first.  Report would block.
+	     */
+	    ret = 0 ;
+	  else if (cork->len > 0)
+	    {
+	      /*
+	       * No memory to grow the buffer and the held data must go
+	       * first.  Throttle until the deadline flush releases it.
+	       */
+	      InterlockedExchange (&sock->throttled, 1) ;
+	      ret = 0 ;
+	    }
+	  else
+	    ret = socket_send (sock, buf, len) ;
+	}
+      ofc_handle_unlock (hSocket) ;
+    }
+  return (ret) ;
+}
+
+/*
+ * Cork or uncork a stream socket
+ *
+ * While corked, sends smaller than OFC_SOCKET_CORK_THRESHOLD are held in
+ * a per socket buffer.  The buffer is flushed when it passes the
+ * threshold, when the socket is uncorked, or OFC_SOCKET_CORK_DEADLINE
+ * milliseconds after the first byte was held.
+ *
+ * Accepts:
+ *    hSocket - socket to cork
+ *    onoff - OFC_TRUE to cork, OFC_FALSE to uncork
+ *
+ * Returns:
+ *    OFC_FALSE if the buffer could not be allocated or a flush failed
+ */
+OFC_BOOL ofc_socket_win32_cork(OFC_HANDLE hSocket, OFC_BOOL onoff)
+{
+  OFC_SOCKET_IMPL *sock ;
+  OFC_BOOL ret ;
+
+  ret = OFC_FALSE ;
+  sock = ofc_handle_lock (hSocket) ;
+  if (sock != OFC_NULL)
+    {
+      if (onoff == OFC_TRUE && sock->cork == OFC_NULL &&
+	  ofc_sockmem_charge (sizeof (SOCKET_CORK), sock->priority))
+	{
+	  sock->cork = ofc_malloc (sizeof (SOCKET_CORK)) ;
+	  if (sock->cork != OFC_NULL)
+	    {
+	      sock->cork->len = 0 ;
+	      sock->cork->size = 0 ;
+	      sock->cork->buf = OFC_NULL ;
+	    }
+	  else
+	    ofc_sockmem_release (sizeof (SOCKET_CORK)) ;
+	}
+
+      if (sock->cork != OFC_NULL)
+	{
+	  sock->cork->corked = onoff ;
+	  ret = OFC_TRUE ;
+	  /*
+	   * Anything that would block goes out with the next send or
+	   * from ofc_socket_win32_service.
+	   */
+	  if (onoff == OFC_FALSE && socket_cork_flush (sock) < 0)
+	    ret = OFC_FALSE ;
+	}
+      ofc_handle_unlock (hSocket) ;
+    }
+  return (ret) ;
+}
+
+/*
+ * Size the send buffer from the connection's statistics.  The target is
+ * the stack's ideal send backlog, or two congestion windows when that is
+ * not available, kept within the configured bounds.  Small changes are
+ * ignored so the buffer does not chase noise.
+ *
+ * The send window is twice the bandwidth delay product: the bytes
+ * delivered over the last interval, less retransmissions, per
+ * millisecond times the round trip time.  The headroom lets the rate
+ * grow when the upper layer, not the network, was the limit.  Before
+ * there is a rate, the congestion window stands in for it.
+ */
+static OFC_VOID socket_autotune(OFC_SOCKET_IMPL *sock)
+{
+  SOCKET_TUNE *tune ;
+  TCP_INFO_v0 info ;
+  DWORD version ;
+  ULONG backlog ;
+  DWORD bytes ;
+  OFC_INT target ;
+  OFC_INT delta ;
+  OFC_MSTIME now ;
+  OFC_MSTIME elapsed ;
+  OFC_UINT64 delivered ;
+  OFC_SIZET window ;
+  OFC_SIZET charged ;
+
+  tune = sock->tune ;
+  now = ofc_time_get_now () ;
+  version = 0 ;
+  if (WSAIoctl (sock->socket, SIO_TCP_INFO, &version, sizeof (version),
+		&info, sizeof (info), &bytes, NULL, NULL) != 0)
+    ofc_memset (&info, '\0', sizeof (info)) ;
+  if (WSAIoctl (sock->socket, SIO_IDEAL_SEND_BACKLOG_QUERY, NULL, 0,
+		&backlog, sizeof (backlog), &bytes, NULL, NULL) != 0)
+    backlog = 0 ;
+
+  target = (OFC_INT) backlog ;
+  if (target == 0)
+    target = (OFC_INT) info.Cwnd * 2 ;
+
+  if (target > 0)
+    {
+      target = OFC_MAX (target, OFC_SOCKET_AUTOTUNE_MIN) ;
+      target = OFC_MIN (target, OFC_SOCKET_AUTOTUNE_MAX) ;
+
+      delta = target - tune->sndbuf ;
+      if (delta < 0)
+	delta = -delta ;
+      charged = sock->mem_sndbuf ;
+      if (delta > tune->sndbuf / 8 &&
+	  socket_mem_resize (sock, &sock->mem_sndbuf, target, sock->priority))
+	{
+	  if (setsockopt (sock->socket, SOL_SOCKET, SO_SNDBUF,
+			  (const char *) &target, sizeof (target)) == 0)
+	    {
+	      ofc_log (OFC_LOG_DEBUG,
+		       "Socket %d send buffer %d -> %d (rtt %u us, cwnd %u, "
+		       "in flight %u, ideal backlog %u)\n",
+		       (OFC_INT) sock->socket, tune->sndbuf, target,
+		       info.RttUs, info.Cwnd, info.BytesInFlight, backlog) ;
+	      tune->sndbuf = target ;
+	    }
+	  else
+	    /*
+	     * The charge stands only for a size the kernel took
+	     */
+	    socket_mem_resize (sock, &sock->mem_sndbuf, (OFC_INT) charged,
+			       OFC_SOCKMEM_NORMAL) ;
+	}
+    }
+
+  window = (OFC_SIZET) info.Cwnd ;
+  elapsed = now - tune->sampled ;
+  if (tune->sampled != 0 && elapsed > 0 && info.RttUs > 0 &&
+      info.BytesOut >= tune->bytes_out && info.BytesRetrans >= tune->retrans)
+    {
+      delivered = info.BytesOut - tune->bytes_out ;
+      if (delivered > info.BytesRetrans - tune->retrans)
+	delivered -= info.BytesRetrans - tune->retrans ;
+      else
+	delivered = 0 ;
+      if (delivered > 0)
+	window = (OFC_SIZET) ((delivered * info.RttUs * 2) /
+			      ((OFC_UINT64) elapsed * 1000)) ;
+    }
+  tune->sampled = now ;
+  tune->bytes_out = info.BytesOut ;
+  tune->retrans = info.BytesRetrans ;
+
+  if (window > 0)
+    {
+      window = OFC_MAX (window, OFC_SOCKET_AUTOTUNE_MIN) ;
+      tune->window = OFC_MIN (window, (OFC_SIZET) tune->sndbuf) ;
+    }
+}
+
+/*
+ * Charge what the kernel holds unacknowledged.  A socket whose send
+ * buffer size is charged already is covered by that.
+ */
+static OFC_VOID socket_inflight_sample(OFC_SOCKET_IMPL *sock)
+{
+  TCP_INFO_v0 info ;
+  DWORD version ;
+  DWORD bytes ;
+  OFC_INT inflight ;
+
+  InterlockedExchange (&sock->tx_dirty, 0) ;
+  inflight = 0 ;
+  version = 0 ;
+  if (sock->mem_sndbuf == 0 &&
+      WSAIoctl (sock->socket, SIO_TCP_INFO, &version, sizeof (version),
+		&info, sizeof (info), &bytes, NULL, NULL) == 0)
+    inflight = (OFC_INT) info.BytesInFlight ;
+  socket_mem_resize (sock, &sock->mem_inflight, inflight,
+		     OFC_SOCKMEM_NORMAL) ;
+}
+
+/*
+ * Run a socket's deferred work, such as the flush of a corked buffer
+ * whose deadline has passed.
+ *
+ * Returns:
+ *    Milliseconds until the socket next needs service, or
+ *    OFC_MAX_SCHED_WAIT if nothing is outstanding
+ */
+OFC_MSTIME ofc_socket_win32_service(OFC_HANDLE hSocket)
+{
+  OFC_SOCKET_IMPL *sock ;
+  SOCKET_CORK *cork ;
+  OFC_MSTIME ret ;
+  OFC_MSTIME now ;
+
+  ret = OFC_MAX_SCHED_WAIT ;
+  sock = ofc_handle_lock (hSocket) ;
+  if (sock != OFC_NULL)
+    {
+      cork = sock->cork ;
+      if (cork != OFC_NULL && cork->len > 0)
+	{
+	  now = ofc_time_get_now () ;
+	  if (!cork->corked || (OFC_INT) (cork->deadline - now) <= 0)
+	    {
+	      /*
+	       * If the flush would block, try again a deadline later
+	       */
+	      if (socket_cork_flush (sock) == 0)
+		{
+		  cork->deadline = now + OFC_SOCKET_CORK_DEADLINE ;
+		  ret = OFC_SOCKET_CORK_DEADLINE ;
+		}
+	    }
+	  else
+	    ret = cork->deadline - now ;
+	}
+
+      if (sock->tx_dirty || sock->mem_inflight > 0)
+	{
+	  now = ofc_time_get_now () ;
+	  if ((OFC_INT) (sock->inflight_next - now) <= 0)
+	    {
+	      socket_inflight_sample (sock) ;
+	      sock->inflight_next = now + OFC_SOCKET_AUTOTUNE_INTERVAL ;
+	    }
+	  if (sock->tx_dirty || sock->mem_inflight > 0)
+	    ret = OFC_MIN (ret, sock->inflight_next - now) ;
+	}
+
+      if (sock->shard != OFC_NULL && sock->shard->accept == INVALID_SOCKET)
+	{
+	  now = ofc_time_get_now () ;
+	  if ((OFC_INT) (sock->shard->retry - now) > 0 ||
+	      !socket_shard_post (sock))
+	    ret = OFC_MIN (ret, sock->shard->retry - now) ;
+	}
+
+      if (sock->throttled)
+	{
+	  if (!ofc_sockmem_exhausted ())
+	    {
+	      InterlockedExchange (&sock->throttled, 0) ;
+	      InterlockedOr (&sock->pending, (LONG) OFC_SOCKET_EVENT_WRITE) ;
+	    }
+	  else
+	    ret = OFC_MIN (ret, OFC_SOCKET_MEMORY_RETRY) ;
+	}
+
+      if (sock->tune != OFC_NULL)
+	{
+	  now = ofc_time_get_now () ;
+	  if ((OFC_INT) (sock->tune->next - now) <= 0)
+	    {
+	      socket_autotune (sock) ;
+	      sock->tune->next = now + OFC_SOCKET_AUTOTUNE_INTERVAL ;
+	    }
+	  ret = OFC_MIN (ret, sock->tune->next - now) ;
+	}
+      ofc_handle_unlock (hSocket) ;
+    }
+  return (ret) ;
+}
+
+/*
+ * Report send calls made by the upper layer and the send system calls
+ * they turned into.  The difference is what coalescing saved.
+ */
+OFC_VOID ofc_socket_win32_send_stats(OFC_UINT32 *calls, OFC_UINT32 *syscalls)
+{
+  if (calls != OFC_NULL)
+    *calls = (OFC_UINT32) socket_send_calls ;
+  if (syscalls != OFC_NULL)
+    *syscalls = (OFC_UINT32) socket_send_syscalls ;
+}
+
+/*
+ * PSP_Send_To - Send Data on a datagram socket
+ *
+ * Accepts:
+ *    hSock - socket to write data on
+ *    buf - buffer to write
+ *    len - number of bytes to write
+ *    port - port number to write to (host order)
+ *    ip - ip to write to (host order)
+ *
+ * Returns:
+ *    Number of bytes written
+ */
+OFC_SIZET ofc_socket_impl_sendto(OFC_HANDLE hSocket, const OFC_VOID *buf,
+                                 OFC_SIZET len,
+                                 const OFC_IPADDR *ip,
+                                 OFC_UINT16 port)
+{
+  OFC_SOCKET_IMPL *sock ;
+  OFC_SIZET ret ;
+  int error ;
+
+  int status ;
+  struct sockaddr *mysockaddr;
+  socklen_t mysocklen ;
+
+  ret = -1 ;
+  sock = ofc_handle_lock (hSocket) ;
+  if (sock != OFC_NULL)
+    {
+      make_sockaddr (&mysockaddr, &mysocklen, ip, port) ;
+
+      status = sendto(sock->socket, (const char * ) buf, (int) len, 0,
+		      mysockaddr, mysocklen) ;
+
+      error = WSAGetLastError () ;
+      
+
+      if ((status == SOCKET_ERROR) && (WSAGetLastError() == WSAEWOULDBLOCK))
+	{
+	  InterlockedExchange (&sock->write_blocked, 1) ;
+	  InterlockedAnd (&sock->ready, ~(LONG) OFC_SOCKET_EVENT_WRITE) ;
+	  ret = 0 ;
+	}
+      else if (status != SOCKET_ERROR)
+	ret = status ;
+
+      ofc_free (mysockaddr) ;
+      ofc_handle_unlock (hSocket) ;
+    }
+
+  return (ret) ;
+}
+
+/*
+ * Receive and note when the data arrived.  With kernel timestamping the
+ * time comes from the SO_TIMESTAMP control message, otherwise it is
+ * when the data was first noticed.  Returns as recvfrom does.
+ */
+static int socket_recv_stamped(OFC_SOCKET_IMPL *sock, OFC_VOID *buf,
+                               OFC_SIZET len, struct sockaddr *from,
+                               socklen_t *fromlen)
+{
+  UINT64 control[(WSA_CMSG_SPACE (sizeof (UINT64)) + 7) / 8] ;
+  WSAMSG msg ;
+  WSABUF data ;
+  WSACMSGHDR *cmsg ;
+  DWORD bytes ;
+  int status ;
+
+  sock->rx_kernel = OFC_FALSE ;
+  if (sock->recvmsg != NULL)
+    {
+      data.buf = (char *) buf ;
+      data.len = (ULONG) len ;
+      msg.name = from ;
+      msg.namelen = from == OFC_NULL ? 0 : *fromlen ;
+      msg.lpBuffers = &data ;
+      msg.dwBufferCount = 1 ;
+      msg.Control.buf = (char *) control ;
+      msg.Control.len = sizeof (control) ;
+      msg.dwFlags = 0 ;
+
+      status = sock->recvmsg (sock->socket, &msg, &bytes, NULL, NULL) ;
+      if (status != SOCKET_ERROR)
+	{
+	  status = (int) bytes ;
+	  if (from != OFC_NULL)
+	    *fromlen = msg.namelen ;
+	  for (cmsg = WSA_CMSG_FIRSTHDR (&msg) ; cmsg != NULL ;
+	       cmsg = WSA_CMSG_NXTHDR (&msg, cmsg))
+	    {
+	      if (cmsg->cmsg_level == SOL_SOCKET &&
+		  cmsg->cmsg_type == SO_TIMESTAMP)
+		{
+		  ofc_memcpy (&sock->rx_stamp, WSA_CMSG_DATA (cmsg),
+			      sizeof (UINT64)) ;
+		  sock->rx_kernel = OFC_TRUE ;
+		}
+	    }
+	}
+    }
+  else if (from != OFC_NULL)
+    status = recvfrom (sock->socket, (char *) buf, (int) len, 0,
+		       from, fromlen) ;
+  else
+    status = recv (sock->socket, (char *) buf, (int) len, 0) ;
+
+  socket_ready_recv (sock, status) ;
+  if (!sock->rx_kernel)
+    socket_stamp_take (sock, status, len) ;
+  return (status) ;
+}
+
+/*
+ * PSP_Recv - Receive bytes from a socket
+ *
+ * Accepts:
+ *    hSock - Socket to read from
+ *    buf - pointer to buffer to store data
+ *    len - size of buffer
+ *
+ * Returns:
+ *    number of bytes read
+ */
+OFC_SIZET ofc_socket_impl_recv(OFC_HANDLE hSocket,
+                               OFC_VOID *buf,
+                               OFC_SIZET len)
+{
+  OFC_SOCKET_IMPL *sock ;
+  SOCKET_FRAME *frame ;
+  OFC_SIZET ret ;
+
+  int status ;
+
+  sock = ofc_handle_lock (hSocket) ;
+  if (sock != OFC_NULL)
+    {
+      frame = sock->frame ;
+      if (frame != OFC_NULL && frame->tail > frame->head + frame->consumed)
+	{
+	  /*
+	   * Data already read for framed receives goes first
+	   */
+	  frame->head += frame->consumed ;
+	  frame->consumed = 0 ;
+	  ret = OFC_MIN (len, frame->tail - frame->head) ;
+	  ofc_memcpy (buf, frame->buf + frame->head, ret) ;
+	  frame->head += ret ;
+	  if (sock->timestamps)
+	    {
+	      sock->rx_stamp = frame->stamp ;
+	      sock->rx_kernel = OFC_FALSE ;
+	    }
+	}
+      else
+	{
+	  if (sock->timestamps)
+	    status = socket_recv_stamped (sock, buf, len, OFC_NULL, OFC_NULL) ;
+	  else
+	    {
+	      status = recv (sock->socket, (char *) buf, (int) len, 0);
+	      socket_ready_recv (sock, status) ;
+	    }
+
+	  if ((status == SOCKET_ERROR) &&
+	      (WSAGetLastError() == WSAEWOULDBLOCK))
+	    ret = 0 ;
+	  else if (status != SOCKET_ERROR)
+	    ret = status ;
+	  else
+	    ret = WSAGetLastError() ;
+	}
+
+      ofc_handle_unlock (hSocket) ;
+    }
+
+  return(ret);
+}
+
+/*
+ * Receive into a buffer borrowed from the shared receive pool
+ *
+ * Accepts:
+ *    hSocket - Socket to read from
+ *    pbuf - Where to return the filled buffer
+ *
+ * Returns:
+ *    number of bytes read.  When non zero, the caller owns *pbuf and
+ *    must return it with ofc_bufpool_free.  Otherwise no buffer is held.
+ */
+OFC_SIZET ofc_socket_win32_recv_pooled(OFC_HANDLE hSocket, OFC_VOID **pbuf)
+{
+  OFC_SOCKET_IMPL *sock ;
+  OFC_SIZET ret ;
+  OFC_VOID *buf ;
+
+  int status ;
+
+  ret = -1 ;
+  *pbuf = OFC_NULL ;
+  sock = ofc_handle_lock (hSocket) ;
+  if (sock != OFC_NULL)
+    {
+      /*
+       * Don't tie up a pool buffer for a read that would block.  A
+       * failed FIONREAD leaves the count unknown, so the receive still
+       * goes ahead and reports the error.
+       */
+      if (socket_ready_bytes (sock) == 0 && sock->rx_known)
+	ret = 0 ;
+      else
+	{
+	  buf = ofc_bufpool_alloc () ;
+	  if (buf != OFC_NULL)
+	    {
+	      if (sock->timestamps)
+		status = socket_recv_stamped (sock, buf, ofc_bufpool_size (),
+					      OFC_NULL, OFC_NULL) ;
+	      else
+		{
+		  status = recv (sock->socket, (char *) buf,
+				 (int) ofc_bufpool_size (), 0) ;
+		  socket_ready_recv (sock, status) ;
+		}
+
+	      if (status > 0)
+		{
+		  *pbuf = buf ;
+		  ret = status ;
+		}
+	      else
+		{
+		  /*
+		   * Fetch the error before the pool touches thread storage
+		   */
+		  if (status == 0 || WSAGetLastError() == WSAEWOULDBLOCK)
+		    ret = 0 ;
+		  ofc_bufpool_free (buf) ;
+		}
+	    }
+	}
+      ofc_handle_unlock (hSocket) ;
+    }
+
+  return (ret) ;
+}
+
+/*
+ * Receive one length prefixed message from a stream socket
+ *
+ * Messages carry the four byte NetBIOS session header: a type byte
+ * followed by a 24 bit big endian length.  The socket is read in large
+ * chunks into a per socket buffer, so one kernel read can yield any
+ * number of messages.
+ *
+ * Accepts:
+ *    hSocket - Socket to read from
+ *    msg - Receives a pointer to the message, header included.  It is
+ *          valid until the next receive on the socket.
+ *
+ * Returns:
+ *    Length of the message, 0 if no complete message is available yet,
+ *    or -1 if the connection failed or was closed
+ */
+OFC_SIZET ofc_socket_win32_recv_frame(OFC_HANDLE hSocket, OFC_VOID **msg)
+{
+  OFC_SOCKET_IMPL *sock ;
+  SOCKET_FRAME *frame ;
+  OFC_SIZET ret ;
+  OFC_SIZET need ;
+  OFC_UCHAR *p ;
+  OFC_CHAR *buf ;
+
+  int status ;
+
+  ret = -1 ;
+  *msg = OFC_NULL ;
+  sock = ofc_handle_lock (hSocket) ;
+  if (sock != OFC_NULL)
+    {
+      frame = sock->frame ;
+      if (frame == OFC_NULL)
+	{
+	  frame = ofc_malloc (sizeof (SOCKET_FRAME)) ;
+	  if (frame != OFC_NULL)
+	    {
+	      frame->buf = ofc_malloc (OFC_SOCKET_FRAME_BUFFER_SIZE) ;
+	      frame->size = OFC_SOCKET_FRAME_BUFFER_SIZE ;
+	      frame->head = 0 ;
+	      frame->tail = 0 ;
+	      frame->consumed = 0 ;
+	      frame->stamp = 0 ;
+	      if (frame->buf == OFC_NULL)
+		{
+		  ofc_free (frame) ;
+		  frame = OFC_NULL ;
+		}
+	      else
+		ofc_sockmem_charge (sizeof (SOCKET_FRAME) + frame->size,
+				    OFC_SOCKMEM_NORMAL) ;
+	    }
+	  sock->frame = frame ;
+	}
+
+      if (frame != OFC_NULL)
+	{
+	  /*
+	   * Release the message handed out last time
+	   */
+	  frame->head += frame->consumed ;
+	  frame->consumed = 0 ;
+	  if (frame->head == frame->tail)
+	    {
+	      frame->head = 0 ;
+	      frame->tail = 0 ;
+	    }
+
+	  ret = socket_frame_complete (frame) ;
+	  if (ret == 0)
+	    {
+	      /*
+	       * Make room for at least the rest of the message at the head
+	       */
+	      need = frame->size ;
+	      if (frame->tail - frame->head >= SOCKET_FRAME_HEADER)
+		{
+		  p = (OFC_UCHAR *) frame->buf + frame->head ;
+		  need = SOCKET_FRAME_HEADER +
+		    (((OFC_SIZET) p[1] << 16) | ((OFC_SIZET) p[2] << 8) | p[3]) ;
+		  need = OFC_MAX (need, frame->size) ;
+		}
+	      if (frame->head > 0 &&
+		  frame->size - frame->tail < need - (frame->tail - frame->head))
+		{
+		  MoveMemory (frame->buf, frame->buf + frame->head,
+			      frame->tail - frame->head) ;
+		  frame->tail -= frame->head ;
+		  frame->head = 0 ;
+		}
+	      if (need > frame->size)
+		{
+		  buf = ofc_realloc (frame->buf, need) ;
+		  if (buf != OFC_NULL)
+		    {
+		      ofc_sockmem_charge (need - frame->size,
+					  OFC_SOCKMEM_NORMAL) ;
+		      frame->buf = buf ;
+		      frame->size = need ;
+		    }
+		}
+
+	      if (frame->size > frame->tail)
+		{
+		  InterlockedIncrement (&socket_frame_syscalls) ;
+		  if (sock->timestamps)
+		    status = socket_recv_stamped (sock,
+						  frame->buf + frame->tail,
+						  frame->size - frame->tail,
+						  OFC_NULL, OFC_NULL) ;
+		  else
+		    {
+		      status = recv (sock->socket, frame->buf + frame->tail,
+				     (int) (frame->size - frame->tail), 0) ;
+		      socket_ready_recv (sock, status) ;
+		    }
+		  if (status > 0)
+		    {
+		      /*
+		       * The buffer's stamp is that of its oldest data
+		       */
+		      if (frame->tail == frame->head)
+			frame->stamp = sock->rx_stamp ;
+		      frame->tail += status ;
+		      ret = socket_frame_complete (frame) ;
+		    }
+		  else if (status == SOCKET_ERROR &&
+			   WSAGetLastError() == WSAEWOULDBLOCK)
+		    ret = 0 ;
+		  else
+		    ret = -1 ;
+		}
+	      else
+		ret = -1 ;
+	    }
+
+	  if (ret != 0 && ret != (OFC_SIZET) -1)
+	    {
+	      InterlockedIncrement (&socket_frame_messages) ;
+	      *msg = frame->buf + frame->head ;
+	      frame->consumed = ret ;
+	      if (sock->timestamps)
+		{
+		  sock->rx_stamp = frame->stamp ;
+		  sock->rx_kernel = OFC_FALSE ;
+		}
+	    }
+	}
+      ofc_handle_unlock (hSocket) ;
+    }
+
+  return (ret) ;
+}
+
+/*
+ * Report kernel reads made for framed receives and the messages they
+ * produced
+ */
+OFC_VOID ofc_socket_win32_frame_stats(OFC_UINT32 *syscalls,
+                                      OFC_UINT32 *messages)
+{
+  if (syscalls != OFC_NULL)
+    *syscalls = (OFC_UINT32) socket_frame_syscalls ;
+  if (messages != OFC_NULL)
+    *messages = (OFC_UINT32) socket_frame_messages ;
+}
+
+OFC_BOOL ofc_socket_impl_peek (OFC_HANDLE hSocket)
+{
+  OFC_SOCKET_IMPL *sock ;
+  OFC_BOOL ret ;
+
+  ret = OFC_FALSE ;
+  sock = ofc_handle_lock (hSocket) ;
+  if (sock != OFC_NULL)
+    {
+      if (sock->frame != OFC_NULL &&
+	  sock->frame->tail > sock->frame->head + sock->frame->consumed)
 	ret = OFC_TRUE ;
-      ofc_handle_unlock(hSocket) ;
+      /*
+       * The byte count answers without copying any data, and not at all
+       * while the cached count is current and non zero
+       */
+      else if (socket_ready_bytes (sock) > 0)
+	ret = OFC_TRUE ;
+
+      ofc_handle_unlock (hSocket) ;
     }
 
   return(ret);
 }
 
 /*
- * PSP_Connect - Connect to a remote ip and port
+ * Check a connection at rest without consuming its events
  *
  * Accepts:
- *    hSock - Handle of socket to connect
- *    ip - 32 bit ip in host order
- *    port - 16 bit port in host order
+ *    hSocket - Socket to check
  *
  * Returns:
- *    status (STATE_SUCCESS or STATE_FAIL)
+ *    OFC_TRUE if no data is waiting, the peer has not closed the
+ *    connection and it has not failed
  */
-OFC_BOOL ofc_socket_impl_connect(OFC_HANDLE hSocket,
-                                 const OFC_IPADDR *ip, OFC_UINT16 port)
+OFC_BOOL ofc_socket_win32_quiet(OFC_HANDLE hSocket)
+{
+  OFC_SOCKET_IMPL *sock ;
+  OFC_BOOL ret ;
+  OFC_CHAR c ;
+
+  int status ;
+
+  ret = OFC_FALSE ;
+  sock = ofc_handle_lock (hSocket) ;
+  if (sock != OFC_NULL)
+    {
+      /*
+       * A peeking receive answers all three without touching the
+       * events recorded for the socket.  It returns 0 once the peer
+       * has closed.
+       */
+      if (sock->frame == OFC_NULL ||
+	  sock->frame->tail == sock->frame->head + sock->frame->consumed)
+	{
+	  status = recv (sock->socket, &c, 1, MSG_PEEK) ;
+	  if (status == SOCKET_ERROR && WSAGetLastError () == WSAEWOULDBLOCK)
+	    ret = OFC_TRUE ;
+	}
+      ofc_handle_unlock (hSocket) ;
+    }
+  return (ret) ;
+}
+
+/*
+ * PSP_Recv_From - Receive bytes from socket, return ip address
+ *
+ * Accepts:
+ *    hSock - socket to read from
+ *    buf - where to read data to
+ *    len - size of buffer
+ *    port - pointer to where to store the port (stored in host order)
+ *    ip - Pointer to where to store the ip (stored in host order)
+ *
+ * Returns:
+ *    number of bytes read
+ */
+OFC_SIZET ofc_socket_impl_recv_from(OFC_HANDLE hSocket,
+                                    OFC_VOID *buf,
+                                    OFC_SIZET len,
+                                    OFC_IPADDR *ip,
+                                    OFC_UINT16 *port)
+{
+  OFC_SOCKET_IMPL *sock ;
+  OFC_SIZET ret ;
+
+  struct sockaddr *mysockaddr;
+  socklen_t mysize ;
+  int status ;
+
+  sock = ofc_handle_lock (hSocket) ;
+  if (sock != OFC_NULL)
+    {
+      mysize = (OFC_MAX (sizeof (struct sockaddr_in6),
+			 sizeof (struct sockaddr_in))) ;
+
+      mysockaddr = ofc_malloc(mysize) ;
+      ofc_memset (mysockaddr, '\0', mysize) ;
+
+      if (sock->timestamps)
+	status = socket_recv_stamped (sock, buf, len, mysockaddr, &mysize) ;
+      else
+	{
+	  status = recvfrom(sock->socket, (char *) buf, (int) len, 0,
+			    mysockaddr, &mysize);
+	  socket_ready_recv (sock, status) ;
+	}
+
+      if ((status == SOCKET_ERROR) && (WSAGetLastError() == WSAEWOULDBLOCK))
+	ret = 0 ;
+      else if (status != SOCKET_ERROR)
+	{
+	  unmake_sockaddr (mysockaddr, ip, port) ;
+	  ret = status ;
+	}
+      else
+	{
+	  ret = -1 ;
+	}
+
+      ofc_free (mysockaddr) ;
+      ofc_handle_unlock (hSocket) ;
+    }
+  return(ret) ;
+}
+
+HANDLE ofc_socket_get_win32_handle (OFC_HANDLE hSocket) 
+{
+  OFC_SOCKET_IMPL *pSocket ;
+  HANDLE handle ;
+
+  handle = INVALID_HANDLE_VALUE ;
+  pSocket = ofc_handle_lock (hSocket) ;
+  if (pSocket != OFC_NULL)
+    {
+      if (pSocket->connect_ex != OFC_NULL)
+	handle = pSocket->connect_ex->overlapped.hEvent ;
+      else if (pSocket->shard != OFC_NULL)
+	handle = pSocket->shard->overlapped.hEvent ;
+      else if (pSocket->group != OFC_NULL)
+	handle = pSocket->group->hEvent ;
+      else
+	handle = pSocket->hEvent ;
+      ofc_handle_unlock (hSocket) ;
+    }
+  return (handle) ;
+}
+
+OFC_SOCKET_EVENT_TYPE ofc_socket_impl_test(OFC_HANDLE hSocket)
+{
+  OFC_SOCKET_IMPL *pSocket ;
+  WSANETWORKEVENTS NetworkEvents;
+  OFC_SOCKET_EVENT_TYPE TestEvents ;
+
+  TestEvents = 0 ;
+
+  pSocket = ofc_handle_lock (hSocket) ;
+  if (pSocket != OFC_NULL)
+    {
+      /*
+       * Events found by a group sweep have already been enumerated.
+       * Grouped sockets must not reset the shared event.
+       */
+      TestEvents = (OFC_SOCKET_EVENT_TYPE)
+	InterlockedExchange (&pSocket->pending, 0) ;
+      TestEvents |= socket_connect_ex_test (pSocket) ;
+      if (pSocket->frame != OFC_NULL &&
+	  socket_frame_complete (pSocket->frame) > 0)
+	TestEvents |= OFC_SOCKET_EVENT_READ ;
+
+      if (pSocket->shard != OFC_NULL)
+	{
+	  /*
+	   * A shard reports only its own AcceptEx
+	   */
+	  if (pSocket->shard->accept != INVALID_SOCKET &&
+	      HasOverlappedIoCompleted (&pSocket->shard->overlapped))
+	    TestEvents |= OFC_SOCKET_EVENT_ACCEPT ;
+	}
+#if defined(OFC_SOCKET_WSAPOLL)
+      /*
+       * Grouped sockets report from the last poll of their group
+       */
+      else if (pSocket->group == OFC_NULL &&
+	       WSAEnumNetworkEvents(pSocket->socket, pSocket->hEvent,
+				    &NetworkEvents) == 0)
+	TestEvents |= socket_events (NetworkEvents.lNetworkEvents) ;
+#else
+      else if (WSAEnumNetworkEvents(pSocket->socket,
+				    pSocket->group == OFC_NULL ?
+				    pSocket->hEvent : NULL,
+				    &NetworkEvents) == 0)
+	TestEvents |= socket_events (NetworkEvents.lNetworkEvents) ;
+#endif
+      socket_ready_note (pSocket, TestEvents) ;
+      /*
+       * Data or a close on an idle socket brings it back to full service
+       */
+      if (pSocket->idle &&
+	  (TestEvents & (OFC_SOCKET_EVENT_READ | OFC_SOCKET_EVENT_CLOSE)))
+	socket_idle_exit (pSocket) ;
+
+      ofc_handle_unlock (hSocket) ;
+    }
+  
+  return (TestEvents) ;
+}
+
+OFC_BOOL ofc_socket_impl_enable(OFC_HANDLE hSocket,
+                                OFC_SOCKET_EVENT_TYPE type)
+{
+  OFC_SOCKET_IMPL *pSocket ;
+  long NetworkEvents;
+  OFC_BOOL ret ;
+
+  ret = OFC_FALSE ;
+  pSocket = ofc_handle_lock (hSocket) ;
+  if (pSocket != OFC_NULL)
+    {
+      NetworkEvents = 0 ;
+      ret = OFC_TRUE ;
+      if (type & OFC_SOCKET_EVENT_CLOSE)
+	NetworkEvents |= FD_CLOSE ;
+      if (type & OFC_SOCKET_EVENT_ACCEPT)
+	NetworkEvents |= FD_ACCEPT ;
+      if (type & OFC_SOCKET_EVENT_ADDRESSCHANGE)
+	NetworkEvents |= FD_ADDRESS_LIST_CHANGE ;
+      if (type & OFC_SOCKET_EVENT_QOS)
+	NetworkEvents |= FD_QOS ;
+      if (type & OFC_SOCKET_EVENT_QOB)
+	NetworkEvents |= FD_OOB ;
+      if (type & OFC_SOCKET_EVENT_READ)
+	NetworkEvents |= FD_READ ;
+      if (type & OFC_SOCKET_EVENT_WRITE)
+	NetworkEvents |= FD_WRITE ;
+
+      pSocket->mask = NetworkEvents ;
+      /*
+       * A shard's listening socket is selected by its primary
+       */
+      if (pSocket->shard == OFC_NULL)
+	socket_select (pSocket) ;
+      ofc_handle_unlock (hSocket) ;
+    }
+  
+  return (ret) ;
+}
+
+OFC_VOID ofc_socket_impl_set_send_size(OFC_HANDLE hSocket, OFC_INT size)
+{
+  OFC_SOCKET_IMPL *sock ;
+  OFC_SIZET charged ;
+
+  sock = ofc_handle_lock (hSocket) ;
+  if (sock != OFC_NULL)
+    {
+      charged = sock->mem_sndbuf ;
+      if (socket_mem_resize (sock, &sock->mem_sndbuf, size, sock->priority))
+	{
+	  if (setsockopt(sock->socket, SOL_SOCKET, SO_SNDBUF,
+			 (const char *) &size, sizeof(size)) == 0)
+	    {
+	      /*
+	       * The tuner starts from the size asked for
+	       */
+	      if (sock->tune != OFC_NULL)
+		sock->tune->sndbuf = size ;
+	    }
+	  else
+	    socket_mem_resize (sock, &sock->mem_sndbuf, (OFC_INT) charged,
+			       OFC_SOCKMEM_NORMAL) ;
+	}
+      ofc_handle_unlock (hSocket) ;
+    }
+}
+  
+OFC_VOID ofc_socket_impl_set_recv_size(OFC_HANDLE hSocket, OFC_INT size)
+{
+  OFC_SOCKET_IMPL *sock ;
+  OFC_SIZET charged ;
+
+  sock = ofc_handle_lock (hSocket) ;
+  if (sock != OFC_NULL)
+    {
+      charged = sock->mem_rcvbuf ;
+      if (socket_mem_resize (sock, &sock->mem_rcvbuf, size,
+			     OFC_SOCKMEM_NORMAL) &&
+	  setsockopt(sock->socket, SOL_SOCKET, SO_RCVBUF,
+		     (const char *) &size, sizeof(size)) != 0)
+	socket_mem_resize (sock, &sock->mem_rcvbuf, (OFC_INT) charged,
+			   OFC_SOCKMEM_NORMAL) ;
+      ofc_handle_unlock (hSocket) ;
+    }
+}
+  
+OFC_BOOL ofc_socket_impl_get_addresses(OFC_HANDLE hSock,
+                                       OFC_SOCKADDR *local,
+                                       OFC_SOCKADDR *remote)
+{
+  OFC_SOCKET_IMPL *sock ;
+  OFC_BOOL ret ;
+  int win32_status ;
+  struct sockaddr *local_sockaddr;
+  struct sockaddr *remote_sockaddr;
+  socklen_t local_sockaddr_size;
+  socklen_t remote_sockaddr_size;
+
+  ret = OFC_FALSE ;
+  sock = ofc_handle_lock (hSock) ;
+  if (sock != OFC_NULL)
+    {
+      local_sockaddr_size = (OFC_MAX (sizeof (struct sockaddr_in6),
+				      sizeof (struct sockaddr_in))) ;
+      local_sockaddr = ofc_malloc (local_sockaddr_size) ;
+
+      win32_status = getsockname (sock->socket, local_sockaddr,
+				  &local_sockaddr_size) ;
+      if (win32_status == 0)
+	{
+	  if (local_sockaddr->sa_family == AF_INET)
+	    local->sin_family = OFC_FAMILY_IP ;
+	  else
+	    local->sin_family = OFC_FAMILY_IPV6 ;
+	  unmake_sockaddr (local_sockaddr, 
+			   &local->sin_addr, &local->sin_port) ;
+
+	  remote_sockaddr_size = (OFC_MAX (sizeof (struct sockaddr_in6),
+					   sizeof (struct sockaddr_in))) ;
+	  remote_sockaddr = ofc_malloc (remote_sockaddr_size) ;
+
+	  win32_status = getpeername (sock->socket, 
+				      remote_sockaddr,
+				      &remote_sockaddr_size) ;
+	  if (win32_status == 0)
+	    {
+	      if (remote_sockaddr->sa_family == AF_INET)
+		remote->sin_family = OFC_FAMILY_IP ;
+	      else
+		remote->sin_family = OFC_FAMILY_IPV6 ;
+	      unmake_sockaddr (remote_sockaddr, &remote->sin_addr, 
+			       &remote->sin_port) ;
+	      ret = OFC_TRUE ;
+	    }
+	  ofc_free (remote_sockaddr) ;
+	}
+      ofc_free (local_sockaddr) ;
+      ofc_handle_unlock (hSock) ;
+    }
+  return (ret) ;
+}
+
+OFC_SOCKET_GROUP *ofc_socket_win32_group_create(OFC_VOID)
+{
+  return (socket_group_alloc (OFC_FALSE)) ;
+}
+
+OFC_BOOL ofc_socket_win32_group_destroy(OFC_SOCKET_GROUP *group)
+{
+  OFC_BOOL ret ;
+
+  ret = OFC_FALSE ;
+  ofc_lock (group->lock) ;
+  if (group->count == 0)
+    ret = OFC_TRUE ;
+  ofc_unlock (group->lock) ;
+
+  if (ret == OFC_TRUE)
+    {
+      CloseHandle (group->hEvent) ;
+      ofc_lock_destroy (group->lock) ;
+      ofc_free (group->members) ;
+#if defined(OFC_SOCKET_WSAPOLL)
+      ofc_free (group->fds) ;
+#endif
+      ofc_free (group) ;
+    }
+  return (ret) ;
+}
+
+OFC_BOOL ofc_socket_win32_group_join(OFC_SOCKET_GROUP *group,
+                                     OFC_HANDLE hSocket)
 {
   OFC_SOCKET_IMPL *sock ;
   OFC_BOOL ret ;
 
-  int status ;
-  struct sockaddr *mysockaddr;
-  socklen_t mysocklen ;
-
   ret = OFC_FALSE ;
-  sock = ofc_handle_lock(hSocket) ;
+  sock = ofc_handle_lock (hSocket) ;
   if (sock != OFC_NULL)
     {
-      make_sockaddr (&mysockaddr, &mysocklen, ip, port) ;
-
-      status = connect(sock->socket, mysockaddr, mysocklen) ;
-
-      if (((status == SOCKET_ERROR) && 
-	   (WSAGetLastError() == WSAEWOULDBLOCK)) ||
-	  (status != SOCKET_ERROR))
+      if (sock->group == group)
 	ret = OFC_TRUE ;
-      ofc_free(mysockaddr) ;
-
-      ofc_handle_unlock(hSocket) ;
+      else if (sock->group == OFC_NULL && sock->connect_ex == OFC_NULL &&
+	       sock->shard == OFC_NULL)
+	/*
+	 * A socket with a ConnectEx outstanding is waited on through the
+	 * overlapped event and joins once the connect completes.  Listener
+	 * shards are always waited on through their AcceptEx event.
+	 */
+	ret = socket_group_attach (group, sock) ;
+      ofc_handle_unlock (hSocket) ;
     }
-
   return (ret) ;
 }
 
-/*
- * PSP_Listen - Listen for a connection from remote
- *
- * Accepts:
- *    hSock - Handle of Socket to set to listen
- *    backlog - Number of simultaneous open connections to accept
- *
- * Returns:
- *    status (STATE_SUCCESS or STATE_FAIL)
- */
-OFC_BOOL ofc_socket_impl_listen(OFC_HANDLE hSocket, OFC_INT backlog)
+OFC_VOID ofc_socket_win32_group_leave(OFC_HANDLE hSocket)
 {
   OFC_SOCKET_IMPL *sock ;
-  OFC_BOOL ret ;
-  int status ;
 
-  ret = OFC_FALSE ;
   sock = ofc_handle_lock (hSocket) ;
   if (sock != OFC_NULL)
     {
-      status = listen(sock->socket, (int) backlog) ;
-      if (status != SOCKET_ERROR)
-	ret = OFC_TRUE ;
-
+      socket_group_detach (sock) ;
       ofc_handle_unlock (hSocket) ;
     }
-  return(ret);
 }
 
-/*
- * PSP_Accept - Accept a connection on socket
- * 
- * Accepts:
- *    sock - Pointer to socket structure of listening socket
- *    newsock - Pointer to new socket structure
- *
- * Returns:
- *    status (STATE_SUCCESS or STATE_FAIL)
- */
-OFC_HANDLE ofc_socket_impl_accept(OFC_HANDLE hSocket,
-                                  OFC_IPADDR *ip, OFC_UINT16 *port)
+OFC_SOCKET_GROUP *ofc_socket_win32_get_group(OFC_HANDLE hSocket)
 {
   OFC_SOCKET_IMPL *sock ;
-  OFC_SOCKET_IMPL *newsock ;
-  OFC_HANDLE hNewSock ;
-
-  socklen_t addrlen;
-  struct sockaddr *mysockaddr;	
+  OFC_SOCKET_GROUP *group ;
 
-  hNewSock = OFC_HANDLE_NULL ;
+  group = OFC_NULL ;
   sock = ofc_handle_lock (hSocket) ;
   if (sock != OFC_NULL)
     {
-      newsock = ofc_malloc (sizeof (OFC_SOCKET_IMPL)) ;
-
-      addrlen = (OFC_MAX (sizeof (struct sockaddr_in6),
-			  sizeof (struct sockaddr_in))) ;
+      group = sock->group ;
+      ofc_handle_unlock (hSocket) ;
+    }
+  return (group) ;
+}
 
-      mysockaddr = ofc_malloc (addrlen) ;
+HANDLE ofc_socket_win32_group_event(OFC_SOCKET_GROUP *group)
+{
+  return (group->hEvent) ;
+}
 
-      newsock->socket = accept(sock->socket, mysockaddr, &addrlen);
+OFC_INT ofc_socket_win32_group_count(OFC_SOCKET_GROUP *group)
+{
+  OFC_INT count ;
 
-      if (newsock->socket != INVALID_SOCKET)
-	{
-	  newsock->hEvent = CreateEvent (NULL, FALSE, FALSE, NULL) ;
-	  WSAEventSelect (newsock->socket, newsock->hEvent,
-			  FD_ACCEPT | FD_READ | FD_WRITE | 
-			  FD_CONNECT | FD_CLOSE) ;
+  ofc_lock (group->lock) ;
+  count = group->count ;
+  ofc_unlock (group->lock) ;
+  return (count) ;
+}
 
-	  unmake_sockaddr (mysockaddr, ip, port) ;
+OFC_INT ofc_socket_win32_group_sweep(OFC_SOCKET_GROUP *group)
+{
+#if !defined(OFC_SOCKET_WSAPOLL)
+  OFC_SOCKET_IMPL *sock ;
+  WSANETWORKEVENTS NetworkEvents ;
+#endif
+  OFC_SOCKET_EVENT_TYPE events ;
+  OFC_INT ready ;
+  OFC_INT i ;
 
-	  hNewSock = ofc_handle_create (OFC_HANDLE_SOCKET_IMPL, newsock) ;
+  ready = 0 ;
+  ofc_lock (group->lock) ;
+#if defined(OFC_SOCKET_WSAPOLL)
+  /*
+   * One WSAPoll covers every member.  Only the poll array's requested
+   * events are refreshed, the array itself persists across sweeps.
+   */
+  for (i = 0 ; i < group->count ; i++)
+    {
+      group->fds[i].events = socket_poll_events (group->members[i]) ;
+      group->fds[i].revents = 0 ;
+    }
+  if (group->count > 0 && WSAPoll (group->fds, group->count, 0) > 0)
+    {
+      for (i = 0 ; i < group->count ; i++)
+	{
+	  if (group->fds[i].revents != 0)
+	    {
+	      events = socket_poll_results (group->members[i],
+					    group->fds[i].revents) ;
+	      InterlockedOr (&group->members[i]->pending, (LONG) events) ;
+	      if (events & OFC_SOCKET_EVENT_READ)
+		socket_stamp_seen (group->members[i]) ;
+	    }
 	}
-      else
+    }
+  for (i = 0 ; i < group->count ; i++)
+    {
+      if (group->members[i]->pending != 0)
+	ready++ ;
+    }
+#else
+  /*
+   * Reset before enumerating so a notification racing with the sweep
+   * leaves the event set.  This matters only for manual reset events.
+   */
+  ResetEvent (group->hEvent) ;
+  for (i = 0 ; i < group->count ; i++)
+    {
+      sock = group->members[i] ;
+      if (WSAEnumNetworkEvents (sock->socket, NULL, &NetworkEvents) == 0 &&
+	  NetworkEvents.lNetworkEvents != 0)
 	{
-	  ofc_free (newsock) ;
+	  events = socket_events (NetworkEvents.lNetworkEvents) ;
+	  InterlockedOr (&sock->pending, (LONG) events) ;
+	  if (events & OFC_SOCKET_EVENT_READ)
+	    socket_stamp_seen (sock) ;
 	}
-      ofc_free(mysockaddr) ;
-
-      ofc_handle_unlock(hSocket) ;
+      if (sock->pending != 0)
+	ready++ ;
     }
-  return (hNewSock) ;
+  /*
+   * Members left pending may belong to another wait set sharing the
+   * group.  Keep a shared event set until every one has been claimed
+   * so that wait set wakes too.
+   */
+  if (group->manual && ready > 0)
+    SetEvent (group->hEvent) ;
+#endif
+  ofc_unlock (group->lock) ;
+
+  return (ready) ;
 }
 
-/*
- * PSP_Reuseaddr - Clean up socket so we use it again
- * 
- * Accepts:
- *    hSock - Socket to set the port reuseable on
- *    onoff - TRUE for on, FALSE for off
- */
-OFC_BOOL ofc_socket_impl_reuse_addr(OFC_HANDLE hSocket, OFC_BOOL onoff)
+OFC_SOCKET_EVENT_TYPE ofc_socket_win32_pending(OFC_HANDLE hSocket)
 {
   OFC_SOCKET_IMPL *sock ;
-  OFC_BOOL ret ;
-
-  int status ;
-  BOOL on;
+  OFC_SOCKET_EVENT_TYPE ret ;
 
-  ret = OFC_FALSE ;
-  sock = ofc_handle_lock(hSocket) ;
+  ret = 0 ;
+  sock = ofc_handle_lock (hSocket) ;
   if (sock != OFC_NULL)
     {
-      on = (onoff == OFC_TRUE ? TRUE : FALSE) ;
-      status = setsockopt(sock->socket, SOL_SOCKET, SO_REUSEADDR, 
-			  (const char *) &on, sizeof(on));
-      if (status != SOCKET_ERROR)
-	ret = OFC_TRUE ;
+      ret = (OFC_SOCKET_EVENT_TYPE) sock->pending ;
+      /*
+       * A complete message already read for a framed receive will not
+       * signal the socket's event again
+       */
+      if (sock->frame != OFC_NULL && socket_frame_complete (sock->frame) > 0)
+	ret |= OFC_SOCKET_EVENT_READ ;
       ofc_handle_unlock (hSocket) ;
     }
   return (ret) ;
 }
 
 /*
- * PSP_Is_Connected - Test if the socket is connected or not
- *
- * Accepts:
- *     hSock - Socket to test for
- *
- * Returns:
- *   True if connected, false otherwise
+ * Bytes of user space memory a socket holds
  */
-OFC_BOOL ofc_socket_impl_connected(OFC_HANDLE hSocket)
+static OFC_SIZET socket_footprint(OFC_SOCKET_IMPL *sock)
 {
-  OFC_SOCKET_IMPL *sock ;
-  OFC_BOOL ret ;
-
-  int status ;
-  int *namelenp;
-  int len ;
-  struct sockaddr sa;
+  OFC_SIZET ret ;
 
-  ret = OFC_FALSE ;
-  sock = ofc_handle_lock (hSocket) ;
-  if (sock != OFC_NULL)
+  ret = sizeof (OFC_SOCKET_IMPL) ;
+  if (sock->frame != OFC_NULL)
+    ret += sizeof (SOCKET_FRAME) + sock->frame->size ;
+  if (sock->cork != OFC_NULL)
+    ret += sizeof (SOCKET_CORK) + sock->cork->size ;
+  if (sock->connect_ex != OFC_NULL)
+    ret += sizeof (SOCKET_CONNECT_EX) ;
+  if (sock->group != OFC_NULL)
     {
-      len = sizeof(sa);
-      namelenp = &len ;
-      status = getpeername(sock->socket, &sa, namelenp);
-      if (status != SOCKET_ERROR)
-	ret = OFC_TRUE ;
-      ofc_handle_unlock (hSocket) ;
+      ret += sizeof (OFC_SOCKET_IMPL *) ;
+#if defined(OFC_SOCKET_WSAPOLL)
+      ret += sizeof (WSAPOLLFD) ;
+#endif
     }
-
   return (ret) ;
 }
 
 /*
- * PSP_NoBlock - Set socket block mode
- *
- * Accepts:
- *    hSock - Socket to set the function on 
- *    onoff - Whether setting blocking on or off
- *    option - The option for the command
- *
- * Returns:
- *    status - Success of failure
+ * Kernel handles a socket holds and the bytes its kernel buffers may
+ * hold.  The socket itself is one handle, on an AFD endpoint, and an
+ * event of its own is a second.
  */
-OFC_BOOL ofc_socket_impl_no_block(OFC_HANDLE hSocket, OFC_BOOL onoff)
+static OFC_SIZET socket_kernel_footprint(OFC_SOCKET_IMPL *sock,
+                                         OFC_INT *handles)
 {
-  OFC_SOCKET_IMPL *sock ;
-  OFC_BOOL ret ;
+  OFC_SIZET ret ;
+  int size ;
+  int len ;
 
-  int status ;
-  u_long cmd;
+  ret = 0 ;
+  *handles = 1 ;
+  if (sock->hEvent != NULL)
+    (*handles)++ ;
 
-  ret = OFC_FALSE ;
-  sock = ofc_handle_lock (hSocket) ;
-  if (sock != OFC_NULL)
-    {
-      cmd = (onoff == OFC_TRUE ? 1 : 0) ;
-      status = ioctlsocket (sock->socket, FIONBIO, &cmd) ;
-      if (status != SOCKET_ERROR)
-	ret = OFC_TRUE ;
-      ofc_handle_unlock (hSocket) ;
-    }
+  len = sizeof (size) ;
+  if (getsockopt (sock->socket, SOL_SOCKET, SO_RCVBUF, (char *) &size,
+		  &len) == 0)
+    ret += size ;
+  len = sizeof (size) ;
+  if (getsockopt (sock->socket, SOL_SOCKET, SO_SNDBUF, (char *) &size,
+		  &len) == 0)
+    ret += size ;
   return (ret) ;
 }
 
 /*
- * PSP_Send - Send data on a socket
+ * Put a connected socket in or out of idle mode.
+ *
+ * An idle socket gives up its framed receive buffer and an empty cork
+ * buffer, and is parked on the shared idle group so it owns no event.
+ * The first read or close event reported by ofc_socket_impl_test takes
+ * it out of idle mode.  Buffers are allocated again when next used.
  *
  * Accepts:
- *    hSock - Socket to send data on
- *    buf - Pointer to buffer to write
- *    len - Number of bytes to write
+ *    hSocket - Socket handle
+ *    onoff - OFC_TRUE to enter idle mode
  *
  * Returns:
- *    Number of bytes written
+ *    OFC_FALSE if the handle is not a socket or a connect is outstanding
  */
-OFC_SIZET ofc_socket_impl_send(OFC_HANDLE hSocket, const OFC_VOID *buf,
-                               OFC_SIZET len)
+OFC_BOOL ofc_socket_win32_idle(OFC_HANDLE hSocket, OFC_BOOL onoff)
 {
   OFC_SOCKET_IMPL *sock ;
-  OFC_SIZET ret ;
-
-  int status ;
+  SOCKET_FRAME *frame ;
+  OFC_BOOL ret ;
 
-  ret = -1 ;
+  ret = OFC_FALSE ;
   sock = ofc_handle_lock (hSocket) ;
   if (sock != OFC_NULL)
     {
-      status = send(sock->socket, (const char *) buf, (int) len, 0) ;
-      if ((status == SOCKET_ERROR) && (WSAGetLastError() == WSAEWOULDBLOCK))
-	ret = 0 ;
-      else if (status != SOCKET_ERROR)
-	ret = status ;
+      if (onoff == OFC_FALSE)
+	{
+	  socket_idle_exit (sock) ;
+	  ret = OFC_TRUE ;
+	}
+      else if (sock->idle)
+	ret = OFC_TRUE ;
+      else if (sock->connect_ex == OFC_NULL && sock->shard == OFC_NULL)
+	{
+	  /*
+	   * Only let go of buffers that hold nothing unread
+	   */
+	  frame = sock->frame ;
+	  if (frame != OFC_NULL && frame->tail - frame->head == frame->consumed)
+	    socket_frame_release (sock) ;
+	  if (sock->cork != OFC_NULL && !sock->cork->corked &&
+	      sock->cork->len == 0)
+	    socket_cork_release (sock) ;
+	  /*
+	   * With the WSAPoll backend the wait set already shares one
+	   * group across its sockets
+	   */
+	  if (sock->group == OFC_NULL && socket_idle_group != OFC_NULL)
+	    socket_group_attach (socket_idle_group, sock) ;
 
+	  sock->idle = OFC_TRUE ;
+	  sock->idle_bytes = socket_footprint (sock) ;
+	  sock->idle_kernel = socket_kernel_footprint (sock,
+						       &sock->idle_handles) ;
+	  InterlockedIncrement (&socket_idle_count) ;
+	  InterlockedExchangeAdd64 (&socket_idle_bytes,
+				    (LONG64) sock->idle_bytes) ;
+	  InterlockedExchangeAdd (&socket_idle_handles,
+				  (LONG) sock->idle_handles) ;
+	  InterlockedExchangeAdd64 (&socket_idle_kernel,
+				    (LONG64) sock->idle_kernel) ;
+	  ret = OFC_TRUE ;
+	}
       ofc_handle_unlock (hSocket) ;
     }
   return (ret) ;
 }
 
 /*
- * PSP_Send_To - Send Data on a datagram socket
+ * Report what the idle sockets hold between them
  *
  * Accepts:
- *    hSock - socket to write data on
- *    buf - buffer to write
- *    len - number of bytes to write
- *    port - port number to write to (host order)
- *    ip - ip to write to (host order)
+ *    count - Receives the number of idle sockets
+ *    bytes - Receives the user space bytes they hold
+ *    handles - Receives the kernel handles they hold
+ *    kernel - Receives the sum of their kernel buffer sizes
  *
- * Returns:
- *    Number of bytes written
+ * Any of them may be OFC_NULL.  Kernel buffer sizes are limits, the
+ * stack commits memory to them only as data is queued.
  */
-OFC_SIZET ofc_socket_impl_sendto(OFC_HANDLE hSocket, const OFC_VOID *buf,
-                                 OFC_SIZET len,
-                                 const OFC_IPADDR *ip,
-                                 OFC_UINT16 port)
+OFC_VOID ofc_socket_win32_idle_stats(OFC_INT *count, OFC_SIZET *bytes,
+                                     OFC_INT *handles, OFC_SIZET *kernel)
 {
-  OFC_SOCKET_IMPL *sock ;
-  OFC_SIZET ret ;
-  int error ;
-
-  int status ;
-  struct sockaddr *mysockaddr;
-  socklen_t mysocklen ;
-
-  ret = -1 ;
-  sock = ofc_handle_lock (hSocket) ;
-  if (sock != OFC_NULL)
-    {
-      make_sockaddr (&mysockaddr, &mysocklen, ip, port) ;
-
-      status = sendto(sock->socket, (const char * ) buf, (int) len, 0,
-		      mysockaddr, mysocklen) ;
-
-      error = WSAGetLastError () ;
-      
-
-      if ((status == SOCKET_ERROR) && (WSAGetLastError() == WSAEWOULDBLOCK))
-	ret = 0 ;
-      else if (status != SOCKET_ERROR)
-	ret = status ;
-
-      ofc_free (mysockaddr) ;
-      ofc_handle_unlock (hSocket) ;
-    }
-
-  return (ret) ;
+  if (count != OFC_NULL)
+    *count = (OFC_INT) socket_idle_count ;
+  if (bytes != OFC_NULL)
+    *bytes = (OFC_SIZET) socket_idle_bytes ;
+  if (handles != OFC_NULL)
+    *handles = (OFC_INT) socket_idle_handles ;
+  if (kernel != OFC_NULL)
+    *kernel = (OFC_SIZET) socket_idle_kernel ;
 }
 
 /*
- * PSP_Recv - Receive bytes from a socket
+ * Turn receive timestamps on or off.  Datagram sockets use kernel
+ * timestamps where the system supports SIO_TIMESTAMPING.  Other
+ * sockets, and older systems, are stamped in software when unread data
+ * is first noticed by a test, a group sweep or a byte count.
  *
  * Accepts:
- *    hSock - Socket to read from
- *    buf - pointer to buffer to store data
- *    len - size of buffer
+ *    hSocket - Socket handle
+ *    onoff - OFC_TRUE to timestamp receives
  *
  * Returns:
- *    number of bytes read
+ *    OFC_FALSE if the handle is not a socket
  */
-OFC_SIZET ofc_socket_impl_recv(OFC_HANDLE hSocket,
-                               OFC_VOID *buf,
-                               OFC_SIZET len)
+OFC_BOOL ofc_socket_win32_timestamps(OFC_HANDLE hSocket, OFC_BOOL onoff)
 {
   OFC_SOCKET_IMPL *sock ;
-  OFC_SIZET ret ;
-
-  int status ;
-
-  sock = ofc_handle_lock (hSocket) ;
-  if (sock != OFC_NULL)
-    {
-      status = recv (sock->socket, (char *) buf, (int) len, 0);
-
-      if ((status == SOCKET_ERROR) && (WSAGetLastError() == WSAEWOULDBLOCK))
-	ret = 0 ;
-      else if (status != SOCKET_ERROR)
-	ret = status ;
-      else
-	ret = WSAGetLastError() ;
+  OFC_BOOL ret ;
+  SOCKET_TIMESTAMPING config ;
+  GUID guidRecvMsg = WSAID_WSARECVMSG ;
+  LPFN_WSARECVMSG lpfnRecvMsg ;
+  DWORD bytes ;
 
+  ret = OFC_FALSE ;
+  sock = ofc_handle_lock (hSocket) ;
+  if (sock != OFC_NULL)
+    {
+      lpfnRecvMsg = NULL ;
+      config.Flags = onoff ? TIMESTAMPING_FLAG_RX : 0 ;
+      config.TxTimestampsBuffered = 0 ;
+      /*
+       * Only datagram sockets accept SIO_TIMESTAMPING
+       */
+      if (WSAIoctl (sock->socket, SIO_TIMESTAMPING,
+		    &config, sizeof (config), OFC_NULL, 0,
+		    &bytes, NULL, NULL) == 0 && onoff)
+	WSAIoctl (sock->socket, SIO_GET_EXTENSION_FUNCTION_POINTER,
+		  &guidRecvMsg, sizeof (guidRecvMsg),
+		  &lpfnRecvMsg, sizeof (lpfnRecvMsg),
+		  &bytes, NULL, NULL) ;
+
+      sock->timestamps = onoff ;
+      sock->recvmsg = lpfnRecvMsg ;
+      sock->rx_stamp = 0 ;
+      sock->rx_kernel = OFC_FALSE ;
+      sock->rx_seen = 0 ;
+      ret = OFC_TRUE ;
       ofc_handle_unlock (hSocket) ;
     }
-
-  return(ret);
+  return (ret) ;
 }
 
-OFC_BOOL ofc_socket_impl_peek (OFC_HANDLE hSocket)
+/*
+ * Timestamp of the last receive on a socket
+ *
+ * Accepts:
+ *    hSocket - Socket handle
+ *    stamp - Receives the timestamp in performance counter ticks
+ *    kernel - If not NULL, receives OFC_TRUE if the kernel took it
+ *
+ * Returns:
+ *    OFC_FALSE if timestamps are off or nothing has been received
+ */
+OFC_BOOL ofc_socket_win32_rx_timestamp(OFC_HANDLE hSocket,
+                                       OFC_UINT64 *stamp,
+                                       OFC_BOOL *kernel)
 {
   OFC_SOCKET_IMPL *sock ;
   OFC_BOOL ret ;
-  OFC_CHAR buf[100] ;
-
-  int status ;
 
   ret = OFC_FALSE ;
   sock = ofc_handle_lock (hSocket) ;
   if (sock != OFC_NULL)
     {
-      status = recv (sock->socket, (char *) buf, 100, MSG_PEEK);
-
-      if (status > 0)
-	ret = OFC_TRUE ;
-
+      if (sock->timestamps && sock->rx_stamp != 0)
+	{
+	  *stamp = sock->rx_stamp ;
+	  if (kernel != OFC_NULL)
+	    *kernel = sock->rx_kernel ;
+	  ret = OFC_TRUE ;
+	}
       ofc_handle_unlock (hSocket) ;
     }
+  return (ret) ;
+}
 
-  return(ret);
+/*
+ * Microseconds elapsed since a receive timestamp
+ */
+OFC_UINT64 ofc_socket_win32_timestamp_age(OFC_UINT64 stamp)
+{
+  LARGE_INTEGER now ;
+  LARGE_INTEGER freq ;
+  OFC_UINT64 ret ;
+
+  ret = 0 ;
+  QueryPerformanceCounter (&now) ;
+  QueryPerformanceFrequency (&freq) ;
+  if ((OFC_UINT64) now.QuadPart > stamp)
+    ret = (((OFC_UINT64) now.QuadPart - stamp) * 1000000) /
+      (OFC_UINT64) freq.QuadPart ;
+  return (ret) ;
 }
 
 /*
- * PSP_Recv_From - Receive bytes from socket, return ip address
+ * Turn send buffer autotuning on or off for a connected stream socket.
+ * While on, ofc_socket_win32_service resizes SO_SNDBUF every
+ * OFC_SOCKET_AUTOTUNE_INTERVAL milliseconds from SIO_TCP_INFO and
+ * SIO_IDEAL_SEND_BACKLOG_QUERY.
  *
  * Accepts:
- *    hSock - socket to read from
- *    buf - where to read data to
- *    len - size of buffer
- *    port - pointer to where to store the port (stored in host order)
- *    ip - Pointer to where to store the ip (stored in host order)
+ *    hSocket - Socket handle
+ *    onoff - OFC_TRUE to tune the socket
  *
  * Returns:
- *    number of bytes read
+ *    OFC_FALSE if the handle is not a socket or memory is exhausted
  */
-OFC_SIZET ofc_socket_impl_recv_from(OFC_HANDLE hSocket,
-                                    OFC_VOID *buf,
-                                    OFC_SIZET len,
-                                    OFC_IPADDR *ip,
-                                    OFC_UINT16 *port)
+OFC_BOOL ofc_socket_win32_autotune(OFC_HANDLE hSocket, OFC_BOOL onoff)
 {
   OFC_SOCKET_IMPL *sock ;
-  OFC_SIZET ret ;
-
-  struct sockaddr *mysockaddr;
-  socklen_t mysize ;
-  int status ;
+  OFC_BOOL ret ;
+  int size ;
+  int len ;
 
+  ret = OFC_FALSE ;
   sock = ofc_handle_lock (hSocket) ;
   if (sock != OFC_NULL)
     {
-      mysize = (OFC_MAX (sizeof (struct sockaddr_in6),
-			 sizeof (struct sockaddr_in))) ;
-
-      mysockaddr = ofc_malloc(mysize) ;
-      ofc_memset (mysockaddr, '\0', mysize) ;
-
-      status = recvfrom(sock->socket, (char *) buf, (int) len, 0,
-			mysockaddr, &mysize);
-
-      if ((status == SOCKET_ERROR) && (WSAGetLastError() == WSAEWOULDBLOCK))
-	ret = 0 ;
-      else if (status != SOCKET_ERROR)
+      if (onoff == OFC_FALSE)
 	{
-	  unmake_sockaddr (mysockaddr, ip, port) ;
-	  ret = status ;
+	  ofc_free (sock->tune) ;
+	  sock->tune = OFC_NULL ;
+	  ret = OFC_TRUE ;
 	}
+      else if (sock->tune != OFC_NULL)
+	ret = OFC_TRUE ;
       else
 	{
-	  ret = -1 ;
+	  sock->tune = ofc_malloc (sizeof (SOCKET_TUNE)) ;
+	  if (sock->tune != OFC_NULL)
+	    {
+	      len = sizeof (size) ;
+	      if (getsockopt (sock->socket, SOL_SOCKET, SO_SNDBUF,
+			      (char *) &size, &len) != 0)
+		size = 0 ;
+	      sock->tune->sndbuf = size ;
+	      sock->tune->window = size ;
+	      sock->tune->sampled = 0 ;
+	      sock->tune->bytes_out = 0 ;
+	      sock->tune->retrans = 0 ;
+	      /*
+	       * First look at the connection on the next service
+	       */
+	      sock->tune->next = ofc_time_get_now () ;
+	      ret = OFC_TRUE ;
+	    }
 	}
-
-      ofc_free (mysockaddr) ;
       ofc_handle_unlock (hSocket) ;
     }
-  return(ret) ;
+  return (ret) ;
 }
 
-HANDLE ofc_socket_get_win32_handle (OFC_HANDLE hSocket) 
+/*
+ * Bytes the upper layer should keep outstanding on a tuned socket, or
+ * zero if the socket is not being tuned
+ */
+OFC_SIZET ofc_socket_win32_send_window(OFC_HANDLE hSocket)
 {
-  OFC_SOCKET_IMPL *pSocket ;
-  HANDLE handle ;
+  OFC_SOCKET_IMPL *sock ;
+  OFC_SIZET ret ;
 
-  handle = INVALID_HANDLE_VALUE ;
-  pSocket = ofc_handle_lock (hSocket) ;
-  if (pSocket != OFC_NULL)
+  ret = 0 ;
+  sock = ofc_handle_lock (hSocket) ;
+  if (sock != OFC_NULL)
     {
-      handle = pSocket->hEvent ;
+      if (sock->tune != OFC_NULL)
+	ret = sock->tune->window ;
       ofc_handle_unlock (hSocket) ;
     }
-  return (handle) ;
+  return (ret) ;
 }
 
-OFC_SOCKET_EVENT_TYPE ofc_socket_impl_test(OFC_HANDLE hSocket)
+/*
+ * Open a listener shard on a listening stream socket.
+ *
+ * A shard is a socket handle of its own that accepts a share of the
+ * connections arriving on the listener.  Each scheduler thread opens a
+ * shard and waits on it, so accepts and the I/O that follows spread
+ * across threads without a hand-off.  The listener is set up as usual
+ * with ofc_socket_impl_reuse_addr, ofc_socket_impl_bind and
+ * ofc_socket_impl_listen.  Close the shards before the listener.
+ *
+ * Accepts:
+ *    hListen - Handle of the listening socket
+ *
+ * Returns:
+ *    Handle of the shard or OFC_HANDLE_NULL on failure
+ */
+OFC_HANDLE ofc_socket_win32_listen_shard(OFC_HANDLE hListen)
 {
-  OFC_SOCKET_IMPL *pSocket ;
-  WSANETWORKEVENTS NetworkEvents;
-  OFC_SOCKET_EVENT_TYPE TestEvents ;
-
-  TestEvents = 0 ;
+  OFC_SOCKET_IMPL *listener ;
+  OFC_SOCKET_IMPL *sock ;
+  SOCKET_SHARD *shard ;
+  OFC_HANDLE hSocket ;
+  GUID guidAcceptEx = WSAID_ACCEPTEX ;
+  GUID guidGetAcceptExSockaddrs = WSAID_GETACCEPTEXSOCKADDRS ;
+  DWORD bytes ;
 
-  pSocket = ofc_handle_lock (hSocket) ;
-  if (pSocket != OFC_NULL)
+  hSocket = OFC_HANDLE_NULL ;
+  listener = ofc_handle_lock (hListen) ;
+  if (listener != OFC_NULL)
     {
-      WSAEnumNetworkEvents(pSocket->socket,
-			   pSocket->hEvent,
-			   &NetworkEvents) ;
-
-      if (NetworkEvents.lNetworkEvents & FD_CLOSE)
-	TestEvents |= OFC_SOCKET_EVENT_CLOSE ;
-      if (NetworkEvents.lNetworkEvents & FD_ACCEPT)
-	TestEvents |= OFC_SOCKET_EVENT_ACCEPT ;
-      if (NetworkEvents.lNetworkEvents & FD_ADDRESS_LIST_CHANGE)
-	TestEvents |= OFC_SOCKET_EVENT_ADDRESSCHANGE ;
-      if (NetworkEvents.lNetworkEvents & FD_QOS)
-	TestEvents |= OFC_SOCKET_EVENT_QOS ;
-      if (NetworkEvents.lNetworkEvents & FD_OOB)
-	TestEvents |= OFC_SOCKET_EVENT_QOB ;
-      if (NetworkEvents.lNetworkEvents & FD_READ)
-	TestEvents |= OFC_SOCKET_EVENT_READ ;
-      if (NetworkEvents.lNetworkEvents & FD_WRITE)
-	TestEvents |= OFC_SOCKET_EVENT_WRITE ;
+      sock = OFC_NULL ;
+      shard = OFC_NULL ;
+      if (listener->listening && listener->shard == OFC_NULL)
+	shard = ofc_malloc (sizeof (SOCKET_SHARD)) ;
+      if (shard != OFC_NULL)
+	{
+	  ofc_memset (shard, '\0', sizeof (SOCKET_SHARD)) ;
+	  shard->accept = INVALID_SOCKET ;
+	  shard->hListen = OFC_HANDLE_NULL ;
+	  shard->overlapped.hEvent = CreateEvent (NULL, TRUE, FALSE, NULL) ;
+	  if (shard->overlapped.hEvent != NULL &&
+	      WSAIoctl (listener->socket, SIO_GET_EXTENSION_FUNCTION_POINTER,
+			&guidAcceptEx, sizeof (guidAcceptEx),
+			&shard->lpfnAcceptEx, sizeof (shard->lpfnAcceptEx),
+			&bytes, NULL, NULL) == 0 &&
+	      WSAIoctl (listener->socket, SIO_GET_EXTENSION_FUNCTION_POINTER,
+			&guidGetAcceptExSockaddrs,
+			sizeof (guidGetAcceptExSockaddrs),
+			&shard->lpfnGetAcceptExSockaddrs,
+			sizeof (shard->lpfnGetAcceptExSockaddrs),
+			&bytes, NULL, NULL) == 0)
+	    sock = ofc_malloc (sizeof (OFC_SOCKET_IMPL)) ;
+	}
 
-      ofc_handle_unlock (hSocket) ;
+      if (sock != OFC_NULL)
+	{
+	  sock->socket = listener->socket ;
+	  sock->family = listener->family ;
+	  sock->ip = listener->ip ;
+	  sock->hEvent = NULL ;
+	  socket_init_impl (sock, OFC_TRUE) ;
+	  sock->listening = OFC_TRUE ;
+	  sock->mask = FD_ACCEPT ;
+	  sock->shard = shard ;
+	  if (socket_shard_post (sock))
+	    {
+	      hSocket = ofc_handle_create (OFC_HANDLE_SOCKET_IMPL, sock) ;
+	      /*
+	       * Accepts are the shards' from now on
+	       */
+	      shard->hListen = hListen ;
+	      listener->shards++ ;
+	      socket_select (listener) ;
+	    }
+	  else
+	    {
+	      socket_shard_release (sock) ;
+	      ofc_free (sock) ;
+	    }
+	}
+      else if (shard != OFC_NULL)
+	{
+	  if (shard->overlapped.hEvent != NULL)
+	    CloseHandle (shard->overlapped.hEvent) ;
+	  ofc_free (shard) ;
+	}
+      ofc_handle_unlock (hListen) ;
     }
-  
-  return (TestEvents) ;
+  return (hSocket) ;
 }
 
-OFC_BOOL ofc_socket_impl_enable(OFC_HANDLE hSocket,
-                                OFC_SOCKET_EVENT_TYPE type)
+/*
+ * Cached readiness of a socket
+ *
+ * Accepts:
+ *    hSocket - Socket handle
+ *    bytes - If not NULL, receives the bytes that can be read now,
+ *            counting data already buffered for framed receives
+ *
+ * Returns:
+ *    The events enumerated on the socket and not yet consumed by a
+ *    receive, send or accept that would block, plus events found by a
+ *    group sweep that ofc_socket_impl_test has not reported yet
+ */
+OFC_SOCKET_EVENT_TYPE ofc_socket_win32_readiness(OFC_HANDLE hSocket,
+                                                 OFC_SIZET *bytes)
 {
-  OFC_SOCKET_IMPL *pSocket ;
-  long NetworkEvents;
-  OFC_BOOL ret ;
+  OFC_SOCKET_IMPL *sock ;
+  OFC_SOCKET_EVENT_TYPE ret ;
+  OFC_SIZET count ;
 
-  ret = OFC_FALSE ;
-  pSocket = ofc_handle_lock (hSocket) ;
-  if (pSocket != OFC_NULL)
+  ret = 0 ;
+  count = 0 ;
+  sock = ofc_handle_lock (hSocket) ;
+  if (sock != OFC_NULL)
     {
-      NetworkEvents = 0 ;
-      ret = OFC_TRUE ;
-      if (type & OFC_SOCKET_EVENT_CLOSE)
-	NetworkEvents |= FD_CLOSE ;
-      if (type & OFC_SOCKET_EVENT_ACCEPT)
-	NetworkEvents |= FD_ACCEPT ;
-      if (type & OFC_SOCKET_EVENT_ADDRESSCHANGE)
-	NetworkEvents |= FD_ADDRESS_LIST_CHANGE ;
-      if (type & OFC_SOCKET_EVENT_QOS)
-	NetworkEvents |= FD_QOS ;
-      if (type & OFC_SOCKET_EVENT_QOB)
-	NetworkEvents |= FD_OOB ;
-      if (type & OFC_SOCKET_EVENT_READ)
-	NetworkEvents |= FD_READ ;
-      if (type & OFC_SOCKET_EVENT_WRITE)
-	NetworkEvents |= FD_WRITE ;
-
-      WSAEventSelect (pSocket->socket, pSocket->hEvent, NetworkEvents) ;
+      ret = (OFC_SOCKET_EVENT_TYPE) (sock->ready | sock->pending) ;
+      if (bytes != OFC_NULL && sock->shard == OFC_NULL &&
+	  !sock->listening)
+	{
+	  if (sock->frame != OFC_NULL)
+	    count = sock->frame->tail - sock->frame->head -
+	      sock->frame->consumed ;
+	  count += socket_ready_bytes (sock) ;
+	  if (count > 0)
+	    ret |= OFC_SOCKET_EVENT_READ ;
+	}
       ofc_handle_unlock (hSocket) ;
     }
-  
+  if (bytes != OFC_NULL)
+    *bytes = count ;
   return (ret) ;
 }
 
-OFC_VOID ofc_socket_impl_set_send_size(OFC_HANDLE hSocket, OFC_INT size)
+/*
+ * Borrow a socket for I/O without the handle lock.
+ *
+ * A borrowed socket stays valid until it is returned, even if it is
+ * closed or destroyed meanwhile.  Sends and receives on a borrowed
+ * socket go straight to Winsock, which allows one thread to send while
+ * another receives.  They bypass corking and framed receive buffers,
+ * so do not mix them with those on the same socket.
+ *
+ * Accepts:
+ *    hSocket - Handle of a connected socket
+ *
+ * Returns:
+ *    The borrowed socket or OFC_NULL if the socket is closed or
+ *    listening
+ */
+OFC_SOCKET_BORROW *ofc_socket_win32_borrow(OFC_HANDLE hSocket)
 {
   OFC_SOCKET_IMPL *sock ;
+  OFC_SOCKET_BORROW *ret ;
 
+  ret = OFC_NULL ;
   sock = ofc_handle_lock (hSocket) ;
   if (sock != OFC_NULL)
     {
-      setsockopt(sock->socket, SOL_SOCKET, SO_SNDBUF,
-		 (const char *) &size, sizeof(size));
+      if (!sock->listening && sock->shard == OFC_NULL)
+	{
+	  InterlockedIncrement (&sock->refs) ;
+	  InterlockedIncrement (&sock->borrows) ;
+	  if (sock->socket != INVALID_SOCKET)
+	    ret = sock ;
+	  else
+	    socket_unborrow (sock) ;
+	}
       ofc_handle_unlock (hSocket) ;
     }
+  return (ret) ;
 }
-  
-OFC_VOID ofc_socket_impl_set_recv_size(OFC_HANDLE hSocket, OFC_INT size)
+
+OFC_VOID ofc_socket_win32_return(OFC_SOCKET_BORROW *sock)
 {
-  OFC_SOCKET_IMPL *sock ;
+  socket_unborrow (sock) ;
+}
 
-  sock = ofc_handle_lock (hSocket) ;
-  if (sock != OFC_NULL)
+/*
+ * Send on a borrowed socket
+ *
+ * Returns:
+ *    Bytes sent, 0 if the send would block, -1 on error
+ */
+OFC_SIZET ofc_socket_win32_borrowed_send(OFC_SOCKET_BORROW *sock,
+                                         const OFC_VOID *buf,
+                                         OFC_SIZET len)
+{
+  OFC_SIZET ret ;
+
+  InterlockedIncrement (&socket_send_calls) ;
+  if (sock->priority == OFC_SOCKMEM_LOW && ofc_sockmem_exhausted ())
     {
-      setsockopt(sock->socket, SOL_SOCKET, SO_RCVBUF,
-		 (const char *) &size, sizeof(size));
-      ofc_handle_unlock (hSocket) ;
+      InterlockedExchange (&sock->throttled, 1) ;
+      ret = 0 ;
     }
+  else
+    ret = socket_send (sock, buf, len) ;
+  return (ret) ;
 }
-  
-OFC_BOOL ofc_socket_impl_get_addresses(OFC_HANDLE hSock,
-                                       OFC_SOCKADDR *local,
-                                       OFC_SOCKADDR *remote)
+
+/*
+ * Receive on a borrowed socket
+ *
+ * Returns:
+ *    Bytes received, 0 if none are available or the peer closed, -1 on
+ *    error
+ */
+OFC_SIZET ofc_socket_win32_borrowed_recv(OFC_SOCKET_BORROW *sock,
+                                         OFC_VOID *buf,
+                                         OFC_SIZET len)
+{
+  OFC_SIZET ret ;
+  int status ;
+
+  ret = -1 ;
+  status = recv (sock->socket, (char *) buf, (int) len, 0) ;
+  if (status > 0)
+    ret = status ;
+  else if (status == 0 || WSAGetLastError () == WSAEWOULDBLOCK)
+    ret = 0 ;
+  /*
+   * The readiness cache belongs to the handle locked path.  Only mark
+   * the byte count out of date and let readability be polled again.
+   */
+  InterlockedExchange (&sock->rx_stale, 1) ;
+  InterlockedExchange (&sock->read_reported, 0) ;
+  return (ret) ;
+}
+
+/*
+ * Set a socket's priority for memory accounting.  Low priority sockets
+ * get would-block from sends, and cannot grow their send buffers, while
+ * the process wide socket memory budget is used up.
+ *
+ * Accepts:
+ *    hSocket - Socket handle
+ *    priority - OFC_SOCKMEM_NORMAL or OFC_SOCKMEM_LOW
+ *
+ * Returns:
+ *    OFC_FALSE if the handle is not a socket
+ */
+OFC_BOOL ofc_socket_win32_priority(OFC_HANDLE hSocket,
+                                   OFC_SOCKMEM_PRIORITY priority)
 {
   OFC_SOCKET_IMPL *sock ;
   OFC_BOOL ret ;
-  int win32_status ;
-  struct sockaddr *local_sockaddr;
-  struct sockaddr *remote_sockaddr;
-  socklen_t local_sockaddr_size;
-  socklen_t remote_sockaddr_size;
 
   ret = OFC_FALSE ;
-  sock = ofc_handle_lock (hSock) ;
+  sock = ofc_handle_lock (hSocket) ;
   if (sock != OFC_NULL)
     {
-      local_sockaddr_size = (OFC_MAX (sizeof (struct sockaddr_in6),
-				      sizeof (struct sockaddr_in))) ;
-      local_sockaddr = ofc_malloc (local_sockaddr_size) ;
-
-      win32_status = getsockname (sock->socket, local_sockaddr,
-				  &local_sockaddr_size) ;
-      if (win32_status == 0)
-	{
-	  if (local_sockaddr->sa_family == AF_INET)
-	    local->sin_family = OFC_FAMILY_IP ;
-	  else
-	    local->sin_family = OFC_FAMILY_IPV6 ;
-	  unmake_sockaddr (local_sockaddr, 
-			   &local->sin_addr, &local->sin_port) ;
-
-	  remote_sockaddr_size = (OFC_MAX (sizeof (struct sockaddr_in6),
-					   sizeof (struct sockaddr_in))) ;
-	  remote_sockaddr = ofc_malloc (remote_sockaddr_size) ;
-
-	  win32_status = getpeername (sock->socket, 
-				      remote_sockaddr,
-				      &remote_sockaddr_size) ;
-	  if (win32_status == 0)
-	    {
-	      if (remote_sockaddr->sa_family == AF_INET)
-		remote->sin_family = OFC_FAMILY_IP ;
-	      else
-		remote->sin_family = OFC_FAMILY_IPV6 ;
-	      unmake_sockaddr (remote_sockaddr, &remote->sin_addr, 
-			       &remote->sin_port) ;
-	      ret = OFC_TRUE ;
-	    }
-	  ofc_free (remote_sockaddr) ;
-	}
-      ofc_free (local_sockaddr) ;
-      ofc_handle_unlock (hSock) ;
+      sock->priority = priority ;
+      ret = OFC_TRUE ;
+      ofc_handle_unlock (hSocket) ;
     }
   return (ret) ;
 }
@@ -0,0 +1,82 @@
+/* Copyright (c) 2021 Connected Way, LLC. All rights reserved.
+ * Use of this source code is governed by a Creative Commons
+ * Attribution-NoDerivatives 4.0 International license that can be
+ * found in the LICENSE file.
+ */
+#define __OFC_CORE_DLL__
+
+#include <windows.h>
+
+#include "ofc/types.h"
+
+#include "ofc_windows/config.h"
+#include "ofc_windows/sockmem_windows.h"
+
+/** \{ */
+
+static volatile LONG64 sockmem_used = 0 ;
+static volatile LONG64 sockmem_budget = OFC_SOCKET_MEMORY_BUDGET ;
+static volatile LONG sockmem_refused = 0 ;
+
+OFC_VOID ofc_sockmem_init(OFC_VOID)
+{
+  InterlockedExchange64 (&sockmem_budget, OFC_SOCKET_MEMORY_BUDGET) ;
+}
+
+OFC_VOID ofc_sockmem_set_budget(OFC_SIZET budget)
+{
+  InterlockedExchange64 (&sockmem_budget, (LONG64) budget) ;
+}
+
+OFC_BOOL ofc_sockmem_charge(OFC_SIZET bytes, OFC_SOCKMEM_PRIORITY priority)
+{
+  OFC_BOOL ret ;
+  LONG64 used ;
+
+  ret = OFC_TRUE ;
+  if (priority == OFC_SOCKMEM_LOW)
+    {
+      /*
+       * Claim the bytes only if they still fit when the claim lands
+       */
+      do
+	{
+	  used = sockmem_used ;
+	  if (used + (LONG64) bytes > sockmem_budget)
+	    ret = OFC_FALSE ;
+	}
+      while (ret == OFC_TRUE &&
+	     InterlockedCompareExchange64 (&sockmem_used,
+					   used + (LONG64) bytes,
+					   used) != used) ;
+      if (ret == OFC_FALSE)
+	InterlockedIncrement (&sockmem_refused) ;
+    }
+  else
+    InterlockedExchangeAdd64 (&sockmem_used, (LONG64) bytes) ;
+
+  return (ret) ;
+}
+
+OFC_VOID ofc_sockmem_release(OFC_SIZET bytes)
+{
+  InterlockedExchangeAdd64 (&sockmem_used, -(LONG64) bytes) ;
+}
+
+OFC_BOOL ofc_sockmem_exhausted(OFC_VOID)
+{
+  return (sockmem_used >= sockmem_budget) ;
+}
+
+OFC_VOID ofc_sockmem_stats(OFC_SIZET *used, OFC_SIZET *budget,
+                           OFC_UINT32 *refused)
+{
+  if (used != OFC_NULL)
+    *used = (OFC_SIZET) sockmem_used ;
+  if (budget != OFC_NULL)
+    *budget = (OFC_SIZET) sockmem_budget ;
+  if (refused != OFC_NULL)
+    *refused = (OFC_UINT32) sockmem_refused ;
+}
+
+/** \} */
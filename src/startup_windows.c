@@ -0,0 +1,169 @@
+/* Copyright (c) 2021 Connected Way, LLC. All rights reserved.
+ * Use of this source code is governed by a Creative Commons
+ * Attribution-NoDerivatives 4.0 International license that can be
+ * found in the LICENSE file.
+ */
+#define __OFC_CORE_DLL__
+
+#include <windows.h>
+
+#include "ofc/types.h"
+#include "ofc/process.h"
+
+#include "ofc_windows/startup_windows.h"
+
+/** \{ */
+
+typedef struct
+{
+  volatile LONG seen ;
+  volatile LONG64 first ;
+  volatile LONG64 ticks ;
+  volatile LONG count ;
+} STARTUP_PHASE ;
+
+static const OFC_CHAR *startup_names[OFC_STARTUP_NUM] =
+  {
+    "wsastartup",
+    "socket",
+    "sockmem",
+    "bufpool",
+    "connpool",
+    "dnscache",
+    "interfaces",
+    "environment",
+    "console",
+    "first accept"
+  } ;
+
+static STARTUP_PHASE startup_phases[OFC_STARTUP_NUM] ;
+static volatile LONG startup_over = 0 ;
+static INIT_ONCE startup_once = INIT_ONCE_STATIC_INIT ;
+static LARGE_INTEGER startup_freq ;
+static LARGE_INTEGER startup_origin ;
+/*
+ * Microseconds from process creation to startup_origin
+ */
+static OFC_UINT64 startup_created ;
+
+static BOOL CALLBACK startup_clock(PINIT_ONCE once, PVOID param,
+				   PVOID *context)
+{
+  FILETIME creation ;
+  FILETIME exited ;
+  FILETIME kernel ;
+  FILETIME user ;
+  FILETIME now ;
+  ULARGE_INTEGER created ;
+  ULARGE_INTEGER current ;
+
+  QueryPerformanceFrequency (&startup_freq) ;
+  QueryPerformanceCounter (&startup_origin) ;
+  GetSystemTimeAsFileTime (&now) ;
+
+  startup_created = 0 ;
+  if (GetProcessTimes (GetCurrentProcess (), &creation, &exited,
+		       &kernel, &user))
+    {
+      created.LowPart = creation.dwLowDateTime ;
+      created.HighPart = creation.dwHighDateTime ;
+      current.LowPart = now.dwLowDateTime ;
+      current.HighPart = now.dwHighDateTime ;
+      if (current.QuadPart > created.QuadPart)
+	startup_created = (current.QuadPart - created.QuadPart) / 10 ;
+    }
+  return (TRUE) ;
+}
+
+static OFC_UINT64 startup_usec(LONGLONG ticks)
+{
+  return ((OFC_UINT64) (ticks / startup_freq.QuadPart) * 1000000 +
+	  (OFC_UINT64) (ticks % startup_freq.QuadPart) * 1000000 /
+	  startup_freq.QuadPart) ;
+}
+
+OFC_UINT64 ofc_startup_begin(OFC_VOID)
+{
+  LARGE_INTEGER now ;
+
+  InitOnceExecuteOnce (&startup_once, startup_clock, NULL, NULL) ;
+  QueryPerformanceCounter (&now) ;
+  return ((OFC_UINT64) now.QuadPart) ;
+}
+
+OFC_VOID ofc_startup_end(OFC_STARTUP_PHASE phase, OFC_UINT64 begin)
+{
+  STARTUP_PHASE *entry ;
+  LARGE_INTEGER now ;
+
+  if (phase < OFC_STARTUP_NUM)
+    {
+      QueryPerformanceCounter (&now) ;
+      entry = &startup_phases[phase] ;
+      if (InterlockedCompareExchange (&entry->seen, 1, 0) == 0)
+	InterlockedExchange64 (&entry->first, (LONG64) begin) ;
+      InterlockedExchangeAdd64 (&entry->ticks,
+				now.QuadPart - (LONG64) begin) ;
+      InterlockedIncrement (&entry->count) ;
+    }
+}
+
+OFC_VOID ofc_startup_milestone(OFC_STARTUP_PHASE phase)
+{
+  if (phase < OFC_STARTUP_NUM && startup_phases[phase].seen == 0)
+    {
+      /*
+       * Later arrivals lose the race in ofc_startup_end and only add a
+       * zero length run
+       */
+      ofc_startup_end (phase, ofc_startup_begin ()) ;
+    }
+  if (phase == OFC_STARTUP_FIRST_ACCEPT)
+    ofc_startup_done () ;
+}
+
+OFC_VOID ofc_startup_done(OFC_VOID)
+{
+  InterlockedExchange (&startup_over, 1) ;
+}
+
+OFC_BOOL ofc_startup_active(OFC_VOID)
+{
+  return (startup_over == 0) ;
+}
+
+OFC_BOOL ofc_startup_report(OFC_STARTUP_PHASE phase,
+                            OFC_STARTUP_TIMING *timing)
+{
+  STARTUP_PHASE *entry ;
+  OFC_BOOL ret ;
+
+  ret = OFC_FALSE ;
+  if (phase < OFC_STARTUP_NUM && startup_phases[phase].count > 0)
+    {
+      entry = &startup_phases[phase] ;
+      timing->offset = startup_created +
+	startup_usec (entry->first - startup_origin.QuadPart) ;
+      timing->duration = startup_usec (entry->ticks) ;
+      timing->count = (OFC_UINT32) entry->count ;
+      ret = OFC_TRUE ;
+    }
+  return (ret) ;
+}
+
+OFC_VOID ofc_startup_log(OFC_VOID)
+{
+  OFC_STARTUP_TIMING timing ;
+  OFC_INT phase ;
+
+  for (phase = 0 ; phase < OFC_STARTUP_NUM ; phase++)
+    {
+      if (ofc_startup_report (phase, &timing))
+	ofc_log (OFC_LOG_DEBUG,
+		 "startup %s at %llu us took %llu us over %u runs\n",
+		 startup_names[phase], timing.offset, timing.duration,
+		 timing.count) ;
+    }
+}
+
+/** \} */
@@ -17,10 +17,19 @@
 #include "ofc/waitset.h"
 #include "ofc/event.h"
 #include "ofc/heap.h"
+#include "ofc/process.h"
+#include "ofc_windows/config.h"
+#include "ofc_windows/bufpool_windows.h"
+#include "ofc_windows/executor_windows.h"
+#include "ofc_windows/thread_windows.h"
 
 /** \{ */
 
-typedef struct
+#define THREAD_JOINABLE 0
+#define THREAD_DETACHED 1
+#define THREAD_FINISHED 2
+
+typedef struct _WIN32_THREAD
 {
   HANDLE thread ;
   OFC_DWORD (*scheduler)(OFC_HANDLE hThread, OFC_VOID *context)  ;
@@ -31,28 +40,389 @@ typedef struct
   OFC_THREAD_DETACHSTATE detachstate ;
   OFC_HANDLE wait_set ;
   OFC_HANDLE hNotify ;
+  /*
+   * Set when a pooled joinable thread finishes since its OS thread
+   * does not exit
+   */
+  HANDLE done ;
+  /*
+   * THREAD_JOINABLE, THREAD_DETACHED or THREAD_FINISHED.  Whichever of
+   * the thread finishing and a detach comes second frees the entry.
+   */
+  volatile LONG fate ;
+  OFC_BOOL pinned ;
+  GROUP_AFFINITY affinity ;
+  /*
+   * Registry entry, valid while the thread runs.  The times and cycles
+   * are the OS thread's counts when the run started.
+   */
+  struct _WIN32_THREAD *prev ;
+  struct _WIN32_THREAD *next ;
+  OFC_CHAR name[OFC_THREAD_WIN32_NAME_LEN] ;
+  OFC_INT instance ;
+  HANDLE os ;
+  DWORD tid ;
+  OFC_UINT64 kernel ;
+  OFC_UINT64 user ;
+  OFC_UINT64 cycles ;
 } WIN32_THREAD ;
 
+typedef HRESULT (WINAPI *THREAD_DESCRIBE)(HANDLE thread, PCWSTR description) ;
+
+static SRWLOCK thread_registry_lock = SRWLOCK_INIT ;
+static WIN32_THREAD *thread_registry = OFC_NULL ;
+static OFC_INT thread_registry_count = 0 ;
+static INIT_ONCE thread_describe_once = INIT_ONCE_STATIC_INIT ;
+static THREAD_DESCRIBE thread_describe = OFC_NULL ;
+
+/*
+ * Placement policy, read once from OFC_THREAD_AFFINITY.  The variable
+ * holds rules separated by semicolons, each of the form name=policy.
+ * The name is matched against the thread name and * matches any
+ * thread without a rule of its own.  Policies are:
+ *
+ *   core       pin instance i to logical processor i
+ *   core:b     pin instance i to logical processor b + i
+ *   node       spread instances round robin across NUMA nodes
+ *   node:n     keep every instance on NUMA node n
+ *   none       leave the thread to the scheduler
+ *
+ * For example "scheduler=core;worker=node;*=none".
+ */
+#define THREAD_AFFINITY_RULES 16
+#define THREAD_AFFINITY_NAME 32
+#define THREAD_AFFINITY_ENV_LEN 512
+
+typedef enum
+  {
+    THREAD_PLACE_NONE = 0,
+    THREAD_PLACE_CORE,
+    THREAD_PLACE_NODE
+  } THREAD_PLACE ;
+
+typedef struct
+{
+  OFC_CHAR name[THREAD_AFFINITY_NAME] ;
+  THREAD_PLACE place ;
+  OFC_BOOL fixed ;
+  OFC_INT base ;
+} THREAD_AFFINITY_RULE ;
+
+static INIT_ONCE thread_affinity_once = INIT_ONCE_STATIC_INIT ;
+static THREAD_AFFINITY_RULE thread_affinity_rules[THREAD_AFFINITY_RULES] ;
+static OFC_INT thread_affinity_count = 0 ;
+
+static OFC_CHAR *thread_affinity_number(OFC_CHAR *p, OFC_INT *value)
+{
+  *value = 0 ;
+  while (*p >= '0' && *p <= '9')
+    *value = *value * 10 + (*p++ - '0') ;
+  return (p) ;
+}
+
+static BOOL CALLBACK thread_affinity_load(PINIT_ONCE once, PVOID param,
+					  PVOID *context)
+{
+  OFC_CHAR env[THREAD_AFFINITY_ENV_LEN] ;
+  THREAD_AFFINITY_RULE *rule ;
+  OFC_CHAR *p ;
+  OFC_CHAR *policy ;
+  OFC_INT len ;
+  DWORD status ;
+
+  status = GetEnvironmentVariableA ("OFC_THREAD_AFFINITY", env,
+				    THREAD_AFFINITY_ENV_LEN) ;
+  if (status == 0 || status >= THREAD_AFFINITY_ENV_LEN)
+    env[0] = '\0' ;
+
+  p = env ;
+  while (*p != '\0' && thread_affinity_count < THREAD_AFFINITY_RULES)
+    {
+      rule = &thread_affinity_rules[thread_affinity_count] ;
+      for (len = 0 ; p[len] != '\0' && p[len] != '=' && p[len] != ';' ;
+	   len++) ;
+
+      policy = OFC_NULL ;
+      if (p[len] == '=' && len < THREAD_AFFINITY_NAME)
+	{
+	  ofc_memcpy (rule->name, p, len) ;
+	  rule->name[len] = '\0' ;
+	  policy = p + len + 1 ;
+	}
+      p += len ;
+
+      if (policy != OFC_NULL)
+	{
+	  rule->place = THREAD_PLACE_NONE ;
+	  rule->fixed = OFC_FALSE ;
+	  rule->base = 0 ;
+	  if (ofc_strncmp (policy, "core", 4) == 0)
+	    {
+	      rule->place = THREAD_PLACE_CORE ;
+	      policy += 4 ;
+	    }
+	  else if (ofc_strncmp (policy, "node", 4) == 0)
+	    {
+	      rule->place = THREAD_PLACE_NODE ;
+	      policy += 4 ;
+	    }
+	  if (rule->place != THREAD_PLACE_NONE && *policy == ':')
+	    {
+	      policy = thread_affinity_number (policy + 1, &rule->base) ;
+	      rule->fixed = OFC_TRUE ;
+	    }
+	  thread_affinity_count++ ;
+	  p = policy ;
+	}
+
+      while (*p != '\0' && *p != ';')
+	p++ ;
+      if (*p == ';')
+	p++ ;
+    }
+  return (TRUE) ;
+}
+
+/*
+ * Work out where a thread goes.  Returns OFC_FALSE if the thread is
+ * left to the scheduler.
+ */
+static OFC_BOOL thread_affinity(OFC_CCHAR *thread_name,
+				OFC_INT thread_instance,
+				GROUP_AFFINITY *affinity)
+{
+  THREAD_AFFINITY_RULE *rule ;
+  OFC_BOOL ret ;
+  OFC_INT i ;
+  ULONG highest ;
+  DWORD total ;
+  DWORD index ;
+  WORD groups ;
+  WORD group ;
+
+  InitOnceExecuteOnce (&thread_affinity_once, thread_affinity_load,
+		       NULL, NULL) ;
+
+  rule = OFC_NULL ;
+  for (i = 0 ; i < thread_affinity_count ; i++)
+    {
+      if (thread_name != OFC_NULL &&
+	  lstrcmpiA (thread_affinity_rules[i].name, thread_name) == 0)
+	{
+	  rule = &thread_affinity_rules[i] ;
+	  break ;
+	}
+      if (rule == OFC_NULL &&
+	  ofc_strcmp (thread_affinity_rules[i].name, "*") == 0)
+	rule = &thread_affinity_rules[i] ;
+    }
+
+  ret = OFC_FALSE ;
+  ofc_memset (affinity, '\0', sizeof (GROUP_AFFINITY)) ;
+  if (rule != OFC_NULL && rule->place == THREAD_PLACE_CORE)
+    {
+      total = GetActiveProcessorCount (ALL_PROCESSOR_GROUPS) ;
+      if (total > 0)
+	{
+	  index = (DWORD) (rule->base + thread_instance) % total ;
+	  groups = GetActiveProcessorGroupCount () ;
+	  for (group = 0 ; group < groups &&
+		 index >= GetActiveProcessorCount (group) ; group++)
+	    index -= GetActiveProcessorCount (group) ;
+	  if (group < groups)
+	    {
+	      affinity->Group = group ;
+	      affinity->Mask = (KAFFINITY) 1 << index ;
+	      ret = OFC_TRUE ;
+	    }
+	}
+    }
+  else if (rule != OFC_NULL && rule->place == THREAD_PLACE_NODE &&
+	   GetNumaHighestNodeNumber (&highest))
+    {
+      /*
+       * Skip nodes with no processors, which exist on some machines
+       */
+      for (i = 0 ; i <= (OFC_INT) highest && !ret ; i++)
+	{
+	  if (GetNumaNodeProcessorMaskEx ((USHORT)
+					  (((rule->fixed ? rule->base :
+					     thread_instance) + i) %
+					   (highest + 1)), affinity) &&
+	      affinity->Mask != 0)
+	    ret = OFC_TRUE ;
+	}
+    }
+
+  if (ret)
+    ofc_log (OFC_LOG_DEBUG, "Thread %s:%d placed on group %u mask 0x%llx\n",
+	     thread_name, thread_instance, (OFC_UINT) affinity->Group,
+	     (OFC_UINT64) affinity->Mask) ;
+  return (ret) ;
+}
+
+static OFC_UINT64 thread_usec(FILETIME *ft)
+{
+  return (((OFC_UINT64) ft->dwHighDateTime << 32 | ft->dwLowDateTime) / 10) ;
+}
+
+/*
+ * SetThreadDescription is only there on Windows 10 1607 and later
+ */
+static BOOL CALLBACK thread_describe_load(PINIT_ONCE once, PVOID param,
+					  PVOID *context)
+{
+  HMODULE kernel ;
+
+  kernel = GetModuleHandleW (L"kernel32.dll") ;
+  if (kernel != NULL)
+    thread_describe = (THREAD_DESCRIBE)
+      GetProcAddress (kernel, "SetThreadDescription") ;
+  return (TRUE) ;
+}
+
+/*
+ * Register the calling thread.  Called on the thread itself so pooled
+ * and dedicated OS threads are handled alike.
+ */
+static OFC_VOID thread_register(WIN32_THREAD *win32Thread)
+{
+  FILETIME creation ;
+  FILETIME exited ;
+  FILETIME kernel ;
+  FILETIME user ;
+  OFC_CHAR desc[OFC_THREAD_WIN32_NAME_LEN + 16] ;
+  WCHAR wdesc[OFC_THREAD_WIN32_NAME_LEN + 16] ;
+  ULONG64 cycles ;
+
+  win32Thread->tid = GetCurrentThreadId () ;
+  if (!DuplicateHandle (GetCurrentProcess (), GetCurrentThread (),
+			GetCurrentProcess (), &win32Thread->os,
+			0, FALSE, DUPLICATE_SAME_ACCESS))
+    win32Thread->os = NULL ;
+
+  win32Thread->kernel = 0 ;
+  win32Thread->user = 0 ;
+  win32Thread->cycles = 0 ;
+  if (GetThreadTimes (GetCurrentThread (), &creation, &exited,
+		      &kernel, &user))
+    {
+      win32Thread->kernel = thread_usec (&kernel) ;
+      win32Thread->user = thread_usec (&user) ;
+    }
+  if (QueryThreadCycleTime (GetCurrentThread (), &cycles))
+    win32Thread->cycles = cycles ;
+
+  InitOnceExecuteOnce (&thread_describe_once, thread_describe_load,
+		       NULL, NULL) ;
+  if (thread_describe != OFC_NULL)
+    {
+      ofc_snprintf (desc, sizeof (desc), "%s:%d", win32Thread->name,
+		    win32Thread->instance) ;
+      if (MultiByteToWideChar (CP_UTF8, 0, desc, -1, wdesc,
+			       OFC_THREAD_WIN32_NAME_LEN + 16) > 0)
+	thread_describe (GetCurrentThread (), wdesc) ;
+    }
+
+  AcquireSRWLockExclusive (&thread_registry_lock) ;
+  win32Thread->prev = OFC_NULL ;
+  win32Thread->next = thread_registry ;
+  if (thread_registry != OFC_NULL)
+    thread_registry->prev = win32Thread ;
+  thread_registry = win32Thread ;
+  thread_registry_count++ ;
+  ReleaseSRWLockExclusive (&thread_registry_lock) ;
+}
+
+static OFC_VOID thread_unregister(WIN32_THREAD *win32Thread)
+{
+  AcquireSRWLockExclusive (&thread_registry_lock) ;
+  if (win32Thread->prev != OFC_NULL)
+    win32Thread->prev->next = win32Thread->next ;
+  else
+    thread_registry = win32Thread->next ;
+  if (win32Thread->next != OFC_NULL)
+    win32Thread->next->prev = win32Thread->prev ;
+  thread_registry_count-- ;
+  ReleaseSRWLockExclusive (&thread_registry_lock) ;
+
+  if (win32Thread->os != NULL)
+    CloseHandle (win32Thread->os) ;
+  win32Thread->os = NULL ;
+}
+
+static OFC_VOID thread_free(WIN32_THREAD *win32Thread)
+{
+  if (win32Thread->thread != NULL)
+    CloseHandle (win32Thread->thread) ;
+  if (win32Thread->done != NULL)
+    CloseHandle (win32Thread->done) ;
+  ofc_handle_destroy (win32Thread->handle) ;
+  ofc_free (win32Thread) ;
+}
+
 static void *ofc_thread_launch(void *arg)
 {
   WIN32_THREAD *win32Thread ;
+  HANDLE done ;
 
   win32Thread = arg ;
+  thread_register (win32Thread) ;
 
   win32Thread->ret = (win32Thread->scheduler)(win32Thread->handle,
 					      win32Thread->context) ;
+  thread_unregister (win32Thread) ;
+  /*
+   * Don't strand this thread's cached receive buffers
+   */
+  ofc_bufpool_thread_flush () ;
+
   if (win32Thread->hNotify != OFC_HANDLE_NULL)
     ofc_event_set (win32Thread->hNotify) ;
 
-  if (win32Thread->detachstate == OFC_THREAD_DETACH)
-    {
-      CloseHandle (win32Thread->thread) ;
-      ofc_handle_destroy (win32Thread->handle) ;
-      ofc_free (win32Thread) ;
-    }
+  /*
+   * A finished joinable thread is freed by its join, or by a detach.
+   * Either waits for done first when there is one, so done is the last
+   * thing touched here.
+   */
+  done = win32Thread->done ;
+  if (InterlockedCompareExchange (&win32Thread->fate, THREAD_FINISHED,
+				  THREAD_JOINABLE) == THREAD_DETACHED)
+    thread_free (win32Thread) ;
+  else if (done != NULL)
+    SetEvent (done) ;
   return (OFC_NULL) ;
 }
 
+#if defined(OFC_THREAD_POOLED)
+static OFC_VOID thread_tls_reset(OFC_VOID) ;
+
+static OFC_VOID ofc_thread_pooled(OFC_VOID *arg)
+{
+  WIN32_THREAD *win32Thread ;
+  GROUP_AFFINITY saved ;
+  OFC_BOOL pinned ;
+
+  /*
+   * The OS thread is reused so put its placement back afterwards.
+   * win32Thread may be gone by then.
+   */
+  win32Thread = arg ;
+  pinned = win32Thread->pinned &&
+    GetThreadGroupAffinity (GetCurrentThread (), &saved) &&
+    SetThreadGroupAffinity (GetCurrentThread (), &win32Thread->affinity,
+			    NULL) ;
+  /*
+   * Thread variables left behind by the last thread to run here must
+   * not show through to this one
+   */
+  thread_tls_reset () ;
+  ofc_thread_launch (arg) ;
+  if (pinned)
+    SetThreadGroupAffinity (GetCurrentThread (), &saved, NULL) ;
+}
+#endif
+
 OFC_HANDLE ofc_thread_create_impl(OFC_DWORD(scheduler)(OFC_HANDLE hThread,
                                                        OFC_VOID *context),
                                   OFC_CCHAR *thread_name,
@@ -63,6 +433,9 @@ OFC_HANDLE ofc_thread_create_impl(OFC_DWORD(scheduler)(OFC_HANDLE hThread,
 {
   WIN32_THREAD *win32Thread ;
   OFC_HANDLE ret ;
+  OFC_BOOL pooled ;
+  OFC_BOOL pinned ;
+  HANDLE thread ;
 
   ret = OFC_HANDLE_NULL ;
   win32Thread = ofc_malloc (sizeof (WIN32_THREAD)) ;
@@ -76,25 +449,76 @@ OFC_HANDLE ofc_thread_create_impl(OFC_DWORD(scheduler)(OFC_HANDLE hThread,
       win32Thread->handle = 
 	ofc_handle_create (OFC_HANDLE_THREAD, win32Thread) ;
       win32Thread->detachstate = detachstate ;
-
-      win32Thread->thread = 
-	CreateThread (NULL, 0, 
-		      (LPTHREAD_START_ROUTINE) ofc_thread_launch,
-		      win32Thread, 0, NULL) ;
-
-      if (win32Thread->thread == NULL)
+      win32Thread->fate = (detachstate == OFC_THREAD_DETACH) ?
+	THREAD_DETACHED : THREAD_JOINABLE ;
+      win32Thread->thread = NULL ;
+      win32Thread->done = NULL ;
+      win32Thread->pinned =
+	thread_affinity (thread_name, thread_instance,
+			 &win32Thread->affinity) ;
+      win32Thread->name[0] = '\0' ;
+      if (thread_name != OFC_NULL)
 	{
-	  ofc_handle_destroy (win32Thread->handle) ;
-	  ofc_free (win32Thread) ;
+	  ofc_strncpy (win32Thread->name, thread_name,
+		       OFC_THREAD_WIN32_NAME_LEN - 1) ;
+	  win32Thread->name[OFC_THREAD_WIN32_NAME_LEN - 1] = '\0' ;
 	}
-      else
+      win32Thread->instance = thread_instance ;
+      win32Thread->os = NULL ;
+
+      pooled = OFC_FALSE ;
+#if defined(OFC_THREAD_POOLED)
+      /*
+       * Run on a parked OS thread if there is one
+       */
+      if (detachstate == OFC_THREAD_JOIN)
+	win32Thread->done = CreateEvent (NULL, TRUE, FALSE, NULL) ;
+      if (detachstate == OFC_THREAD_DETACH || win32Thread->done != NULL)
 	{
-	  if (win32Thread->detachstate == OFC_THREAD_DETACH)
+	  ret = win32Thread->handle ;
+	  pooled = ofc_executor_spawn (ofc_thread_pooled, win32Thread) ;
+	  if (!pooled)
 	    {
-	      CloseHandle (win32Thread->thread) ;
-	      win32Thread->thread = NULL ;
+	      ret = OFC_HANDLE_NULL ;
+	      if (win32Thread->done != NULL)
+		CloseHandle (win32Thread->done) ;
+	      win32Thread->done = NULL ;
 	    }
+	}
+#endif
+      if (!pooled)
+	{
+	  /*
+	   * A pinned thread is placed before it runs so its stack and
+	   * first allocations land on the right node.  A detached thread
+	   * may free its entry as soon as it runs, so nothing is read
+	   * from the entry after that.
+	   */
 	  ret = win32Thread->handle ;
+	  pinned = win32Thread->pinned ;
+	  thread = CreateThread (NULL, 0, 
+				 (LPTHREAD_START_ROUTINE) ofc_thread_launch,
+				 win32Thread,
+				 pinned ? CREATE_SUSPENDED : 0, NULL) ;
+
+	  if (thread == NULL)
+	    {
+	      ofc_handle_destroy (win32Thread->handle) ;
+	      ofc_free (win32Thread) ;
+	      ret = OFC_HANDLE_NULL ;
+	    }
+	  else
+	    {
+	      if (pinned)
+		SetThreadGroupAffinity (thread, &win32Thread->affinity,
+					NULL) ;
+	      if (detachstate == OFC_THREAD_JOIN)
+		win32Thread->thread = thread ;
+	      if (pinned)
+		ResumeThread (thread) ;
+	      if (detachstate == OFC_THREAD_DETACH)
+		CloseHandle (thread) ;
+	    }
 	}
     }
 
@@ -137,9 +561,11 @@ OFC_VOID ofc_thread_wait_impl(OFC_HANDLE hThread)
     {
       if (win32Thread->detachstate == OFC_THREAD_JOIN)
 	{
-	  WaitForSingleObject (win32Thread->thread, INFINITE) ;
-	  ofc_handle_destroy (win32Thread->handle) ;
-	  ofc_free (win32Thread) ;
+	  if (win32Thread->done != NULL)
+	    WaitForSingleObject (win32Thread->done, INFINITE) ;
+	  else
+	    WaitForSingleObject (win32Thread->thread, INFINITE) ;
+	  thread_free (win32Thread) ;
 	}
       ofc_handle_unlock (hThread) ;
     }
@@ -172,24 +598,120 @@ OFC_VOID ofc_sleep_impl(OFC_DWORD milliseconds)
   Sleep (dwMilliseconds) ;
 }
 
+/*
+ * The first OFC_THREAD_TLS_FAST variables created live in compiler
+ * managed thread local storage, which is a plain memory access instead
+ * of a call into TlsGetValue.  The rest fall back to dynamic TLS
+ * slots.  A fast key has the top bit set, which TlsAlloc never returns
+ * for a valid index.
+ *
+ * Handing fast slots out by creation order is deliberate.  The
+ * variables owned by the core are created during core init, before
+ * any application code can create its own, and they are the ones read
+ * on every scheduler pass.  This layer cannot name them since the core
+ * owns them, so creation order stands in for an explicit list.  A
+ * variable created after the fast slots run out works the same, only
+ * slower, and the first such fallback is logged so a change in the
+ * core's init order shows up.
+ *
+ * Fast slots are not reused once freed so a new variable always
+ * starts out as zero in every thread, as it does with TlsAlloc.  An
+ * OS thread reused from the pool gets the same guarantee by having
+ * its fast slots and every live dynamic slot cleared before each run.
+ * The live dynamic slots are kept in a bitmap for that.
+ */
+#if defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+#define THREAD_TLS_FAST_KEY 0x80000000U
+#define THREAD_TLS_IS_FAST(var) \
+  (((var) & THREAD_TLS_FAST_KEY) && \
+   ((var) & ~THREAD_TLS_FAST_KEY) < OFC_THREAD_TLS_FAST)
+
+/*
+ * TLS_MINIMUM_AVAILABLE plus the 1024 expansion slots
+ */
+#define THREAD_TLS_SLOTS (TLS_MINIMUM_AVAILABLE + 1024)
+#define THREAD_TLS_WORDS (THREAD_TLS_SLOTS / 32)
+
+static THREAD_LOCAL OFC_DWORD_PTR thread_tls_fast[OFC_THREAD_TLS_FAST] ;
+static volatile LONG thread_tls_fast_next = 0 ;
+static volatile LONG thread_tls_live[THREAD_TLS_WORDS] ;
+static volatile LONG thread_tls_spilled = 0 ;
+
+#if defined(OFC_THREAD_POOLED)
+static OFC_VOID thread_tls_reset(OFC_VOID)
+{
+  OFC_INT i ;
+  DWORD slot ;
+  ULONG live ;
+
+  ofc_memset (thread_tls_fast, 0, sizeof (thread_tls_fast)) ;
+  for (i = 0 ; i < THREAD_TLS_WORDS ; i++)
+    {
+      for (live = (ULONG) thread_tls_live[i], slot = i * 32 ; live != 0 ;
+	   live >>= 1, slot++)
+	{
+	  if (live & 1)
+	    TlsSetValue (slot, NULL) ;
+	}
+    }
+}
+#endif
+
 OFC_DWORD ofc_thread_create_variable_impl(OFC_VOID)
 {
-  return ((OFC_DWORD) TlsAlloc()) ;
+  LONG slot ;
+  OFC_DWORD ret ;
+
+  slot = InterlockedIncrement (&thread_tls_fast_next) - 1 ;
+  if (slot < OFC_THREAD_TLS_FAST)
+    ret = THREAD_TLS_FAST_KEY | (OFC_DWORD) slot ;
+  else
+    {
+      InterlockedDecrement (&thread_tls_fast_next) ;
+      ret = (OFC_DWORD) TlsAlloc () ;
+      if (InterlockedExchange (&thread_tls_spilled, 1) == 0)
+	ofc_log (OFC_LOG_DEBUG,
+		 "Thread variables past %d use dynamic TLS slots\n",
+		 OFC_THREAD_TLS_FAST) ;
+      if (ret < THREAD_TLS_SLOTS)
+	InterlockedOr (&thread_tls_live[ret / 32], (LONG) (1U << (ret % 32))) ;
+    }
+  return (ret) ;
 }
 
 OFC_VOID ofc_thread_destroy_variable_impl(OFC_DWORD dkey)
 {
-  TlsFree(dkey);
+  if (!THREAD_TLS_IS_FAST (dkey))
+    {
+      if (dkey < THREAD_TLS_SLOTS)
+	InterlockedAnd (&thread_tls_live[dkey / 32],
+			~(LONG) (1U << (dkey % 32))) ;
+      TlsFree(dkey);
+    }
 }
 
 OFC_DWORD_PTR ofc_thread_get_variable_impl(OFC_DWORD var)
 {
-  return ((OFC_DWORD_PTR) TlsGetValue ((DWORD) var)) ;
+  OFC_DWORD_PTR ret ;
+
+  if (THREAD_TLS_IS_FAST (var))
+    ret = thread_tls_fast[var & ~THREAD_TLS_FAST_KEY] ;
+  else
+    ret = (OFC_DWORD_PTR) TlsGetValue ((DWORD) var) ;
+  return (ret) ;
 }
 
 OFC_VOID ofc_thread_set_variable_impl(OFC_DWORD var, OFC_DWORD_PTR val)
 {
-  TlsSetValue ((DWORD) var, (LPVOID) val) ;
+  if (THREAD_TLS_IS_FAST (var))
+    thread_tls_fast[var & ~THREAD_TLS_FAST_KEY] = val ;
+  else
+    TlsSetValue ((DWORD) var, (LPVOID) val) ;
 }
 
 /*
@@ -215,17 +737,74 @@ ofc_thread_destroy_impl(OFC_VOID)
 {
 }
 
+OFC_INT ofc_thread_win32_sample(OFC_THREAD_WIN32_SAMPLE *samples,
+                                OFC_INT max)
+{
+  WIN32_THREAD *win32Thread ;
+  OFC_THREAD_WIN32_SAMPLE *sample ;
+  FILETIME creation ;
+  FILETIME exited ;
+  FILETIME kernel ;
+  FILETIME user ;
+  ULONG64 cycles ;
+  OFC_INT count ;
+
+  /*
+   * The shared lock keeps every entry and its handle alive while it
+   * is sampled
+   */
+  AcquireSRWLockShared (&thread_registry_lock) ;
+  count = thread_registry_count ;
+  for (win32Thread = thread_registry ; win32Thread != OFC_NULL && max > 0 ;
+       win32Thread = win32Thread->next, max--)
+    {
+      sample = samples++ ;
+      ofc_memcpy (sample->name, win32Thread->name,
+		  OFC_THREAD_WIN32_NAME_LEN) ;
+      sample->instance = win32Thread->instance ;
+      sample->tid = win32Thread->tid ;
+      sample->kernel = 0 ;
+      sample->user = 0 ;
+      sample->cycles = 0 ;
+      if (win32Thread->os != NULL)
+	{
+	  if (GetThreadTimes (win32Thread->os, &creation, &exited,
+			      &kernel, &user))
+	    {
+	      sample->kernel = thread_usec (&kernel) - win32Thread->kernel ;
+	      sample->user = thread_usec (&user) - win32Thread->user ;
+	    }
+	  if (QueryThreadCycleTime (win32Thread->os, &cycles))
+	    sample->cycles = cycles - win32Thread->cycles ;
+	}
+    }
+  ReleaseSRWLockShared (&thread_registry_lock) ;
+  return (count) ;
+}
+
 OFC_CORE_LIB OFC_VOID
 ofc_thread_detach_impl(OFC_HANDLE hThread)
 {
   WIN32_THREAD *win32Thread ;
 
-  win32ThreadThread = ofc_handle_lock (hThread) ;
+  win32Thread = ofc_handle_lock (hThread) ;
   if (win32Thread != OFC_NULL)
     {
       win32Thread->detachstate = OFC_THREAD_DETACH;
-      CloseHandle (win32Thread->thread) ;
+      if (win32Thread->thread != NULL)
+	CloseHandle (win32Thread->thread) ;
       win32Thread->thread = NULL ;
+      /*
+       * A thread that already finished is freed here.  A pooled one
+       * may not have set done yet, and must before its entry goes.
+       */
+      if (InterlockedCompareExchange (&win32Thread->fate, THREAD_DETACHED,
+				      THREAD_JOINABLE) == THREAD_FINISHED)
+	{
+	  if (win32Thread->done != NULL)
+	    WaitForSingleObject (win32Thread->done, INFINITE) ;
+	  thread_free (win32Thread) ;
+	}
       ofc_handle_unlock(hThread) ;
     }
 }
@@ -15,6 +15,7 @@
 #include "ofc/socket.h"
 #include "ofc/event.h"
 #include "ofc/waitset.h"
+#include "ofc_windows/config.h"
 #include "ofc_windows/socket_windows.h"
 #include "ofc_windows/event_windows.h"
 
@@ -31,21 +32,72 @@
 
 /** \{ */
 
-OFC_VOID ofc_waitset_create_impl(WAIT_SET *pWaitSet)
+typedef struct
 {
   HANDLE win32WakeHandle ;
+#if defined(OFC_SOCKET_WSAPOLL)
+  /*
+   * Every socket in the wait set is a member of this group.  Its
+   * readiness comes from one WSAPoll over the group.
+   */
+  OFC_SOCKET_GROUP *group ;
+#endif
+} WIN32_WAIT_SET ;
 
-  win32WakeHandle = CreateEvent (NULL, FALSE, FALSE, NULL) ;
-  pWaitSet->impl = (OFC_VOID *) win32WakeHandle ;
+OFC_VOID ofc_waitset_create_impl(WAIT_SET *pWaitSet)
+{
+  WIN32_WAIT_SET *win32WaitSet ;
+
+  win32WaitSet = ofc_malloc (sizeof (WIN32_WAIT_SET)) ;
+  if (win32WaitSet != OFC_NULL)
+    {
+      win32WaitSet->win32WakeHandle = CreateEvent (NULL, FALSE, FALSE, NULL) ;
+#if defined(OFC_SOCKET_WSAPOLL)
+      win32WaitSet->group = ofc_socket_win32_group_create () ;
+#endif
+    }
+  pWaitSet->impl = (OFC_VOID *) win32WaitSet ;
 }
 
 OFC_VOID ofc_waitset_destroy_impl(WAIT_SET *pWaitSet)
 {
-  HANDLE win32WakeHandle ;
-  win32WakeHandle = (HANDLE) pWaitSet->impl ;
-  if (win32WakeHandle != NULL)
+  WIN32_WAIT_SET *win32WaitSet ;
+#if defined(OFC_SOCKET_WSAPOLL)
+  OFC_HANDLE hEventHandle ;
+  OFC_HANDLE winHandle ;
+#endif
+
+  win32WaitSet = pWaitSet->impl ;
+  if (win32WaitSet != OFC_NULL)
     {
-      CloseHandle (win32WakeHandle) ;
+#if defined(OFC_SOCKET_WSAPOLL)
+      if (win32WaitSet->group != OFC_NULL)
+	{
+	  for (hEventHandle = 
+		 (OFC_HANDLE) ofc_queue_first (pWaitSet->hHandleQueue) ;
+	       hEventHandle != OFC_HANDLE_NULL ;
+	       hEventHandle = 
+		 (OFC_HANDLE) ofc_queue_next (pWaitSet->hHandleQueue, 
+					      (OFC_VOID *) hEventHandle) ) 
+	    {
+	      if (ofc_handle_get_type (hEventHandle) == OFC_HANDLE_SOCKET)
+		{
+		  winHandle = ofc_socket_get_impl (hEventHandle) ;
+		  if (ofc_socket_win32_get_group (winHandle) ==
+		      win32WaitSet->group)
+		    ofc_socket_win32_group_leave (winHandle) ;
+		}
+	    }
+	  /*
+	   * A socket that left the wait set earlier may still refer to
+	   * the group.  In that case the group stays allocated.
+	   */
+	  ofc_socket_win32_group_destroy (win32WaitSet->group) ;
+	}
+#endif
+      if (win32WaitSet->win32WakeHandle != NULL)
+	CloseHandle (win32WaitSet->win32WakeHandle) ;
+      ofc_free (win32WaitSet) ;
       pWaitSet->impl = OFC_NULL ;
     }
 }
@@ -53,15 +105,15 @@ OFC_VOID ofc_waitset_destroy_impl(WAIT_SET *pWaitSet)
 OFC_VOID ofc_waitset_wake_impl(OFC_HANDLE handle)
 {
   WAIT_SET *pWaitSet ;
-  HANDLE win32WakeHandle ;
+  WIN32_WAIT_SET *win32WaitSet ;
 
   pWaitSet = ofc_handle_lock (handle) ;
 
   if (pWaitSet != OFC_NULL)
     {
-      win32WakeHandle = (HANDLE) pWaitSet->impl ;
-      if (win32WakeHandle != NULL)
-	SetEvent (win32WakeHandle) ;
+      win32WaitSet = pWaitSet->impl ;
+      if (win32WaitSet != OFC_NULL && win32WaitSet->win32WakeHandle != NULL)
+	SetEvent (win32WaitSet->win32WakeHandle) ;
       ofc_handle_unlock (handle) ;
     }
 }
@@ -71,9 +123,34 @@ OFC_VOID ofc_waitset_signal_impl(OFC_HANDLE handle, OFC_HANDLE hEvent)
   ofc_waitset_wake_impl (handle) ;
 }
 
+/*
+ * Find a socket in the wait set that already has events pending, such
+ * as a group member found ready by a sweep.
+ */
+static OFC_HANDLE waitset_socket_pending(WAIT_SET *pWaitSet)
+{
+  OFC_HANDLE hEventHandle ;
+  OFC_HANDLE ret ;
+
+  ret = OFC_HANDLE_NULL ;
+  for (hEventHandle = 
+	 (OFC_HANDLE) ofc_queue_first (pWaitSet->hHandleQueue) ;
+       hEventHandle != OFC_HANDLE_NULL && ret == OFC_HANDLE_NULL ;
+       hEventHandle = 
+	 (OFC_HANDLE) ofc_queue_next (pWaitSet->hHandleQueue, 
+				      (OFC_VOID *) hEventHandle) ) 
+    {
+      if (ofc_handle_get_type (hEventHandle) == OFC_HANDLE_SOCKET &&
+	  ofc_socket_win32_pending (ofc_socket_get_impl (hEventHandle)) != 0)
+	ret = hEventHandle ;
+    }
+  return (ret) ;
+}
+
 OFC_HANDLE ofc_waitset_wait_impl(OFC_HANDLE handle)
 {
   WAIT_SET *pWaitSet ;
+  WIN32_WAIT_SET *win32WaitSet ;
 
   OFC_HANDLE hEventHandle ;
   OFC_HANDLE triggered_event ;
@@ -90,20 +167,27 @@ OFC_HANDLE ofc_waitset_wait_impl(OFC_HANDLE handle)
   OFC_FST_TYPE fsType ;
   OFC_HANDLE hEvent ;
   OFC_HANDLE hMsgQ ;
+  OFC_SOCKET_GROUP *group ;
+  OFC_SOCKET_GROUP **group_list ;
+  OFC_INT group_count ;
+  OFC_INT i ;
 
   triggered_event = OFC_HANDLE_NULL ;
   pWaitSet = ofc_handle_lock (handle) ;
 
   if (pWaitSet != OFC_NULL)
     {
+      win32WaitSet = pWaitSet->impl ;
       leastWait = OFC_MAX_SCHED_WAIT ;
       timer_event = OFC_HANDLE_NULL ;
 
       win32_handle_list = ofc_malloc (sizeof (HANDLE)) ;
       ofc_handle_list = ofc_malloc (sizeof (OFC_HANDLE)) ;
-      win32_handle_list[0] = (HANDLE) pWaitSet->impl ;
+      win32_handle_list[0] = win32WaitSet->win32WakeHandle ;
       ofc_handle_list[0] = OFC_HANDLE_NULL ;
       wait_count = 1 ;
+      group_list = OFC_NULL ;
+      group_count = 0 ;
 
       for (hEventHandle = 
 	     (OFC_HANDLE) ofc_queue_first (pWaitSet->hHandleQueue) ;
@@ -221,6 +305,45 @@ OFC_HANDLE ofc_waitset_wait_impl(OFC_HANDLE handle)
 	      break ;
 
 	    case OFC_HANDLE_SOCKET:
+	      winHandle = ofc_socket_get_impl (hEventHandle) ;
+	      /*
+	       * Wake up in time for deferred socket work such as the
+	       * flush of a corked buffer.
+	       */
+	      wait_time = ofc_socket_win32_service (winHandle) ;
+	      if (wait_time < leastWait)
+		{
+		  leastWait = wait_time ;
+		  timer_event = OFC_HANDLE_NULL ;
+		}
+#if defined(OFC_SOCKET_WSAPOLL)
+	      if (win32WaitSet->group != OFC_NULL &&
+		  ofc_socket_win32_get_group (winHandle) != win32WaitSet->group)
+		{
+		  ofc_socket_win32_group_leave (winHandle) ;
+		  ofc_socket_win32_group_join (win32WaitSet->group, winHandle) ;
+		}
+#endif
+	      if (ofc_socket_win32_pending (winHandle) != 0)
+		{
+		  triggered_event = hEventHandle ;
+		  break ;
+		}
+	      /*
+	       * Members of a socket group share one event.  Only wait
+	       * on it once.
+	       */
+	      group = ofc_socket_win32_get_group (winHandle) ;
+	      if (group != OFC_NULL)
+		{
+		  for (i = 0 ; i < group_count && group_list[i] != group ; i++) ;
+		  if (i < group_count)
+		    break ;
+		  group_list = ofc_realloc (group_list,
+					    sizeof (OFC_SOCKET_GROUP *) *
+					    (group_count+1)) ;
+		  group_list[group_count++] = group ;
+		}
 	      /*
 	       * Wait on event
 	       */
@@ -231,7 +354,6 @@ OFC_HANDLE ofc_waitset_wait_impl(OFC_HANDLE handle)
 		ofc_realloc (ofc_handle_list,
 			      sizeof (OFC_HANDLE) * (wait_count+1)) ;
 	      
-	      winHandle = ofc_socket_get_impl (hEventHandle) ;
 	      win32_handle_list[wait_count] = 
 		ofc_socket_get_win32_handle (winHandle) ;
 	      ofc_handle_list[wait_count] = hEventHandle ;
@@ -282,6 +404,18 @@ OFC_HANDLE ofc_waitset_wait_impl(OFC_HANDLE handle)
 	    }
 	}
 
+#if defined(OFC_SOCKET_WSAPOLL)
+      /*
+       * Catch sockets that are ready but whose notification was
+       * already consumed.  One poll covers every socket in the set.
+       */
+      if (triggered_event == OFC_HANDLE_NULL &&
+	  win32WaitSet->group != OFC_NULL &&
+	  ofc_socket_win32_group_count (win32WaitSet->group) > 0 &&
+	  ofc_socket_win32_group_sweep (win32WaitSet->group) > 0)
+	triggered_event = waitset_socket_pending (pWaitSet) ;
+#endif
+
       if (triggered_event == OFC_HANDLE_NULL)
 	{
 	  if (wait_count == 0)
@@ -304,9 +438,26 @@ OFC_HANDLE ofc_waitset_wait_impl(OFC_HANDLE handle)
 		triggered_event = 
 		  ofc_handle_list[wait_index - WAIT_OBJECT_0] ;
 	    }
+
+	  if (triggered_event != OFC_HANDLE_NULL &&
+	      ofc_handle_get_type (triggered_event) == OFC_HANDLE_SOCKET)
+	    {
+	      /*
+	       * A group event stands for all of its members.  Sweep the
+	       * group and hand back a member that is actually ready.
+	       */
+	      group = ofc_socket_win32_get_group
+		(ofc_socket_get_impl (triggered_event)) ;
+	      if (group != OFC_NULL)
+		{
+		  ofc_socket_win32_group_sweep (group) ;
+		  triggered_event = waitset_socket_pending (pWaitSet) ;
+		}
+	    }
 	}
       ofc_free (win32_handle_list) ;
       ofc_free (ofc_handle_list) ;
+      ofc_free (group_list) ;
 
       ofc_handle_unlock (handle) ;
     }
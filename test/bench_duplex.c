@@ -0,0 +1,174 @@
+/* Copyright (c) 2021 Connected Way, LLC. All rights reserved.
+ * Use of this source code is governed by a Creative Commons
+ * Attribution-NoDerivatives 4.0 International license that can be
+ * found in the LICENSE file.
+ */
+/*
+ * Full duplex throughput over one loopback connection.
+ *
+ * Each end of the connection has a sending thread and a receiving
+ * thread running at once.  The run is made twice, first through
+ * ofc_socket_impl_send and ofc_socket_impl_recv, which serialize on
+ * the handle lock, then through borrowed sockets, which do not.  The
+ * throughput of both directions is reported for each.
+ *
+ * Usage: bench_duplex [seconds [port]]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <winsock2.h>
+#include <windows.h>
+
+#include "ofc/types.h"
+#include "ofc/framework.h"
+#include "ofc/net.h"
+#include "ofc/socket.h"
+#include "ofc/impl/socketimpl.h"
+
+#include "ofc_windows/socket_windows.h"
+
+#define BENCH_DUPLEX_SECONDS 5
+#define BENCH_DUPLEX_PORT 47040
+#define BENCH_DUPLEX_CHUNK 16384
+
+typedef struct
+{
+  OFC_HANDLE hSocket ;
+  OFC_SOCKET_BORROW *borrow ;
+  OFC_BOOL send ;
+  volatile LONG *stop ;
+  OFC_UINT64 bytes ;
+} BENCH_DUPLEX_SIDE ;
+
+static DWORD WINAPI bench_duplex_run(LPVOID context)
+{
+  BENCH_DUPLEX_SIDE *side ;
+  OFC_CHAR buf[BENCH_DUPLEX_CHUNK] ;
+  OFC_SIZET status ;
+
+  side = context ;
+  memset (buf, 'x', sizeof (buf)) ;
+  while (*side->stop == 0)
+    {
+      if (side->borrow != OFC_NULL && side->send)
+	status = ofc_socket_win32_borrowed_send (side->borrow, buf,
+						 sizeof (buf)) ;
+      else if (side->borrow != OFC_NULL)
+	status = ofc_socket_win32_borrowed_recv (side->borrow, buf,
+						 sizeof (buf)) ;
+      else if (side->send)
+	status = ofc_socket_impl_send (side->hSocket, buf, sizeof (buf)) ;
+      else
+	status = ofc_socket_impl_recv (side->hSocket, buf, sizeof (buf)) ;
+
+      if (status == (OFC_SIZET) -1)
+	break ;
+      else if (status == 0)
+	Sleep (0) ;
+      else
+	side->bytes += status ;
+    }
+  return (0) ;
+}
+
+static OFC_VOID bench_duplex(const char *name, OFC_HANDLE hA, OFC_HANDLE hB,
+			     OFC_BOOL borrowed, OFC_INT seconds)
+{
+  BENCH_DUPLEX_SIDE sides[4] ;
+  HANDLE threads[4] ;
+  volatile LONG stop ;
+  OFC_INT i ;
+
+  stop = 0 ;
+  for (i = 0 ; i < 4 ; i++)
+    {
+      sides[i].hSocket = (i < 2) ? hA : hB ;
+      sides[i].borrow = borrowed ?
+	ofc_socket_win32_borrow (sides[i].hSocket) : OFC_NULL ;
+      sides[i].send = (i % 2 == 0) ;
+      sides[i].stop = &stop ;
+      sides[i].bytes = 0 ;
+    }
+  for (i = 0 ; i < 4 ; i++)
+    threads[i] = CreateThread (NULL, 0, bench_duplex_run, &sides[i], 0,
+			       NULL) ;
+  Sleep (seconds * 1000) ;
+  InterlockedExchange (&stop, 1) ;
+  WaitForMultipleObjects (4, threads, TRUE, INFINITE) ;
+
+  for (i = 0 ; i < 4 ; i++)
+    {
+      CloseHandle (threads[i]) ;
+      if (sides[i].borrow != OFC_NULL)
+	ofc_socket_win32_return (sides[i].borrow) ;
+    }
+  /*
+   * Sides 1 and 3 receive what 2 and 0 sent
+   */
+  printf ("%-8s A->B %8.1f MB/s  B->A %8.1f MB/s\n", name,
+	  sides[3].bytes / (1048576.0 * seconds),
+	  sides[1].bytes / (1048576.0 * seconds)) ;
+}
+
+int main(int argc, char **argv)
+{
+  OFC_HANDLE hListen ;
+  OFC_HANDLE hA ;
+  OFC_HANDLE hB ;
+  OFC_IPADDR ip ;
+  OFC_IPADDR peer ;
+  OFC_UINT16 peer_port ;
+  OFC_UINT16 port ;
+  OFC_INT seconds ;
+  DWORD start ;
+  int ret ;
+
+  seconds = (argc > 1) ? atoi (argv[1]) : BENCH_DUPLEX_SECONDS ;
+  port = (OFC_UINT16) ((argc > 2) ? atoi (argv[2]) : BENCH_DUPLEX_PORT) ;
+  ret = 1 ;
+
+  ofc_framework_init () ;
+  ofc_pton ("127.0.0.1", &ip) ;
+
+  hB = OFC_HANDLE_NULL ;
+  hListen = ofc_socket_impl_create (OFC_FAMILY_IP, SOCKET_TYPE_STREAM) ;
+  hA = ofc_socket_impl_create (OFC_FAMILY_IP, SOCKET_TYPE_STREAM) ;
+  if (hListen != OFC_HANDLE_NULL && hA != OFC_HANDLE_NULL &&
+      ofc_socket_impl_bind (hListen, &ip, port) &&
+      ofc_socket_impl_listen (hListen, 1))
+    {
+      ofc_socket_impl_connect (hA, &ip, port) ;
+      start = GetTickCount () ;
+      do
+	{
+	  Sleep (1) ;
+	  hB = ofc_socket_impl_accept (hListen, &peer, &peer_port) ;
+	}
+      while (hB == OFC_HANDLE_NULL && GetTickCount () - start < 5000) ;
+    }
+
+  if (hB == OFC_HANDLE_NULL)
+    printf ("Could not connect over 127.0.0.1:%u\n", port) ;
+  else
+    {
+      bench_duplex ("locked", hA, hB, OFC_FALSE, seconds) ;
+      bench_duplex ("borrowed", hA, hB, OFC_TRUE, seconds) ;
+      ofc_socket_impl_close (hB) ;
+      ofc_socket_impl_destroy (hB) ;
+      ret = 0 ;
+    }
+
+  if (hA != OFC_HANDLE_NULL)
+    {
+      ofc_socket_impl_close (hA) ;
+      ofc_socket_impl_destroy (hA) ;
+    }
+  if (hListen != OFC_HANDLE_NULL)
+    {
+      ofc_socket_impl_close (hListen) ;
+      ofc_socket_impl_destroy (hListen) ;
+    }
+  ofc_socket_win32_shutdown () ;
+  ofc_framework_destroy () ;
+  return (ret) ;
+}
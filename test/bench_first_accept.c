@@ -0,0 +1,220 @@
+/* Copyright (c) 2021 Connected Way, LLC. All rights reserved.
+ * Use of this source code is governed by a Creative Commons
+ * Attribution-NoDerivatives 4.0 International license that can be
+ * found in the LICENSE file.
+ */
+/*
+ * Startup benchmark: time to the first accepted connection.
+ *
+ * Each run starts a fresh copy of this program as a server, which
+ * brings up the framework, listens and exits after its first accept.
+ * The parent connects as soon as the port answers and times the run
+ * from process creation to the connect completing.  The server reports
+ * its own view, the first accept milestone and the phase timings from
+ * the startup report.  A new process per run is what makes this a
+ * startup measurement, since loader, WSAStartup and first use costs
+ * are paid only once per process.
+ *
+ * Usage: bench_first_accept [runs [port]]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include <windows.h>
+
+#include "ofc/types.h"
+#include "ofc/framework.h"
+#include "ofc/net.h"
+#include "ofc/socket.h"
+#include "ofc/impl/socketimpl.h"
+
+#include "ofc_windows/socket_windows.h"
+#include "ofc_windows/startup_windows.h"
+
+#define BENCH_ACCEPT_RUNS 10
+#define BENCH_ACCEPT_PORT 47046
+#define BENCH_ACCEPT_WAIT 10000
+
+static const char *bench_accept_names[OFC_STARTUP_NUM] =
+  {
+    "wsastartup", "socket", "sockmem", "bufpool", "connpool",
+    "dnscache", "interfaces", "environment", "console", "first accept"
+  } ;
+
+/*
+ * The server side.  Returns the process exit code.
+ */
+static int bench_accept_server(OFC_UINT16 port)
+{
+  OFC_HANDLE hListen ;
+  OFC_HANDLE hAccept ;
+  OFC_IPADDR ip ;
+  OFC_UINT16 peer_port ;
+  OFC_STARTUP_TIMING timing ;
+  DWORD start ;
+  OFC_INT phase ;
+  int ret ;
+
+  ret = 1 ;
+  ofc_framework_init () ;
+  ofc_pton ("127.0.0.1", &ip) ;
+  hAccept = OFC_HANDLE_NULL ;
+  hListen = ofc_socket_impl_create (OFC_FAMILY_IP, SOCKET_TYPE_STREAM) ;
+  if (hListen != OFC_HANDLE_NULL)
+    {
+      ofc_socket_impl_reuse_addr (hListen, OFC_TRUE) ;
+      if (ofc_socket_impl_bind (hListen, &ip, port) &&
+	  ofc_socket_impl_listen (hListen, 1))
+	{
+	  start = GetTickCount () ;
+	  do
+	    {
+	      hAccept = ofc_socket_impl_accept (hListen, &ip, &peer_port) ;
+	      if (hAccept == OFC_HANDLE_NULL)
+		Sleep (0) ;
+	    }
+	  while (hAccept == OFC_HANDLE_NULL &&
+		 GetTickCount () - start < BENCH_ACCEPT_WAIT) ;
+	}
+    }
+
+  if (hAccept != OFC_HANDLE_NULL)
+    {
+      for (phase = 0 ; phase < OFC_STARTUP_NUM ; phase++)
+	{
+	  if (ofc_startup_report (phase, &timing))
+	    printf ("  %-13s at %8llu us took %8llu us over %u runs\n",
+		    bench_accept_names[phase], timing.offset,
+		    timing.duration, timing.count) ;
+	}
+      ofc_socket_impl_close (hAccept) ;
+      ofc_socket_impl_destroy (hAccept) ;
+      ret = 0 ;
+    }
+  if (hListen != OFC_HANDLE_NULL)
+    {
+      ofc_socket_impl_close (hListen) ;
+      ofc_socket_impl_destroy (hListen) ;
+    }
+  ofc_socket_win32_shutdown () ;
+  ofc_framework_destroy () ;
+  return (ret) ;
+}
+
+/*
+ * One run.  Returns the microseconds from starting the server to the
+ * connect completing, or zero on failure.
+ */
+static OFC_UINT64 bench_accept_run(const char *self, OFC_UINT16 port)
+{
+  STARTUPINFOA si ;
+  PROCESS_INFORMATION pi ;
+  LARGE_INTEGER freq ;
+  LARGE_INTEGER begin ;
+  LARGE_INTEGER end ;
+  struct sockaddr_in sa ;
+  char cmd[MAX_PATH + 32] ;
+  SOCKET s ;
+  OFC_BOOL connected ;
+  OFC_UINT64 ret ;
+
+  ret = 0 ;
+  connected = OFC_FALSE ;
+  _snprintf (cmd, sizeof (cmd), "\"%s\" --server %u", self, port) ;
+  cmd[sizeof (cmd) - 1] = '\0' ;
+  memset (&si, 0, sizeof (si)) ;
+  si.cb = sizeof (si) ;
+  memset (&sa, 0, sizeof (sa)) ;
+  sa.sin_family = AF_INET ;
+  sa.sin_port = htons (port) ;
+  sa.sin_addr.s_addr = htonl (INADDR_LOOPBACK) ;
+
+  QueryPerformanceFrequency (&freq) ;
+  QueryPerformanceCounter (&begin) ;
+  if (CreateProcessA (NULL, cmd, NULL, NULL, FALSE, 0, NULL, NULL, &si, &pi))
+    {
+      /*
+       * Refused until the server listens
+       */
+      while (!connected &&
+	     WaitForSingleObject (pi.hProcess, 0) == WAIT_TIMEOUT)
+	{
+	  s = socket (AF_INET, SOCK_STREAM, IPPROTO_TCP) ;
+	  if (s != INVALID_SOCKET)
+	    {
+	      if (connect (s, (struct sockaddr *) &sa, sizeof (sa)) == 0)
+		{
+		  QueryPerformanceCounter (&end) ;
+		  connected = OFC_TRUE ;
+		}
+	      closesocket (s) ;
+	    }
+	}
+      WaitForSingleObject (pi.hProcess, BENCH_ACCEPT_WAIT) ;
+      CloseHandle (pi.hThread) ;
+      CloseHandle (pi.hProcess) ;
+      if (connected)
+	ret = (OFC_UINT64) (end.QuadPart - begin.QuadPart) * 1000000 /
+	  freq.QuadPart ;
+    }
+  return (ret) ;
+}
+
+static int bench_accept_compare(const void *a, const void *b)
+{
+  OFC_UINT64 x ;
+  OFC_UINT64 y ;
+
+  x = *(const OFC_UINT64 *) a ;
+  y = *(const OFC_UINT64 *) b ;
+  return ((x > y) - (x < y)) ;
+}
+
+int main(int argc, char **argv)
+{
+  WSADATA wsaData ;
+  OFC_UINT64 *times ;
+  OFC_INT runs ;
+  OFC_INT done ;
+  OFC_INT i ;
+  OFC_UINT16 port ;
+  int ret ;
+
+  if (argc > 2 && strcmp (argv[1], "--server") == 0)
+    ret = bench_accept_server ((OFC_UINT16) atoi (argv[2])) ;
+  else
+    {
+      runs = (argc > 1) ? atoi (argv[1]) : BENCH_ACCEPT_RUNS ;
+      port = (OFC_UINT16) ((argc > 2) ? atoi (argv[2]) : BENCH_ACCEPT_PORT) ;
+      ret = 1 ;
+      times = malloc (sizeof (OFC_UINT64) * (runs > 0 ? runs : 1)) ;
+      if (times != NULL && WSAStartup (MAKEWORD (2, 2), &wsaData) == 0)
+	{
+	  for (done = 0, i = 0 ; i < runs ; i++)
+	    {
+	      printf ("run %d\n", i + 1) ;
+	      times[done] = bench_accept_run (argv[0], port) ;
+	      if (times[done] > 0)
+		{
+		  printf ("  process start to first accept %llu us\n",
+			  times[done]) ;
+		  done++ ;
+		}
+	      else
+		printf ("  no connection\n") ;
+	    }
+	  if (done > 0)
+	    {
+	      qsort (times, done, sizeof (OFC_UINT64), bench_accept_compare) ;
+	      printf ("%d runs: min %llu us, median %llu us, max %llu us\n",
+		      done, times[0], times[done / 2], times[done - 1]) ;
+	      ret = 0 ;
+	    }
+	  WSACleanup () ;
+	}
+      free (times) ;
+    }
+  return (ret) ;
+}
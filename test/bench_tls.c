@@ -0,0 +1,146 @@
+/* Copyright (c) 2021 Connected Way, LLC. All rights reserved.
+ * Use of this source code is governed by a Creative Commons
+ * Attribution-NoDerivatives 4.0 International license that can be
+ * found in the LICENSE file.
+ */
+/*
+ * Per call cost of thread variable access.
+ *
+ * After the framework is up, and the core has created its own thread
+ * variables, this creates variables until one falls back to a dynamic
+ * TLS slot.  It then times get and set on a fast slot, if any were
+ * left, on the dynamic slot and on a bare TlsGetValue and TlsSetValue
+ * for reference.  The count of fast slots the core left free shows
+ * whether its variables landed in the fast set.
+ *
+ * Usage: bench_tls [iterations]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <windows.h>
+
+#include "ofc/types.h"
+#include "ofc/framework.h"
+#include "ofc/impl/threadimpl.h"
+
+#include "ofc_windows/config.h"
+
+#define BENCH_TLS_ITERATIONS 100000000
+#define BENCH_TLS_FAST_KEY 0x80000000U
+
+static volatile OFC_DWORD_PTR bench_tls_sink ;
+
+static double bench_tls_elapsed(LARGE_INTEGER *begin, OFC_INT iterations)
+{
+  LARGE_INTEGER end ;
+  LARGE_INTEGER freq ;
+
+  QueryPerformanceCounter (&end) ;
+  QueryPerformanceFrequency (&freq) ;
+  return ((double) (end.QuadPart - begin->QuadPart) * 1e9 /
+	  (double) freq.QuadPart / iterations) ;
+}
+
+static OFC_VOID bench_tls_var(const char *name, OFC_DWORD var,
+			      OFC_INT iterations)
+{
+  LARGE_INTEGER begin ;
+  OFC_DWORD_PTR sum ;
+  double get ;
+  double set ;
+  OFC_INT i ;
+
+  QueryPerformanceCounter (&begin) ;
+  for (i = 0 ; i < iterations ; i++)
+    ofc_thread_set_variable_impl (var, (OFC_DWORD_PTR) i) ;
+  set = bench_tls_elapsed (&begin, iterations) ;
+
+  sum = 0 ;
+  QueryPerformanceCounter (&begin) ;
+  for (i = 0 ; i < iterations ; i++)
+    sum += ofc_thread_get_variable_impl (var) ;
+  get = bench_tls_elapsed (&begin, iterations) ;
+  bench_tls_sink = sum ;
+
+  printf ("%-10s get %6.2f ns  set %6.2f ns\n", name, get, set) ;
+}
+
+static OFC_VOID bench_tls_raw(OFC_INT iterations)
+{
+  LARGE_INTEGER begin ;
+  OFC_DWORD_PTR sum ;
+  DWORD slot ;
+  double get ;
+  double set ;
+  OFC_INT i ;
+
+  slot = TlsAlloc () ;
+  if (slot != TLS_OUT_OF_INDEXES)
+    {
+      QueryPerformanceCounter (&begin) ;
+      for (i = 0 ; i < iterations ; i++)
+	TlsSetValue (slot, (LPVOID) (OFC_DWORD_PTR) i) ;
+      set = bench_tls_elapsed (&begin, iterations) ;
+
+      sum = 0 ;
+      QueryPerformanceCounter (&begin) ;
+      for (i = 0 ; i < iterations ; i++)
+	sum += (OFC_DWORD_PTR) TlsGetValue (slot) ;
+      get = bench_tls_elapsed (&begin, iterations) ;
+      bench_tls_sink = sum ;
+
+      printf ("%-10s get %6.2f ns  set %6.2f ns\n", "TlsGetValue", get, set) ;
+      TlsFree (slot) ;
+    }
+}
+
+int main(int argc, char **argv)
+{
+  OFC_DWORD vars[OFC_THREAD_TLS_FAST + 1] ;
+  OFC_DWORD fast ;
+  OFC_DWORD dynamic ;
+  OFC_INT iterations ;
+  OFC_INT free_fast ;
+  OFC_INT count ;
+  OFC_BOOL spilled ;
+  OFC_INT i ;
+
+  iterations = (argc > 1) ? atoi (argv[1]) : BENCH_TLS_ITERATIONS ;
+  ofc_framework_init () ;
+
+  /*
+   * At most OFC_THREAD_TLS_FAST fast slots are left, so one more
+   * variable than that is always dynamic
+   */
+  fast = 0 ;
+  dynamic = 0 ;
+  free_fast = 0 ;
+  spilled = OFC_FALSE ;
+  for (count = 0 ; count < OFC_THREAD_TLS_FAST + 1 && !spilled ; count++)
+    {
+      vars[count] = ofc_thread_create_variable_impl () ;
+      if (vars[count] & BENCH_TLS_FAST_KEY)
+	{
+	  if (free_fast == 0)
+	    fast = vars[count] ;
+	  free_fast++ ;
+	}
+      else
+	{
+	  dynamic = vars[count] ;
+	  spilled = OFC_TRUE ;
+	}
+    }
+
+  printf ("%d of %d fast slots left after framework init\n", free_fast,
+	  OFC_THREAD_TLS_FAST) ;
+  if (free_fast > 0)
+    bench_tls_var ("fast", fast, iterations) ;
+  bench_tls_var ("dynamic", dynamic, iterations) ;
+  bench_tls_raw (iterations) ;
+
+  for (i = 0 ; i < count ; i++)
+    ofc_thread_destroy_variable_impl (vars[i]) ;
+  ofc_framework_destroy () ;
+  return (0) ;
+}
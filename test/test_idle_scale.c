@@ -0,0 +1,178 @@
+/* Copyright (c) 2021 Connected Way, LLC. All rights reserved.
+ * Use of this source code is governed by a Creative Commons
+ * Attribution-NoDerivatives 4.0 International license that can be
+ * found in the LICENSE file.
+ */
+/*
+ * Loopback scale test for idle mode.
+ *
+ * Opens count connections over loopback, puts the accepted side of
+ * each in idle mode with a large receive buffer and checks that
+ * ofc_socket_win32_idle_stats adds up to count times the cost of one
+ * idle connection.  With the default receive size the kernel total
+ * passes 2GB well before the default count.  A byte sent on one client
+ * must then take its server socket out of idle mode.
+ *
+ * Usage: test_idle_scale [count [port]]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <winsock2.h>
+#include <windows.h>
+
+#include "ofc/types.h"
+#include "ofc/framework.h"
+#include "ofc/net.h"
+#include "ofc/socket.h"
+#include "ofc/impl/socketimpl.h"
+#include "ofc/heap.h"
+
+#include "ofc_windows/socket_windows.h"
+
+#define TEST_IDLE_COUNT 12000
+#define TEST_IDLE_PORT 47035
+#define TEST_IDLE_RCVBUF (256 * 1024)
+#define TEST_IDLE_WAIT 5000
+
+static OFC_HANDLE test_accept(OFC_HANDLE hListen)
+{
+  OFC_HANDLE ret ;
+  OFC_IPADDR ip ;
+  OFC_UINT16 port ;
+  DWORD start ;
+
+  start = GetTickCount () ;
+  do
+    {
+      ret = ofc_socket_impl_accept (hListen, &ip, &port) ;
+      if (ret == OFC_HANDLE_NULL)
+	Sleep (0) ;
+    }
+  while (ret == OFC_HANDLE_NULL && GetTickCount () - start < TEST_IDLE_WAIT) ;
+  return (ret) ;
+}
+
+int main(int argc, char **argv)
+{
+  OFC_HANDLE hListen ;
+  OFC_HANDLE *clients ;
+  OFC_HANDLE *servers ;
+  OFC_IPADDR ip ;
+  OFC_INT count ;
+  OFC_INT opened ;
+  OFC_INT idle ;
+  OFC_INT handles ;
+  OFC_UINT16 port ;
+  OFC_SIZET bytes ;
+  OFC_SIZET kernel ;
+  OFC_SIZET one_bytes ;
+  OFC_SIZET one_kernel ;
+  OFC_SOCKET_EVENT_TYPE events ;
+  DWORD start ;
+  OFC_INT i ;
+  int ret ;
+
+  count = (argc > 1) ? atoi (argv[1]) : TEST_IDLE_COUNT ;
+  port = (OFC_UINT16) ((argc > 2) ? atoi (argv[2]) : TEST_IDLE_PORT) ;
+  ret = 1 ;
+  one_bytes = 0 ;
+  one_kernel = 0 ;
+
+  ofc_framework_init () ;
+  ofc_pton ("127.0.0.1", &ip) ;
+
+  clients = malloc (sizeof (OFC_HANDLE) * count) ;
+  servers = malloc (sizeof (OFC_HANDLE) * count) ;
+  hListen = ofc_socket_impl_create (OFC_FAMILY_IP, SOCKET_TYPE_STREAM) ;
+  if (clients == NULL || servers == NULL || hListen == OFC_HANDLE_NULL ||
+      !ofc_socket_impl_bind (hListen, &ip, port) ||
+      !ofc_socket_impl_listen (hListen, SOMAXCONN))
+    {
+      printf ("Could not listen on 127.0.0.1:%u\n", port) ;
+      count = 0 ;
+    }
+
+  start = GetTickCount () ;
+  for (opened = 0 ; opened < count ; opened++)
+    {
+      clients[opened] = ofc_socket_impl_create (OFC_FAMILY_IP,
+						SOCKET_TYPE_STREAM) ;
+      if (clients[opened] == OFC_HANDLE_NULL)
+	break ;
+      ofc_socket_impl_connect (clients[opened], &ip, port) ;
+      servers[opened] = test_accept (hListen) ;
+      if (servers[opened] == OFC_HANDLE_NULL)
+	{
+	  ofc_socket_impl_close (clients[opened]) ;
+	  ofc_socket_impl_destroy (clients[opened]) ;
+	  break ;
+	}
+      ofc_socket_impl_set_recv_size (servers[opened], TEST_IDLE_RCVBUF) ;
+      ofc_socket_win32_idle (servers[opened], OFC_TRUE) ;
+      if (opened == 0)
+	ofc_socket_win32_idle_stats (OFC_NULL, &one_bytes, OFC_NULL,
+				     &one_kernel) ;
+    }
+
+  ofc_socket_win32_idle_stats (&idle, &bytes, &handles, &kernel) ;
+  printf ("%d of %d connections opened in %lu ms\n", opened, count,
+	  (unsigned long) (GetTickCount () - start)) ;
+  printf ("%d idle, %llu user bytes, %d handles, %llu kernel bytes\n",
+	  idle, (unsigned long long) bytes, handles,
+	  (unsigned long long) kernel) ;
+  if (opened > 0)
+    printf ("%llu user bytes and %llu kernel bytes per connection\n",
+	    (unsigned long long) bytes / opened,
+	    (unsigned long long) kernel / opened) ;
+
+  if (opened < count)
+    printf ("Ran out of connections after %d\n", opened) ;
+  else if (idle != count)
+    printf ("Idle count %d, expected %d\n", idle, count) ;
+  else if (kernel != one_kernel * count || bytes < one_bytes * count)
+    printf ("Idle totals do not add up, expected %llu kernel bytes\n",
+	    (unsigned long long) one_kernel * count) ;
+  else if (count > 0)
+    {
+      /*
+       * Data on any idle connection must wake its server socket
+       */
+      ofc_socket_impl_send (clients[count / 2], "x", 1) ;
+      start = GetTickCount () ;
+      do
+	{
+	  Sleep (1) ;
+	  events = ofc_socket_impl_test (servers[count / 2]) ;
+	}
+      while (!(events & OFC_SOCKET_EVENT_READ) &&
+	     GetTickCount () - start < TEST_IDLE_WAIT) ;
+      ofc_socket_win32_idle_stats (&idle, OFC_NULL, OFC_NULL, OFC_NULL) ;
+      if (!(events & OFC_SOCKET_EVENT_READ))
+	printf ("Idle socket was not woken by data\n") ;
+      else if (idle != count - 1)
+	printf ("Woken socket still counted idle\n") ;
+      else
+	ret = 0 ;
+    }
+
+  for (i = 0 ; i < opened ; i++)
+    {
+      ofc_socket_impl_close (servers[i]) ;
+      ofc_socket_impl_destroy (servers[i]) ;
+      ofc_socket_impl_close (clients[i]) ;
+      ofc_socket_impl_destroy (clients[i]) ;
+    }
+  if (hListen != OFC_HANDLE_NULL)
+    {
+      ofc_socket_impl_close (hListen) ;
+      ofc_socket_impl_destroy (hListen) ;
+    }
+  free (clients) ;
+  free (servers) ;
+
+  ofc_socket_win32_shutdown () ;
+  ofc_framework_destroy () ;
+
+  printf ("%s\n", ret == 0 ? "PASS" : "FAIL") ;
+  return (ret) ;
+}
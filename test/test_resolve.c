@@ -0,0 +1,131 @@
+/* Copyright (c) 2021 Connected Way, LLC. All rights reserved.
+ * Use of this source code is governed by a Creative Commons
+ * Attribution-NoDerivatives 4.0 International license that can be
+ * found in the LICENSE file.
+ */
+/*
+ * Asynchronous resolver test against a local stub.
+ *
+ * The stub answers fixed names, so the test needs no DNS server and
+ * can make a lookup fail or stall on demand.  It checks a completed
+ * lookup, a name that does not exist and its negative cache entry, a
+ * server failure that must not be cached, a timeout and a cancel.
+ *
+ * Usage: test_resolve
+ */
+#include <stdio.h>
+#include <string.h>
+#include <winsock2.h>
+#include <windows.h>
+
+#include "ofc/types.h"
+#include "ofc/framework.h"
+#include "ofc/event.h"
+#include "ofc/net.h"
+
+#include "ofc_windows/dnscache_windows.h"
+#include "ofc_windows/resolve_windows.h"
+
+#define TEST_RESOLVE_SLOW 2000
+
+static volatile LONG test_resolve_calls = 0 ;
+
+static OFC_INT test_resolve_stub(OFC_LPCSTR name, OFC_UINT16 *num_addrs,
+				 OFC_IPADDR *ip)
+{
+  OFC_INT ret ;
+
+  InterlockedIncrement (&test_resolve_calls) ;
+  ret = 0 ;
+  if (strcmp (name, "host.test") == 0 && *num_addrs > 0)
+    {
+      ip[0].ip_version = OFC_FAMILY_IP ;
+      ip[0].u.ipv4.addr = 0x0a000001 ;
+      *num_addrs = 1 ;
+    }
+  else if (strcmp (name, "missing.test") == 0)
+    ret = WSAHOST_NOT_FOUND ;
+  else if (strcmp (name, "broken.test") == 0)
+    ret = WSATRY_AGAIN ;
+  else
+    {
+      Sleep (TEST_RESOLVE_SLOW) ;
+      ret = WSATRY_AGAIN ;
+    }
+  return (ret) ;
+}
+
+/*
+ * Run a request to its end and check its status and the number of
+ * times it reached the stub
+ */
+static OFC_BOOL test_resolve(OFC_LPCSTR name, OFC_MSTIME timeout,
+			     OFC_BOOL cancel, OFC_RESOLVE_STATUS expect,
+			     LONG calls)
+{
+  OFC_RESOLVE *resolve ;
+  OFC_RESOLVE_STATUS status ;
+  OFC_IPADDR ip ;
+  OFC_UINT16 count ;
+  OFC_BOOL ret ;
+  LONG before ;
+
+  ret = OFC_FALSE ;
+  before = test_resolve_calls ;
+  resolve = ofc_resolve_start (name, timeout) ;
+  if (resolve != OFC_NULL)
+    {
+      if (cancel)
+	ofc_resolve_cancel (resolve) ;
+      ofc_event_wait (ofc_resolve_event (resolve)) ;
+      count = 1 ;
+      status = ofc_resolve_result (resolve, &count, &ip) ;
+      ofc_resolve_destroy (resolve) ;
+      /*
+       * A stalled lookup may still be running, and counted, after its
+       * request finished
+       */
+      ret = status == expect &&
+	(calls < 0 || test_resolve_calls - before == calls) &&
+	(status != OFC_RESOLVE_DONE ||
+	 (count == 1 && ip.u.ipv4.addr == 0x0a000001)) ;
+      printf ("%-14s status %d, expected %d: %s\n", name, status, expect,
+	      ret ? "ok" : "FAILED") ;
+    }
+  return (ret) ;
+}
+
+int main(int argc, char **argv)
+{
+  OFC_BOOL ok ;
+
+  ofc_framework_init () ;
+  ofc_resolve_set_stub (test_resolve_stub) ;
+  ofc_dnscache_flush () ;
+
+  ok = test_resolve ("host.test", 0, OFC_FALSE, OFC_RESOLVE_DONE, 1) ;
+  /*
+   * Answered from the cache the second time
+   */
+  ok &= test_resolve ("host.test", 0, OFC_FALSE, OFC_RESOLVE_DONE, 0) ;
+  ok &= test_resolve ("missing.test", 0, OFC_FALSE, OFC_RESOLVE_FAILED, 1) ;
+  ok &= test_resolve ("missing.test", 0, OFC_FALSE, OFC_RESOLVE_FAILED, 0) ;
+  /*
+   * A server failure is asked again
+   */
+  ok &= test_resolve ("broken.test", 0, OFC_FALSE, OFC_RESOLVE_FAILED, 1) ;
+  ok &= test_resolve ("broken.test", 0, OFC_FALSE, OFC_RESOLVE_FAILED, 1) ;
+  ok &= test_resolve ("slow.test", 200, OFC_FALSE, OFC_RESOLVE_TIMEOUT, -1) ;
+  ok &= test_resolve ("stalled.test", 0, OFC_TRUE, OFC_RESOLVE_CANCELLED,
+		      -1) ;
+
+  /*
+   * Let the stalled lookups drain before tearing down
+   */
+  Sleep (TEST_RESOLVE_SLOW) ;
+  ofc_resolve_set_stub (OFC_NULL) ;
+  ofc_framework_destroy () ;
+
+  printf ("%s\n", ok ? "PASS" : "FAIL") ;
+  return (ok ? 0 : 1) ;
+}